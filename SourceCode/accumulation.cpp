@@ -0,0 +1,19 @@
+#include <math.h>
+
+#include "accumulation.h"
+
+// ToneMapper.
+ToneMapper::ToneMapper(const ToneMapping &newToneMapping, int newMaxValue)
+    : toneMapping(newToneMapping)
+    , maxValue(newMaxValue) {
+    if (toneMapping.gamma==1.0f || toneMapping.gamma<=0.0f) {
+        return;
+    }
+    gammaTable.resize(gammaTableSize);
+    const double inverseGamma=1.0/toneMapping.gamma;
+    for (int i=0; i<gammaTableSize; ++i) {
+        // The index is the square root of the value.
+        const double root=double(i)/(gammaTableSize-1);
+        gammaTable[i]=int32_t(pow(root*root, inverseGamma)*maxValue+0.5);
+    }
+}
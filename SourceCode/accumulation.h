@@ -0,0 +1,104 @@
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+#include <stdint.h>
+#include <vector>
+
+/// The sum of the samples of a pixel, in linear floating point, where 1 is the full intensity of a channel.
+/// Samples are only added up here - averaging, tone mapping and quantizing are left to a single resolve pass,
+/// so adding more samples costs no conversions and loses no precision.
+struct AccumulatedColor {
+    float R, G, B;
+    /// The total weight of the samples, the number of samples if all of them have the default weight.
+    float weight;
+
+    /// Constructor.
+    AccumulatedColor() : R(0.0f), G(0.0f), B(0.0f), weight(0.0f) {}
+
+    /// Add a sample to the pixel. Values above 1 are kept, they are only brought into range when resolving.
+    void addSample(float red, float green, float blue, float sampleWeight=1.0f) {
+        R+=red*sampleWeight;
+        G+=green*sampleWeight;
+        B+=blue*sampleWeight;
+        weight+=sampleWeight;
+    }
+};
+
+/// The running mean and spread of the luminances of the samples of a pixel, to estimate its noise.
+/// Updated with Welford's method, which keeps the variance from cancelling out or going negative the way
+/// the mean of the squares minus the squared mean does in floating point.
+struct LuminanceMoments {
+    float mean;
+    /// The sum of the squared differences of the samples from their mean.
+    float squaredDeviations;
+    uint32_t count;
+
+    /// Constructor.
+    LuminanceMoments() : mean(0.0f), squaredDeviations(0.0f), count(0) {}
+
+    void addSample(float luminance) {
+        ++count;
+        const float difference=luminance-mean;
+        mean+=difference/count;
+        squaredDeviations+=difference*(luminance-mean);
+    }
+    /// The unbiased variance of the samples, 0 for fewer than two.
+    float findVariance() const {
+        return count>1 ? squaredDeviations/(count-1) : 0.0f;
+    }
+};
+
+/// How values above 1 are brought into the displayable range.
+enum class ToneMapOperator {
+    /// Cut them off at 1.
+    Clamp,
+    /// v/(1+v) - compresses the highlights smoothly instead of cutting them off.
+    Reinhard
+};
+
+/// The settings of the resolve pass.
+struct ToneMapping {
+    /// The multiplier of the averaged samples before tone mapping.
+    float exposure;
+    ToneMapOperator toneMapOperator;
+    /// The display gamma - the tone mapped values are raised to 1/gamma. 1 (or anything not above 0) keeps them linear.
+    float gamma;
+
+    /// Constructor. The defaults keep the samples linear and only clamp them.
+    ToneMapping() : exposure(1.0f), toneMapOperator(ToneMapOperator::Clamp), gamma(1.0f) {}
+};
+
+/// The tone mapping settings prepared for the resolve kernel.
+/// With a gamma other than 1, the gamma curve is looked up in a table instead of calling pow for each channel.
+/// The table is indexed by the square root of the value, which spreads the entries towards the dark end,
+/// where the curve is the steepest.
+class ToneMapper {
+private:
+    ToneMapping toneMapping;
+    /// The max intensity value of the quantized channels.
+    int maxValue;
+    /// The quantized output for each index, empty if the gamma is 1.
+    std::vector<int32_t> gammaTable;
+public:
+    /// The number of entries in the gamma table.
+    static constexpr int gammaTableSize=4096;
+
+    /// Constructor.
+    ToneMapper(const ToneMapping &newToneMapping, int newMaxValue);
+
+    /// Getters.
+    const ToneMapping &getToneMapping() const {
+        return toneMapping;
+    }
+    int getMaxValue() const {
+        return maxValue;
+    }
+    bool usesGammaTable() const {
+        return !gammaTable.empty();
+    }
+    const int32_t *getGammaTable() const {
+        return gammaTable.data();
+    }
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "animation.h"
+#include "arena.h"
+#include "blockingqueue.h"
+
+// CameraPath.
+void CameraPath::addKeyframe(const CameraKeyframe &keyframe) {
+    const std::vector<CameraKeyframe>::iterator position=std::upper_bound(keyframes.begin(), keyframes.end(), keyframe,
+        [](const CameraKeyframe &first, const CameraKeyframe &second) { return first.time<second.time; });
+    keyframes.insert(position, keyframe);
+}
+
+Camera CameraPath::evaluate(float time, size_t width, size_t height) const {
+    if (keyframes.empty()) {
+        return Camera(width, height);
+    }
+    if (time<=keyframes.front().time) {
+        const CameraKeyframe &first=keyframes.front();
+        return Camera(width, height, first.position, first.target, first.worldUp);
+    }
+    if (time>=keyframes.back().time) {
+        const CameraKeyframe &last=keyframes.back();
+        return Camera(width, height, last.position, last.target, last.worldUp);
+    }
+    // The first keyframe after the time. There is always one before it, since the time is past the first keyframe.
+    size_t next=1;
+    while (keyframes[next].time<=time) {
+        ++next;
+    }
+    const CameraKeyframe &from=keyframes[next-1];
+    const CameraKeyframe &to=keyframes[next];
+    const float ratio=(time-from.time)/(to.time-from.time);
+    const Vector &position=from.position+(to.position-from.position)*ratio;
+    const Vector &target=from.target+(to.target-from.target)*ratio;
+    const Vector &worldUp=from.worldUp+(to.worldUp-from.worldUp)*ratio;
+    return Camera(width, height, position, target, worldUp);
+}
+
+// AnimationRenderer.
+namespace {
+
+/// A rendered frame on its way to the writer thread.
+struct RenderedFrame {
+    size_t index=0;
+    FrameBuffer<Color> pixels;
+};
+
+double getMillisecondsSince(const std::chrono::steady_clock::time_point &start) {
+    const std::chrono::duration<double, std::milli> elapsed=std::chrono::steady_clock::now()-start;
+    return elapsed.count();
+}
+
+}
+
+AnimationRenderer::AnimationRenderer(const BVH &newScene, const AnimationSettings &newSettings)
+    : scene(newScene)
+    , settings(newSettings)
+    , drawer(newSettings.outputFilePattern, newSettings.width, newSettings.height) {
+    drawer.changeScene(scene, settings.backgroundColor);
+    drawer.changeWavefront(settings.useWavefront);
+}
+
+std::string AnimationRenderer::getFrameFilePath(size_t frameIndex) const {
+    const int length=snprintf(nullptr, 0, settings.outputFilePattern.c_str(), int(frameIndex));
+    if (length<0) {
+        return settings.outputFilePattern;
+    }
+    std::string filePath(size_t(length)+1, '\0');
+    snprintf(&filePath[0], filePath.size(), settings.outputFilePattern.c_str(), int(frameIndex));
+    filePath.resize(size_t(length));
+    return filePath;
+}
+
+bool AnimationRenderer::render(const CameraPath &path) {
+    statistics=AnimationStatistics();
+    const size_t queueDepth=std::max<size_t>(settings.queueDepth, 1);
+    // The drawer renders into one buffer while up to queueDepth others wait for, or are in, the writer.
+    BlockingQueue<FrameBuffer<Color>> freeBuffers(queueDepth);
+    BlockingQueue<RenderedFrame> renderedFrames(queueDepth);
+    for (size_t i=0; i<queueDepth; ++i) {
+        freeBuffers.push(FrameBuffer<Color>(settings.width, settings.height));
+    }
+
+    std::atomic<bool> writeFailed(false);
+    const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    const ArenaStatistics &scratchStart=getScratchStatistics();
+    std::thread writer([&]() {
+        RenderedFrame frame;
+        while (renderedFrames.pop(frame)) {
+            const std::chrono::steady_clock::time_point writeStart=std::chrono::steady_clock::now();
+            const std::unique_ptr<ImageWriter> &imageWriter=createImageWriter(settings.outputFormat,
+                                                                              getFrameFilePath(frame.index));
+            if (imageWriter->writeImage(frame.pixels, 255)) {
+                ++statistics.framesWritten;
+                statistics.rawBytes+=imageWriter->getStatistics().rawBytes;
+                statistics.encodedBytes+=imageWriter->getStatistics().encodedBytes;
+            } else {
+                writeFailed=true;
+            }
+            statistics.writeMilliseconds+=getMillisecondsSince(writeStart);
+            freeBuffers.push(std::move(frame.pixels));
+        }
+    });
+
+    try {
+        const float startTime=path.getStartTime();
+        const float duration=path.getEndTime()-startTime;
+        for (size_t i=0; i<settings.frameCount; ++i) {
+            const float ratio=settings.frameCount>1 ? float(i)/float(settings.frameCount-1) : 0.0f;
+            drawer.changeCamera(path.evaluate(startTime+duration*ratio, settings.width, settings.height));
+            const std::chrono::steady_clock::time_point renderStart=std::chrono::steady_clock::now();
+            drawer.fillPixelsFromRays();
+            statistics.renderMilliseconds+=getMillisecondsSince(renderStart);
+            ++statistics.framesRendered;
+
+            // Hand the frame over to the writer and keep rendering into a buffer it is done with.
+            const std::chrono::steady_clock::time_point stallStart=std::chrono::steady_clock::now();
+            FrameBuffer<Color> freeBuffer;
+            freeBuffers.pop(freeBuffer);
+            statistics.stallMilliseconds+=getMillisecondsSince(stallStart);
+            RenderedFrame frame;
+            frame.index=i;
+            frame.pixels=drawer.exchangeFrameBuffer(std::move(freeBuffer));
+            renderedFrames.push(std::move(frame));
+        }
+    } catch (...) {
+        renderedFrames.close();
+        writer.join();
+        throw;
+    }
+    renderedFrames.close();
+    writer.join();
+
+    statistics.totalMilliseconds=getMillisecondsSince(start);
+    const ArenaStatistics &scratchEnd=getScratchStatistics();
+    statistics.scratchAllocations=scratchEnd.allocations-scratchStart.allocations;
+    statistics.scratchHeapAllocations=scratchEnd.heapAllocations-scratchStart.heapAllocations;
+    if (statistics.totalMilliseconds>0.0) {
+        statistics.framesPerSecond=statistics.framesWritten*1000.0/statistics.totalMilliseconds;
+    }
+    const double frameCount=std::max<double>(statistics.framesRendered, 1.0);
+    printf("Animation: %zu frames in %.1f ms, %.2f frames per second.\n",
+           statistics.framesWritten, statistics.totalMilliseconds, statistics.framesPerSecond);
+    printf("  render: %.1f ms (%.2f ms per frame)\n", statistics.renderMilliseconds, statistics.renderMilliseconds/frameCount);
+    printf("  write:  %.1f ms (%.2f ms per frame, in the background)\n", statistics.writeMilliseconds, statistics.writeMilliseconds/frameCount);
+    printf("  stall:  %.1f ms (rendering waiting for a free frame buffer)\n", statistics.stallMilliseconds);
+    printf("  output: %zu bytes (%.2fx compression)\n", statistics.encodedBytes,
+           statistics.encodedBytes>0 ? double(statistics.rawBytes)/statistics.encodedBytes : 0.0);
+    printf("  memory: %llu scratch allocations from %llu heap blocks\n", (unsigned long long)statistics.scratchAllocations,
+           (unsigned long long)statistics.scratchHeapAllocations);
+    if (writeFailed) {
+        printf("Some animation frames couldn't be written.\n");
+        return false;
+    }
+    return true;
+}
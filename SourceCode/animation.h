@@ -0,0 +1,122 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "draw.h"
+#include "imagewriter.h"
+
+/// Where the camera is and what it looks at, at a point in time.
+struct CameraKeyframe {
+    float time;
+    Vector position;
+    Vector target;
+    Vector worldUp;
+
+    /// Constructors.
+    CameraKeyframe(float newTime, const Vector &newPosition, const Vector &newTarget,
+                   const Vector &newWorldUp=Vector(0.0, 1.0, 0.0))
+        : time(newTime)
+        , position(newPosition)
+        , target(newTarget)
+        , worldUp(newWorldUp) {}
+};
+
+/// A camera path through a list of keyframes. Between two keyframes the position, the target
+/// and the up direction are interpolated linearly.
+class CameraPath {
+private:
+    /// The keyframes, sorted by time.
+    std::vector<CameraKeyframe> keyframes;
+public:
+    /// Add a keyframe. It can be added in any order - it is sorted in by its time.
+    void addKeyframe(const CameraKeyframe &keyframe);
+    /// The camera at a point in time. Before the first and after the last keyframe the camera stays still.
+    Camera evaluate(float time, size_t width, size_t height) const;
+
+    /// Getters.
+    const std::vector<CameraKeyframe> &getKeyframes() const {
+        return keyframes;
+    }
+    float getStartTime() const {
+        return keyframes.empty() ? 0.0f : keyframes.front().time;
+    }
+    float getEndTime() const {
+        return keyframes.empty() ? 0.0f : keyframes.back().time;
+    }
+};
+
+/// Everything about the frames an animation renders.
+struct AnimationSettings {
+    /// The path of every frame - a printf pattern with a single integer for the frame index, e.g. "frame_%04d.ppm".
+    std::string outputFilePattern="frame_%04d.ppm";
+    ImageFormat outputFormat=ImageFormat::PPMBinary;
+    size_t width=1920, height=1080;
+    /// The number of frames, spread evenly from the first to the last keyframe.
+    size_t frameCount=60;
+    /// The number of rendered frames that can wait to be written while the next ones render.
+    /// Rendering only blocks when all of them are taken.
+    size_t queueDepth=3;
+    /// The color of the pixels whose rays miss the scene.
+    Color backgroundColor;
+    /// Whether to render the frames as wavefronts of rays instead of pixel by pixel.
+    bool useWavefront=false;
+};
+
+/// How long an animation took and where the time went. The times are sums over all frames.
+struct AnimationStatistics {
+    size_t framesRendered=0;
+    size_t framesWritten=0;
+    /// From the start of the first frame until the last frame is on disk.
+    double totalMilliseconds=0.0;
+    /// Tracing the rays of the frames.
+    double renderMilliseconds=0.0;
+    /// Rendering waiting for the writer to give back a frame buffer.
+    double stallMilliseconds=0.0;
+    /// Encoding and writing the frames, on the writer thread.
+    double writeMilliseconds=0.0;
+    /// The frames per second sustained over the whole animation.
+    double framesPerSecond=0.0;
+    /// The size of the pixels of the written frames as 8-bit RGB, and the size of their files.
+    size_t rawBytes=0;
+    size_t encodedBytes=0;
+    /// What the scratch arenas of all threads served during the animation, and the heap blocks they took for it.
+    /// Once every thread has its blocks, rendering and writing more frames takes no more.
+    uint64_t scratchAllocations=0;
+    uint64_t scratchHeapAllocations=0;
+};
+
+/// Renders the frames of a camera animation, one after the other. The scene and its BVH are built once
+/// by the caller and shared by all frames. While a frame renders, the previous ones are encoded and written
+/// on a background thread. The frame buffers go around between the two threads and are reused.
+class AnimationRenderer {
+private:
+    const BVH &scene;
+    AnimationSettings settings;
+    RayDrawer drawer;
+    AnimationStatistics statistics;
+
+    /// The output file of a frame.
+    std::string getFrameFilePath(size_t frameIndex) const;
+public:
+    /// Constructors. The BVH must outlive the renderer.
+    AnimationRenderer(const BVH &newScene, const AnimationSettings &newSettings);
+
+    /// Change the scheduler the frames are rendered with. It must outlive the renderer.
+    void changeScheduler(TileScheduler &newScheduler) {
+        drawer.changeScheduler(newScheduler);
+    }
+    /// Render and write all frames of a path, then print how long each stage took.
+    /// Returns false if any frame couldn't be written.
+    bool render(const CameraPath &path);
+    /// The timings of the last render(..).
+    const AnimationStatistics &getStatistics() const {
+        return statistics;
+    }
+};
+
+#endif
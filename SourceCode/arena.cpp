@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <mutex>
+
+#include "arena.h"
+
+namespace {
+
+/// The alignment of every block, and so the largest alignment an allocation can ask for.
+const size_t blockAlignment=64;
+
+/// The scratch arenas of the running threads, and what the ended ones did.
+struct ScratchRegistry {
+    std::mutex mutex;
+    std::vector<const MemoryArena *> arenas;
+    ArenaStatistics endedStatistics;
+};
+
+/// Never destructed - threads can end after the static objects were destructed, e.g. the ones of the default scheduler.
+ScratchRegistry &getScratchRegistry() {
+    static ScratchRegistry *registry=new ScratchRegistry();
+    return *registry;
+}
+
+/// The scratch arena of a thread, registered for as long as the thread runs.
+struct ThreadScratch {
+    MemoryArena arena;
+
+    ThreadScratch() {
+        ScratchRegistry &registry=getScratchRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.arenas.push_back(&arena);
+    }
+    ~ThreadScratch() {
+        ScratchRegistry &registry=getScratchRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        // Only what the arena did is kept - its memory goes with the thread.
+        const ArenaStatistics &statistics=arena.getStatistics();
+        registry.endedStatistics.allocations+=statistics.allocations;
+        registry.endedStatistics.allocatedBytes+=statistics.allocatedBytes;
+        registry.endedStatistics.heapAllocations+=statistics.heapAllocations;
+        registry.arenas.erase(std::find(registry.arenas.begin(), registry.arenas.end(), &arena));
+    }
+};
+
+}
+
+// MemoryArena.
+void *MemoryArena::allocate(size_t size, size_t alignment) {
+    size=std::max<size_t>(size, 1);
+    for (;;) {
+        if (currentBlock<blocks.size()) {
+            const Block &block=blocks[currentBlock];
+            const uintptr_t start=reinterpret_cast<uintptr_t>(block.data);
+            const size_t alignedOffset=((start+offset+alignment-1)&~uintptr_t(alignment-1))-start;
+            if (alignedOffset+size<=block.size) {
+                offset=alignedOffset+size;
+                ++statistics.allocations;
+                statistics.allocatedBytes+=size;
+                statistics.usedBytes=bytesBeforeCurrent+offset;
+                statistics.peakUsedBytes=std::max(statistics.peakUsedBytes, statistics.usedBytes);
+                return block.data+alignedOffset;
+            }
+            // The rest of the block stays unused until the arena is rewound past it.
+            bytesBeforeCurrent+=block.size;
+            ++currentBlock;
+            offset=0;
+            continue;
+        }
+        const size_t newSize=(std::max(blockSize, size+alignment)+blockAlignment-1)/blockAlignment*blockAlignment;
+        char *data=static_cast<char *>(aligned_alloc(blockAlignment, newSize));
+        if (data==nullptr) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(Block{data, newSize});
+        ++statistics.heapAllocations;
+        statistics.reservedBytes+=newSize;
+    }
+}
+
+void MemoryArena::release() {
+    for (const Block &block : blocks) {
+        free(block.data);
+    }
+    blocks.clear();
+    statistics.reservedBytes=0;
+    reset();
+}
+
+MemoryArena &getScratchArena() {
+    thread_local ThreadScratch scratch;
+    return scratch.arena;
+}
+
+ArenaStatistics getScratchStatistics() {
+    ScratchRegistry &registry=getScratchRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    ArenaStatistics statistics=registry.endedStatistics;
+    for (const MemoryArena *arena : registry.arenas) {
+        statistics+=arena->getStatistics();
+    }
+    return statistics;
+}
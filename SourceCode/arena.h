@@ -0,0 +1,146 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// What an arena handed out and what it took from the heap to do it.
+struct ArenaStatistics {
+    /// The allocations the arena served and their bytes.
+    uint64_t allocations=0;
+    uint64_t allocatedBytes=0;
+    /// The blocks the arena took from the heap. Once the arena is warm it stops growing.
+    uint64_t heapAllocations=0;
+    /// The bytes from the start of the arena to where the next allocation goes, the most there ever were,
+    /// and the bytes of all blocks the arena holds.
+    size_t usedBytes=0;
+    size_t peakUsedBytes=0;
+    size_t reservedBytes=0;
+
+    ArenaStatistics &operator+=(const ArenaStatistics &other) {
+        allocations+=other.allocations;
+        allocatedBytes+=other.allocatedBytes;
+        heapAllocations+=other.heapAllocations;
+        usedBytes+=other.usedBytes;
+        peakUsedBytes+=other.peakUsedBytes;
+        reservedBytes+=other.reservedBytes;
+        return *this;
+    }
+};
+
+/// A monotonic allocator - memory is handed out by moving forward through big blocks taken from the heap,
+/// and given back all at once, by rewinding to an earlier point or by releasing the whole arena.
+/// Nothing is ever destructed, so only trivially destructible objects can live in it.
+/// An arena is not thread safe, every thread should have its own.
+class MemoryArena {
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    /// The block the next allocation comes from, where in it, and the sizes of the blocks before it.
+    size_t currentBlock;
+    size_t offset;
+    size_t bytesBeforeCurrent;
+    /// The size of new blocks. Bigger allocations get a block of their own.
+    size_t blockSize;
+    ArenaStatistics statistics;
+public:
+    /// A point in the arena to rewind to.
+    struct Marker {
+        size_t block;
+        size_t offset;
+        size_t bytesBeforeCurrent;
+    };
+
+    /// Constructors.
+    explicit MemoryArena(size_t newBlockSize=size_t(64)<<10)
+        : currentBlock(0)
+        , offset(0)
+        , bytesBeforeCurrent(0)
+        , blockSize(newBlockSize==0 ? 1 : newBlockSize) {}
+    MemoryArena(const MemoryArena &)=delete;
+    MemoryArena &operator=(const MemoryArena &)=delete;
+    ~MemoryArena() {
+        release();
+    }
+
+    /// Get size bytes with the given alignment, a power of two up to 64. Throws std::bad_alloc if the heap is out of memory.
+    void *allocate(size_t size, size_t alignment=alignof(max_align_t));
+    /// Get count value initialized objects of a type.
+    template <typename Type>
+    Type *allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible<Type>::value, "An arena never calls destructors.");
+        Type *values=static_cast<Type *>(allocate(count*sizeof(Type), alignof(Type)));
+        for (size_t i=0; i<count; ++i) {
+            new (values+i) Type();
+        }
+        return values;
+    }
+    /// Construct a single object in the arena.
+    template <typename Type, typename... Arguments>
+    Type *create(Arguments &&...arguments) {
+        static_assert(std::is_trivially_destructible<Type>::value, "An arena never calls destructors.");
+        return new (allocate(sizeof(Type), alignof(Type))) Type(std::forward<Arguments>(arguments)...);
+    }
+
+    /// The current point of the arena.
+    Marker getMarker() const {
+        return Marker{currentBlock, offset, bytesBeforeCurrent};
+    }
+    /// Give back everything allocated since the marker was taken. The blocks are kept for the next allocations.
+    void rewind(const Marker &marker) {
+        currentBlock=marker.block;
+        offset=marker.offset;
+        bytesBeforeCurrent=marker.bytesBeforeCurrent;
+        statistics.usedBytes=bytesBeforeCurrent+offset;
+    }
+    /// Give back everything, keeping the blocks.
+    void reset() {
+        rewind(Marker{0, 0, 0});
+    }
+    /// Give back everything and the blocks to the heap.
+    void release();
+
+    /// Getters.
+    const ArenaStatistics &getStatistics() const {
+        return statistics;
+    }
+};
+
+/// The scratch arena of the calling thread, for memory that only lives while a tile or a frame is being worked on.
+/// Use it through a ScratchScope, so whatever a tile takes is given back before the next one.
+MemoryArena &getScratchArena();
+/// The statistics of the scratch arenas of all threads added up, including the ones of the threads that ended.
+/// They are only exact while no other thread is using its arena, e.g. between two renders.
+ArenaStatistics getScratchStatistics();
+
+/// Takes memory from the scratch arena of the calling thread and gives all of it back when it goes out of scope.
+/// Scopes nest, e.g. a tile function inside a frame.
+class ScratchScope {
+private:
+    MemoryArena &arena;
+    MemoryArena::Marker marker;
+public:
+    /// Constructors.
+    ScratchScope() : arena(getScratchArena()), marker(arena.getMarker()) {}
+    ScratchScope(const ScratchScope &)=delete;
+    ScratchScope &operator=(const ScratchScope &)=delete;
+    ~ScratchScope() {
+        arena.rewind(marker);
+    }
+
+    /// Get count value initialized objects of a type, until the scope ends.
+    template <typename Type>
+    Type *allocateArray(size_t count) {
+        return arena.allocateArray<Type>(count);
+    }
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#include "accumulation.h"
+#include "batch.h"
+#include "draw.h"
+#include "imagewriter.h"
+#include "sceneloader.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double getMillisecondsSince(const Clock::time_point &start) {
+    return std::chrono::duration<double, std::milli>(Clock::now()-start).count();
+}
+
+/// Parse "x,y,z". Returns false if it isn't three numbers.
+bool parseVector(const std::string &text, Vector &vector) {
+    float x, y, z;
+    char rest;
+    if (sscanf(text.c_str(), "%f,%f,%f%c", &x, &y, &z, &rest)!=3) {
+        return false;
+    }
+    vector=Vector(x, y, z);
+    return true;
+}
+
+/// Parse a positive whole number. Returns false if it isn't one.
+bool parseCount(const std::string &text, size_t &count) {
+    char *end=nullptr;
+    const long long value=strtoll(text.c_str(), &end, 10);
+    if (text.empty() || *end!='\0' || value<=0) {
+        return false;
+    }
+    count=size_t(value);
+    return true;
+}
+
+/// Set a key of a job from its value. Returns false if the key is unknown or the value is wrong.
+bool parseJobValue(const std::string &key, const std::string &value, BatchJob &job) {
+    size_t count=0;
+    if (key=="name") {
+        job.name=value;
+    } else if (key=="scene") {
+        job.sceneFilePath=value;
+    } else if (key=="output") {
+        job.outputFilePath=value;
+    } else if (key=="width" && parseCount(value, count)) {
+        job.width=count;
+    } else if (key=="height" && parseCount(value, count)) {
+        job.height=count;
+    } else if (key=="samples" && parseCount(value, count) && count<=UINT32_MAX) {
+        job.samples=uint32_t(count);
+    } else if (key=="position" && parseVector(value, job.cameraPosition)) {
+        job.hasCamera=true;
+    } else if (key=="target" && parseVector(value, job.cameraTarget)) {
+        job.hasCamera=true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// The bytes the images of a job take while it renders - its pixels, and the sums of the samples when there are
+/// several. The copy of the scene normals the drawer makes comes on top.
+size_t estimateJobMemory(const BatchJob &job, const PreparedScene *scene, size_t width, size_t height) {
+    size_t bytes=width*height*sizeof(Color);
+    if (job.samples>1) {
+        bytes+=width*height*(sizeof(AccumulatedColor)+sizeof(LuminanceMoments)+sizeof(uint32_t));
+    }
+    if (scene) {
+        bytes+=scene->bvh.getTriangles().size()*sizeof(Vector);
+    }
+    return bytes;
+}
+
+/// Render a job with a scheduler, once it has its scene. Returns false if it couldn't be written.
+bool renderJob(const BatchJob &job, const PreparedScene &scene, TileScheduler &scheduler, BatchJobResult &result) {
+    const Clock::time_point renderStart=Clock::now();
+    const size_t width=job.width>0 ? job.width : scene.imageWidth;
+    const size_t height=job.height>0 ? job.height : scene.imageHeight;
+    RayDrawer rayDrawer(job.outputFilePath, width, height);
+    rayDrawer.changeScheduler(scheduler);
+    rayDrawer.changeScene(scene.bvh, scene.backgroundColor);
+    rayDrawer.changeCamera(job.hasCamera ? Camera(width, height, job.cameraPosition, job.cameraTarget) : scene.camera);
+    if (job.samples>1) {
+        // Every pixel gets exactly the samples of the job, so the time of a job doesn't depend on its noise.
+        SamplingSettings settings;
+        settings.initialSamples=job.samples;
+        settings.maxSamples=job.samples;
+        rayDrawer.fillPixelsFromRaysAdaptive(settings);
+    } else {
+        rayDrawer.fillPixelsFromRays();
+    }
+    result.renderMilliseconds=getMillisecondsSince(renderStart);
+
+    const Clock::time_point writeStart=Clock::now();
+    const std::unique_ptr<ImageWriter> &imageWriter=createImageWriter(findImageFormat(job.outputFilePath), job.outputFilePath);
+    imageWriter->changeScheduler(&scheduler);
+    const bool isWritten=imageWriter->writeImage(rayDrawer.getFrameBuffer(), 255);
+    result.writeMilliseconds=getMillisecondsSince(writeStart);
+    return isWritten;
+}
+
+}
+
+bool loadBatchManifest(const std::string &filePath, std::vector<BatchJob> &jobs) {
+    std::ifstream inputStream(filePath);
+    if (!inputStream.is_open()) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    jobs.clear();
+    std::string line;
+    for (size_t lineNumber=1; std::getline(inputStream, line); ++lineNumber) {
+        const size_t start=line.find_first_not_of(" \t\r");
+        if (start==std::string::npos || line[start]=='#') {
+            continue;
+        }
+        BatchJob job;
+        size_t position=start;
+        while (position<line.size()) {
+            const size_t end=std::min(line.find_first_of(" \t\r", position), line.size());
+            const std::string &pair=line.substr(position, end-position);
+            const size_t equals=pair.find('=');
+            if (equals==std::string::npos || !parseJobValue(pair.substr(0, equals), pair.substr(equals+1), job)) {
+                printf("Line %zu of the manifest: \"%s\" isn't a known key with a valid value.\n", lineNumber, pair.c_str());
+                return false;
+            }
+            const size_t next=line.find_first_not_of(" \t\r", end);
+            position=next==std::string::npos ? line.size() : next;
+        }
+        if (job.sceneFilePath.empty() || job.outputFilePath.empty()) {
+            printf("Line %zu of the manifest: a job needs a scene and an output.\n", lineNumber);
+            return false;
+        }
+        if (job.name.empty()) {
+            job.name=job.outputFilePath;
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+// SceneCache.
+void SceneCache::addUsers(const std::string &sceneFilePath, size_t userCount) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[sceneFilePath].remainingUsers+=userCount;
+}
+
+std::shared_ptr<const PreparedScene> SceneCache::acquire(const std::string &sceneFilePath, size_t threadCount) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Entry &entry=entries[sceneFilePath];
+    loadFinished.wait(lock, [&]() {
+        return !entry.isLoading;
+    });
+    if (entry.scene || entry.hasFailed) {
+        return entry.scene;
+    }
+    entry.isLoading=true;
+    lock.unlock();
+
+    // The other jobs of the scene wait for it, the jobs of other scenes go on.
+    const Clock::time_point start=Clock::now();
+    std::shared_ptr<PreparedScene> prepared;
+    Scene scene;
+    SceneLoadOptions options;
+    options.threadCount=threadCount;
+    if (loadScene(sceneFilePath, scene, options)) {
+        prepared=std::make_shared<PreparedScene>();
+        prepared->bvh.build(scene.mergeObjects(), threadCount);
+        prepared->backgroundColor=scene.getBackgroundColor();
+        prepared->camera=scene.getCamera();
+        prepared->imageWidth=scene.getImageWidth();
+        prepared->imageHeight=scene.getImageHeight();
+        prepared->memoryUsage=prepared->bvh.getNodes().capacity()*sizeof(BVHNode)
+            +prepared->bvh.getTriangles().capacity()*sizeof(TriangleRecord);
+        prepared->loadMilliseconds=getMillisecondsSince(start);
+    }
+
+    lock.lock();
+    entry.isLoading=false;
+    entry.hasFailed=!prepared;
+    entry.scene=prepared;
+    if (prepared) {
+        memoryUsage+=prepared->memoryUsage;
+        ++loadCount;
+    }
+    loadFinished.notify_all();
+    return entry.scene;
+}
+
+void SceneCache::release(const std::string &sceneFilePath) {
+    // Destructed after the lock is given back, so freeing a big BVH doesn't hold up the other jobs.
+    std::shared_ptr<const PreparedScene> droppedScene;
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::map<std::string, Entry>::iterator entry=entries.find(sceneFilePath);
+    if (entry==entries.end() || entry->second.remainingUsers==0 || --entry->second.remainingUsers>0) {
+        return;
+    }
+    if (entry->second.scene) {
+        memoryUsage-=entry->second.scene->memoryUsage;
+    }
+    droppedScene=std::move(entry->second.scene);
+    entries.erase(entry);
+}
+
+size_t SceneCache::getMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return memoryUsage;
+}
+
+size_t SceneCache::getLoadCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loadCount;
+}
+
+BatchStatistics runBatch(const std::vector<BatchJob> &jobs, const BatchSettings &settings, std::vector<BatchJobResult> &results) {
+    const Clock::time_point batchStart=Clock::now();
+    BatchStatistics statistics;
+    results.assign(jobs.size(), BatchJobResult());
+    SceneCache sceneCache;
+    for (const BatchJob &job : jobs) {
+        sceneCache.addUsers(job.sceneFilePath, 1);
+    }
+
+    const size_t threadCount=settings.threadCount>0 ? settings.threadCount : std::max(1u, std::thread::hardware_concurrency());
+    const size_t threadsPerJob=std::max<size_t>(1, std::min(settings.threadsPerJob, threadCount));
+    const size_t laneCount=std::max<size_t>(1, std::min(threadCount/threadsPerJob, jobs.size()));
+
+    // The jobs start in their order, each once a lane is free and its images fit into the memory budget.
+    std::mutex mutex;
+    std::condition_variable jobFinished;
+    size_t nextJob=0, nextStart=0, runningJobs=0, jobMemory=0;
+    const auto runLane=[&]() {
+        // Every lane renders its jobs one after the other, with its own scheduler.
+        TileScheduler scheduler(threadsPerJob);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (nextJob<jobs.size()) {
+            const size_t jobIndex=nextJob++;
+            lock.unlock();
+
+            const BatchJob &job=jobs[jobIndex];
+            BatchJobResult &result=results[jobIndex];
+            const Clock::time_point jobStart=Clock::now();
+            result.queueMilliseconds=std::chrono::duration<double, std::milli>(jobStart-batchStart).count();
+            // The scene comes before the memory is reserved, so a job without a resolution of its own counts
+            // with the one of its scene, and with the normals the drawer copies from it.
+            const std::shared_ptr<const PreparedScene> &scene=sceneCache.acquire(job.sceneFilePath, threadsPerJob);
+            result.sceneMilliseconds=getMillisecondsSince(jobStart);
+            size_t reservedMemory=0;
+            if (scene) {
+                const size_t width=job.width>0 ? job.width : scene->imageWidth;
+                const size_t height=job.height>0 ? job.height : scene->imageHeight;
+                reservedMemory=estimateJobMemory(job, scene.get(), width, height);
+            }
+
+            lock.lock();
+            const Clock::time_point waitStart=Clock::now();
+            jobFinished.wait(lock, [&]() {
+                return nextStart==jobIndex && (!scene || settings.memoryBudget==0 || runningJobs==0
+                    || jobMemory+reservedMemory+sceneCache.getMemoryUsage()<=settings.memoryBudget);
+            });
+            const double waitMilliseconds=getMillisecondsSince(waitStart);
+            result.queueMilliseconds+=waitMilliseconds;
+            ++nextStart;
+            // The next job may be waiting for this one to start.
+            jobFinished.notify_all();
+            if (scene) {
+                ++runningJobs;
+                jobMemory+=reservedMemory;
+                statistics.peakMemoryUsage=std::max(statistics.peakMemoryUsage, jobMemory+sceneCache.getMemoryUsage());
+                statistics.peakConcurrentJobs=std::max(statistics.peakConcurrentJobs, runningJobs);
+                lock.unlock();
+                result.isFinished=renderJob(job, *scene, scheduler, result);
+            } else {
+                lock.unlock();
+                printf("Job \"%s\" failed - its scene couldn't be loaded.\n", job.name.c_str());
+            }
+            // The wait for the memory was counted as queueing, not as part of the job.
+            result.latencyMilliseconds=getMillisecondsSince(jobStart)-waitMilliseconds;
+            sceneCache.release(job.sceneFilePath);
+
+            lock.lock();
+            if (scene) {
+                --runningJobs;
+                jobMemory-=reservedMemory;
+            }
+            if (result.isFinished) {
+                ++statistics.jobsFinished;
+            } else {
+                ++statistics.jobsFailed;
+            }
+            jobFinished.notify_all();
+        }
+    };
+    std::vector<std::thread> lanes;
+    for (size_t i=1; i<laneCount; ++i) {
+        lanes.emplace_back(runLane);
+    }
+    runLane();
+    for (std::thread &lane : lanes) {
+        lane.join();
+    }
+
+    statistics.scenesLoaded=sceneCache.getLoadCount();
+    statistics.milliseconds=getMillisecondsSince(batchStart);
+    return statistics;
+}
@@ -0,0 +1,155 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+
+/// Rendering a list of images, each with its own scene, camera, resolution, output file and samples, described by a
+/// manifest instead of the code. The jobs run next to each other within a budget of threads and memory, and the jobs
+/// of the same scene share a single loaded copy of it.
+///
+/// A manifest has one job per line, as key=value pairs separated by spaces. Empty lines and lines starting with '#'
+/// are skipped. scene and output are required, the rest is optional:
+///     scene=../Scenes/scene.crtscene output=../Images/Batch/front.png width=640 height=480 samples=16
+///     scene=../Scenes/scene.crtscene output=../Images/Batch/top.qoi position=0,10,0 target=0,0,0 name=top
+/// The output format comes from the extension of the output file, the resolution and the camera from the scene
+/// unless given, and a single sample per pixel is traced unless more are given.
+
+/// A single image to render.
+struct BatchJob {
+    /// What the job is called in the report - the output file unless given.
+    std::string name;
+    std::string sceneFilePath;
+    std::string outputFilePath;
+    /// The resolution, 0 for the one of the scene.
+    size_t width;
+    size_t height;
+    /// The samples of every pixel. More than one spreads them over the pixel for anti-aliasing.
+    uint32_t samples;
+    /// Where the camera is and what it looks at, unless it is the camera of the scene.
+    bool hasCamera;
+    Vector cameraPosition;
+    Vector cameraTarget;
+
+    /// Constructor.
+    BatchJob() : width(0), height(0), samples(1), hasCamera(false) {}
+};
+
+/// Read the jobs of a manifest file. Prints an error with the line and returns false if it can't be read or a line is wrong.
+bool loadBatchManifest(const std::string &filePath, std::vector<BatchJob> &jobs);
+
+/// A scene loaded and prepared for rendering - everything the jobs need from it, without the scene file data.
+struct PreparedScene {
+    BVH bvh;
+    Color backgroundColor;
+    Camera camera;
+    size_t imageWidth;
+    size_t imageHeight;
+    /// The bytes of the BVH, which is what stays in memory while the scene is shared.
+    size_t memoryUsage;
+    double loadMilliseconds;
+
+    /// Constructor.
+    PreparedScene() : camera(0, 0), imageWidth(0), imageHeight(0), memoryUsage(0), loadMilliseconds(0.0) {}
+};
+
+/// The scenes of a batch, each loaded by the first job that needs it and shared by the others. A scene is dropped
+/// once its last job released it. Thread safe.
+class SceneCache {
+private:
+    struct Entry {
+        std::shared_ptr<const PreparedScene> scene;
+        /// The jobs that still have to release the scene.
+        size_t remainingUsers=0;
+        bool isLoading=false;
+        /// A scene that failed to load isn't tried again by the next jobs.
+        bool hasFailed=false;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable loadFinished;
+    std::map<std::string, Entry> entries;
+    size_t memoryUsage;
+    size_t loadCount;
+public:
+    /// Constructors.
+    SceneCache() : memoryUsage(0), loadCount(0) {}
+    SceneCache(const SceneCache &)=delete;
+    SceneCache &operator=(const SceneCache &)=delete;
+
+    /// Announce how many jobs will use a scene, so it's kept until the last of them.
+    void addUsers(const std::string &sceneFilePath, size_t userCount);
+    /// Get a scene, loading it with the given number of threads if no job did yet, or waiting for the job loading it.
+    /// Returns nullptr if it couldn't be loaded.
+    std::shared_ptr<const PreparedScene> acquire(const std::string &sceneFilePath, size_t threadCount);
+    /// Tell the cache a job is done with a scene, which drops it after its last job.
+    void release(const std::string &sceneFilePath);
+
+    /// Getters.
+    /// The bytes of the scenes in the cache.
+    size_t getMemoryUsage() const;
+    /// The number of times a scene was loaded.
+    size_t getLoadCount() const;
+};
+
+/// How to run a batch.
+struct BatchSettings {
+    /// The threads of all jobs together, 0 for one per hardware thread.
+    size_t threadCount=0;
+    /// The threads each job renders with. The batch runs threadCount/threadsPerJob jobs at once.
+    size_t threadsPerJob=1;
+    /// The most bytes the images of the running jobs and the loaded scenes may take, 0 for no limit.
+    /// A job waits until it fits, except when nothing else is running, so a job bigger than the budget still runs alone.
+    /// A job gets its scene before it waits, so it counts with its real resolution, and its scene counts while it waits.
+    size_t memoryBudget=0;
+};
+
+/// What happened to a job.
+struct BatchJobResult {
+    bool isFinished;
+    /// From the start of the batch until the job could start, e.g. waiting for a thread or for memory.
+    double queueMilliseconds;
+    /// Getting the scene - loading it or waiting for another job loading it, almost nothing once it is loaded.
+    double sceneMilliseconds;
+    double renderMilliseconds;
+    double writeMilliseconds;
+    /// From the start of the job until its image was written.
+    double latencyMilliseconds;
+
+    /// Constructor.
+    BatchJobResult() : isFinished(false), queueMilliseconds(0.0), sceneMilliseconds(0.0), renderMilliseconds(0.0), writeMilliseconds(0.0), latencyMilliseconds(0.0) {}
+};
+
+/// What a whole batch did.
+struct BatchStatistics {
+    size_t jobsFinished;
+    size_t jobsFailed;
+    size_t scenesLoaded;
+    /// The most jobs that ran at once, and the most bytes they and the scenes took together, as estimated by the budget.
+    size_t peakConcurrentJobs;
+    size_t peakMemoryUsage;
+    double milliseconds;
+
+    /// Constructor.
+    BatchStatistics() : jobsFinished(0), jobsFailed(0), scenesLoaded(0), peakConcurrentJobs(0), peakMemoryUsage(0), milliseconds(0.0) {}
+    /// The finished jobs per hour of the whole batch.
+    double getJobsPerHour() const {
+        return milliseconds>0.0 ? double(jobsFinished)*3600000.0/milliseconds : 0.0;
+    }
+};
+
+/// Render the jobs in the order they are given, as many at once as the settings allow. A job that fails is reported
+/// and the others go on. Fills a result for every job.
+BatchStatistics runBatch(const std::vector<BatchJob> &jobs, const BatchSettings &settings, std::vector<BatchJobResult> &results);
+
+#endif
@@ -0,0 +1,579 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "draw.h"
+#include "geometry.h"
+#include "intersect.h"
+#include "meshprocessing.h"
+#include "sceneloader.h"
+#include "simd.h"
+
+/// Keep the compiler from optimizing away a value that is only computed to be measured.
+template <typename T>
+inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/// The measurement of a single benchmark.
+struct BenchmarkResult {
+    std::string name;
+    size_t iterations;
+    double nanosecondsPerIteration;
+    /// How many items (vectors, pixels, rays...) one iteration processes.
+    size_t itemsPerIteration;
+};
+
+/// Runs benchmarks by name and collects their results.
+/// Every benchmark is repeated until it has run for at least the minimum time, and the average is kept.
+class BenchmarkRunner {
+private:
+    /// Only the benchmarks whose names contain this are run.
+    std::string filter;
+    double minimumSeconds;
+    std::vector<BenchmarkResult> results;
+public:
+    /// Constructors.
+    BenchmarkRunner(const std::string &newFilter, double newMinimumSeconds)
+        : filter(newFilter)
+        , minimumSeconds(newMinimumSeconds) {}
+
+    /// Whether a benchmark passes the filter, to skip setting it up if it doesn't.
+    bool isSelected(const std::string &name) const {
+        return filter.empty() || name.find(filter)!=std::string::npos;
+    }
+    /// Whether any of a group of benchmarks passes the filter, to skip setting up a fixture they share.
+    bool isAnySelected(const std::vector<std::string> &names) const {
+        for (const std::string &name : names) {
+            if (isSelected(name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    /// Measure a function.
+    void run(const std::string &name, size_t itemsPerIteration, const std::function<void()> &function);
+    /// Write the results as JSON, in the layout of Google Benchmark so its comparison tools can read it.
+    void writeJson(FILE *file) const;
+};
+
+void BenchmarkRunner::run(const std::string &name, size_t itemsPerIteration, const std::function<void()> &function) {
+    if (!isSelected(name)) {
+        return;
+    }
+    // Warm up the caches and the lazily created threads.
+    function();
+    size_t iterations=1;
+    while (true) {
+        const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+        for (size_t i=0; i<iterations; ++i) {
+            function();
+        }
+        const std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+        if (elapsed.count()>=minimumSeconds) {
+            BenchmarkResult result;
+            result.name=name;
+            result.iterations=iterations;
+            result.nanosecondsPerIteration=elapsed.count()*1e9/double(iterations);
+            result.itemsPerIteration=itemsPerIteration;
+            results.push_back(result);
+            fprintf(stderr, "%-60s %14.1f ns %12zu iterations\n", name.c_str(), result.nanosecondsPerIteration, iterations);
+            return;
+        }
+        // Aim a bit past the minimum time, but grow at least twice and at most a hundred times per round.
+        const double scale=elapsed.count()>0.0 ? minimumSeconds*1.2/elapsed.count() : 100.0;
+        iterations=size_t(double(iterations)*std::min(std::max(scale, 2.0), 100.0));
+    }
+}
+
+void BenchmarkRunner::writeJson(FILE *file) const {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"context\": {\n");
+    fprintf(file, "    \"simd\": \"%s\",\n", getSimdDescription());
+    fprintf(file, "    \"simd_width\": %d,\n", SIMD_WIDTH);
+    fprintf(file, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(file, "    \"compiler\": \"%s\"\n", __VERSION__);
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"benchmarks\": [\n");
+    for (size_t i=0; i<results.size(); ++i) {
+        const BenchmarkResult &result=results[i];
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"name\": \"%s\",\n", result.name.c_str());
+        fprintf(file, "      \"iterations\": %zu,\n", result.iterations);
+        fprintf(file, "      \"real_time\": %.3f,\n", result.nanosecondsPerIteration);
+        fprintf(file, "      \"time_unit\": \"ns\",\n");
+        fprintf(file, "      \"items_per_second\": %.3f\n", result.itemsPerIteration*1e9/result.nanosecondsPerIteration);
+        fprintf(file, "    }%s\n", i+1<results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+}
+
+namespace {
+
+const size_t vectorCount=4096;
+
+std::vector<Vector> createRandomVectors(std::mt19937 &generator, size_t count, float range) {
+    std::uniform_real_distribution<float> distribution(-range, range);
+    std::vector<Vector> vectors;
+    vectors.reserve(count);
+    for (size_t i=0; i<count; ++i) {
+        vectors.emplace_back(distribution(generator), distribution(generator), distribution(generator));
+    }
+    return vectors;
+}
+
+/// A soup of small random triangles in a cube in front of the default camera.
+std::vector<Triangle> createRandomTriangles(std::mt19937 &generator, size_t count) {
+    std::uniform_real_distribution<float> center(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+    std::vector<Triangle> triangles;
+    triangles.reserve(count);
+    for (size_t i=0; i<count; ++i) {
+        const Vector origin(center(generator), center(generator), center(generator)-20.0f);
+        triangles.emplace_back(
+            origin,
+            origin+Vector(offset(generator), offset(generator), offset(generator)),
+            origin+Vector(offset(generator), offset(generator), offset(generator))
+        );
+    }
+    return triangles;
+}
+
+std::string getResolutionName(size_t width, size_t height) {
+    return std::to_string(width)+"x"+std::to_string(height);
+}
+
+void benchmarkGeometry(BenchmarkRunner &runner) {
+    std::mt19937 generator(7);
+    const std::vector<Vector> &first=createRandomVectors(generator, vectorCount, 10.0f);
+    const std::vector<Vector> &second=createRandomVectors(generator, vectorCount, 10.0f);
+    runner.run("Vector/crossProduct", vectorCount, [&]() {
+        for (size_t i=0; i<vectorCount; ++i) {
+            doNotOptimize(first[i].crossProduct(second[i]));
+        }
+    });
+    runner.run("Vector/normalize", vectorCount, [&]() {
+        for (size_t i=0; i<vectorCount; ++i) {
+            Vector vector(first[i]);
+            vector.normalize();
+            doNotOptimize(vector);
+        }
+    });
+    runner.run("Vector/findParallelogramArea", vectorCount, [&]() {
+        for (size_t i=0; i<vectorCount; ++i) {
+            doNotOptimize(first[i].findParallelogramArea(second[i]));
+        }
+    });
+
+    const std::vector<Triangle> &triangles=createRandomTriangles(generator, vectorCount);
+    runner.run("Triangle/getNormalVector", vectorCount, [&]() {
+        for (const Triangle &triangle : triangles) {
+            doNotOptimize(triangle.getNormalVector());
+        }
+    });
+    runner.run("Triangle/getArea", vectorCount, [&]() {
+        for (const Triangle &triangle : triangles) {
+            doNotOptimize(triangle.getArea());
+        }
+    });
+}
+
+void benchmarkRays(BenchmarkRunner &runner, TileScheduler &scheduler, const std::string &threadsName) {
+    const size_t width=1920, height=1080;
+    const std::string &resolution=getResolutionName(width, height);
+    if (threadsName=="threads:1") {
+        // The replacement of RayDrawer::prepareRays - the rays are generated row by row, on the fly.
+        const std::string &name="Camera/generateRowRays/"+resolution;
+        if (runner.isSelected(name)) {
+            const Camera camera(width, height);
+            std::vector<Ray> rays(width);
+            runner.run(name, width*height, [&]() {
+                for (size_t i=0; i<height; ++i) {
+                    camera.generateRowRays(i, 0, width, rays.data());
+                    doNotOptimize(rays[width-1]);
+                }
+            });
+        }
+    }
+    for (bool usePackets : {false, true}) {
+        const std::string &name=std::string("RayDrawer/fillPixelsFromRays/")+(usePackets ? "packets/" : "scalar/")
+            +threadsName+"/"+resolution;
+        if (!runner.isSelected(name)) {
+            continue;
+        }
+        RayDrawer rayDrawer("benchmark.ppm", width, height);
+        rayDrawer.changeScheduler(scheduler);
+        rayDrawer.changeUsePackets(usePackets);
+        runner.run(name, width*height, [&]() {
+            rayDrawer.fillPixelsFromRays();
+        });
+    }
+    // A large random scene, to compare the per-pixel path with the wavefront, with and without sorting the rays.
+    const std::pair<const char *, RaySortOrder> sceneModes[]={
+        {"pixels/", RaySortOrder::None}, {"wavefront/unsorted/", RaySortOrder::None}, {"wavefront/direction/", RaySortOrder::Direction}
+    };
+    std::vector<std::string> sceneNames;
+    bool isSceneSelected=false;
+    for (const std::pair<const char *, RaySortOrder> &sceneMode : sceneModes) {
+        sceneNames.push_back(std::string("RayDrawer/fillPixelsFromRays/scene/")+sceneMode.first+threadsName+"/"+resolution);
+        isSceneSelected=isSceneSelected || runner.isSelected(sceneNames.back());
+    }
+    if (isSceneSelected) {
+        std::mt19937 generator(7);
+        BVH bvh;
+        bvh.build(createRandomTriangles(generator, 100000));
+        for (size_t i=0; i<sceneNames.size(); ++i) {
+            if (!runner.isSelected(sceneNames[i])) {
+                continue;
+            }
+            RayDrawer rayDrawer("benchmark.ppm", width, height);
+            rayDrawer.changeScheduler(scheduler);
+            rayDrawer.changeScene(bvh, Color(173, 216, 230));
+            WavefrontSettings settings;
+            settings.sortOrder=sceneModes[i].second;
+            rayDrawer.changeWavefront(i>0, settings);
+            runner.run(sceneNames[i], width*height, [&]() {
+                rayDrawer.fillPixelsFromRays();
+            });
+        }
+    }
+
+    const std::string &accumulateName="RayDrawer/accumulatePixelsFromRays/"+threadsName+"/"+resolution;
+    const std::string &resolveName="ImageDrawer/resolveAccumulation/";
+    if (!runner.isAnySelected({accumulateName, resolveName+"linear/"+threadsName+"/"+resolution,
+                               resolveName+"gamma/"+threadsName+"/"+resolution})) {
+        return;
+    }
+    RayDrawer rayDrawer("benchmark.ppm", width, height);
+    rayDrawer.changeScheduler(scheduler);
+    rayDrawer.clearAccumulation();
+    runner.run(accumulateName, width*height, [&]() {
+        rayDrawer.accumulatePixelsFromRays();
+    });
+    for (float gamma : {1.0f, 2.2f}) {
+        ToneMapping toneMapping;
+        toneMapping.toneMapOperator=ToneMapOperator::Reinhard;
+        toneMapping.gamma=gamma;
+        rayDrawer.changeToneMapping(toneMapping);
+        const std::string &gammaName=gamma==1.0f ? "linear/" : "gamma/";
+        runner.run(resolveName+gammaName+threadsName+"/"+resolution, width*height, [&]() {
+            rayDrawer.resolveAccumulation();
+        });
+    }
+}
+
+void benchmarkFills(BenchmarkRunner &runner, TileScheduler &scheduler, const std::string &threadsName) {
+    const size_t width=1920, height=1080;
+    const std::string &suffix="/"+threadsName+"/"+getResolutionName(width, height);
+    const Color color1(173, 216, 230), color2(250, 218, 221);
+
+    const std::vector<std::string> circleNames={
+        "ImageDrawer/fillSolidBackground"+suffix, "ImageDrawer/fillGradientBackground"+suffix, "CircleDrawer/fillSolidCircle"+suffix,
+        "CircleDrawer/fillGradientCircle"+suffix, "ImageDrawer/fillShapes/16"+suffix
+    };
+    if (runner.isAnySelected(circleNames)) {
+        CircleDrawer circleDrawer("benchmark.ppm", width, height, int(height/2));
+        circleDrawer.changeScheduler(scheduler);
+        runner.run(circleNames[0], width*height, [&]() {
+            circleDrawer.fillSolidBackground(color1);
+        });
+        runner.run(circleNames[1], width*height, [&]() {
+            circleDrawer.fillGradientBackground(color1, color2);
+        });
+        runner.run(circleNames[2], width*height, [&]() {
+            circleDrawer.fillSolidCircle(color1);
+        });
+        runner.run(circleNames[3], width*height, [&]() {
+            circleDrawer.fillGradientCircle(color1, color2);
+        });
+
+        // Sixteen overlapping overlays composited in one pass.
+        ShapeBatch shapes;
+        for (int i=0; i<16; ++i) {
+            const int offset=i*int(width)/20;
+            if (i%2==0) {
+                shapes.add(Shape::makeGradientCircle(offset+int(height/4), int(height/2), int(height/4), color1, color2));
+            } else {
+                shapes.add(Shape::makeRectangle(offset, int(height/4), int(height/4), int(height/2), color2));
+            }
+        }
+        runner.run(circleNames[4], width*height, [&]() {
+            circleDrawer.fillShapes(shapes);
+        });
+    }
+
+    const std::vector<std::string> rectangleNames={
+        "RectangleDrawer/fillSolidRectangle"+suffix, "RectangleDrawer/fillGradientRectangle"+suffix, "RectangleDrawer/fillNoiseRectangle"+suffix
+    };
+    if (!runner.isAnySelected(rectangleNames)) {
+        return;
+    }
+    RectangleDrawer rectangleDrawer("benchmark.ppm", width, height, 0, 0, width, height);
+    rectangleDrawer.changeScheduler(scheduler);
+    runner.run(rectangleNames[0], width*height, [&]() {
+        rectangleDrawer.fillSolidRectangle(color1);
+    });
+    runner.run(rectangleNames[1], width*height, [&]() {
+        rectangleDrawer.fillGradientRectangle(color1, color2);
+    });
+    runner.run(rectangleNames[2], width*height, [&]() {
+        rectangleDrawer.fillNoiseRectangle(color1);
+    });
+}
+
+void benchmarkDraw(BenchmarkRunner &runner, const std::string &outputFilePath) {
+    // draw() reports every image it writes, so standard output is muted while measuring it.
+    fflush(stdout);
+    const int standardOutput=dup(STDOUT_FILENO);
+    const int nullOutput=open("/dev/null", O_WRONLY);
+    if (nullOutput>=0) {
+        dup2(nullOutput, STDOUT_FILENO);
+        close(nullOutput);
+    }
+    const size_t resolutions[][2]={{640, 480}, {1920, 1080}, {3840, 2160}};
+    for (const size_t *resolution : resolutions) {
+        const size_t width=resolution[0], height=resolution[1];
+        const std::pair<ImageFormat, const char *> formats[]={
+            {ImageFormat::PPMBinary, "binary/"}, {ImageFormat::PPMText, "text/"}, {ImageFormat::QOI, "qoi/"}, {ImageFormat::PNG, "png/"}
+        };
+        for (const std::pair<ImageFormat, const char *> &formatName : formats) {
+            const ImageFormat format=formatName.first;
+            const std::string &name=std::string("ImageDrawer/draw/")+formatName.second+getResolutionName(width, height);
+            if (!runner.isSelected(name)) {
+                continue;
+            }
+            RayDrawer rayDrawer(outputFilePath, width, height);
+            rayDrawer.changeOutputFormat(format);
+            rayDrawer.fillPixelsFromRays();
+            runner.run(name, width*height, [&]() {
+                rayDrawer.draw();
+            });
+        }
+    }
+    remove(outputFilePath.c_str());
+    fflush(stdout);
+    if (standardOutput>=0) {
+        dup2(standardOutput, STDOUT_FILENO);
+        close(standardOutput);
+    }
+}
+
+void benchmarkIntersection(BenchmarkRunner &runner) {
+    const std::vector<std::string> triangleNames={
+        "TriangleRecord/intersect/scalar/64", "TriangleRecord/intersect/packets/64", "TrianglePacket/intersect/64"
+    };
+    const std::vector<std::string> bvhNames={"BVH/build/100000", "BVH/intersect/100000"};
+    const bool isTriangleSelected=runner.isAnySelected(triangleNames), isBVHSelected=runner.isAnySelected(bvhNames);
+    if (!isTriangleSelected && !isBVHSelected) {
+        return;
+    }
+    std::mt19937 generator(11);
+    const size_t width=256, height=256;
+    const Camera camera(width, height);
+    std::vector<Ray> rays(width*height);
+    for (size_t i=0; i<height; ++i) {
+        camera.generateRowRays(i, 0, width, rays.data()+i*width);
+    }
+
+    // A few triangles tested against every ray, as in the brute force kernels. They are drawn either way, so the
+    // BVH triangles after them are the same whatever is selected.
+    const std::vector<Triangle> &fewTriangles=createRandomTriangles(generator, 64);
+    if (isTriangleSelected) {
+        const std::vector<TriangleRecord> &records=buildTriangleRecords(fewTriangles);
+        const std::vector<TrianglePacket> &packets=buildTrianglePackets(records);
+        runner.run(triangleNames[0], rays.size()*records.size(), [&]() {
+            for (const Ray &ray : rays) {
+                Hit hit;
+                for (const TriangleRecord &record : records) {
+                    record.intersect(ray, hit);
+                }
+                doNotOptimize(hit);
+            }
+        });
+        runner.run(triangleNames[1], rays.size()*records.size(), [&]() {
+            for (size_t i=0; i<height; ++i) {
+                for (size_t j=0; j+SIMD_WIDTH<=width; j+=SIMD_WIDTH) {
+                    const VectorPacket origins(camera.getPosition());
+                    const VectorPacket &directions=camera.generateDirectionPacket(i, j);
+                    HitPacket hits;
+                    for (const TriangleRecord &record : records) {
+                        record.intersect(origins, directions, hits);
+                    }
+                    doNotOptimize(hits);
+                }
+            }
+        });
+        runner.run(triangleNames[2], rays.size()*records.size(), [&]() {
+            for (const Ray &ray : rays) {
+                Hit hit;
+                intersectTriangles(ray, packets, hit);
+                doNotOptimize(hit);
+            }
+        });
+    }
+
+    if (isBVHSelected) {
+        const std::vector<Triangle> &triangles=createRandomTriangles(generator, 100000);
+        BVH bvh;
+        runner.run(bvhNames[0], triangles.size(), [&]() {
+            bvh.build(triangles);
+        });
+        bvh.build(triangles);
+        runner.run(bvhNames[1], rays.size(), [&]() {
+            for (const Ray &ray : rays) {
+                Hit hit;
+                bvh.intersect(ray, hit);
+                doNotOptimize(hit);
+            }
+        });
+    }
+}
+
+/// A bumpy square grid of side*side vertices, two triangles per cell, with the vertices shared like in a loaded scene.
+Mesh createGridMesh(std::mt19937 &generator, size_t side) {
+    std::uniform_real_distribution<float> height(0.0f, 0.1f);
+    Mesh mesh;
+    mesh.reserve(side*side, (side-1)*(side-1)*2);
+    for (size_t i=0; i<side; ++i) {
+        for (size_t j=0; j<side; ++j) {
+            mesh.addVertex(Vector(float(j), height(generator), float(i)));
+        }
+    }
+    for (size_t i=0; i+1<side; ++i) {
+        for (size_t j=0; j+1<side; ++j) {
+            const uint32_t corner=uint32_t(i*side+j);
+            mesh.addTriangle(corner, corner+uint32_t(side), corner+1);
+            mesh.addTriangle(corner+1, corner+uint32_t(side), corner+uint32_t(side)+1);
+        }
+    }
+    return mesh;
+}
+
+void benchmarkMeshProcessing(BenchmarkRunner &runner, TileScheduler &scheduler, const std::string &threadsName) {
+    const std::string &name="processMesh/"+threadsName+"/200000";
+    if (!runner.isSelected(name)) {
+        return;
+    }
+    std::mt19937 generator(13);
+    const Mesh &mesh=createGridMesh(generator, 317);
+    MeshAttributes attributes;
+    runner.run(name, mesh.getTriangleCount(), [&]() {
+        processMesh(mesh, attributes, scheduler);
+    });
+}
+
+/// The text of a scene with a single object of vertexCount vertices. The vertices end in as much whitespace as they
+/// take, so the parts a parallel parse splits them into run past the last comma.
+std::string createSceneText(std::mt19937 &generator, size_t vertexCount) {
+    std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+    std::string vertices;
+    for (size_t i=0; i<vertexCount*3; ++i) {
+        vertices+=(i>0 ? ", " : "")+std::to_string(coordinate(generator));
+    }
+    vertices.append(vertices.size(), ' ');
+    std::string triangles;
+    for (size_t i=0; i+2<vertexCount; i+=3) {
+        triangles+=(i>0 ? ", " : "")+std::to_string(i)+", "+std::to_string(i+1)+", "+std::to_string(i+2);
+    }
+    return "{\"settings\": {\"background_color\": [0, 0, 0], \"image_settings\": {\"width\": 64, \"height\": 64}}, "
+        "\"camera\": {\"matrix\": [1, 0, 0, 0, 1, 0, 0, 0, 1], \"position\": [0, 0, 10]}, "
+        "\"objects\": [{\"vertices\": ["+vertices+"], \"triangles\": ["+triangles+"]}]}";
+}
+
+/// Parse a scene on a single thread and on several, and check both give the same meshes before measuring the
+/// parallel parse. Returns false with a message if they don't.
+bool benchmarkSceneParsing(BenchmarkRunner &runner) {
+    const size_t threadCount=4, vertexCount=100000;
+    const std::string &name="parseScene/threads:"+std::to_string(threadCount)+"/"+std::to_string(vertexCount);
+    if (!runner.isSelected(name)) {
+        return true;
+    }
+    std::mt19937 generator(17);
+    const std::string &text=createSceneText(generator, vertexCount);
+    Scene serialScene, parallelScene;
+    if (!parseScene(text.data(), text.size(), serialScene, 1) || !parseScene(text.data(), text.size(), parallelScene, threadCount)) {
+        printf("The scene of %s couldn't be parsed.\n", name.c_str());
+        return false;
+    }
+    const Mesh &serialMesh=serialScene.getObjects()[0].mesh, &parallelMesh=parallelScene.getObjects()[0].mesh;
+    const bool isSame=serialMesh.getIndices()==parallelMesh.getIndices()
+        && std::equal(serialMesh.getVertices().begin(), serialMesh.getVertices().end(), parallelMesh.getVertices().begin(),
+                      parallelMesh.getVertices().end(), [](const Vector &a, const Vector &b) {
+            return a.getX()==b.getX() && a.getY()==b.getY() && a.getZ()==b.getZ();
+        });
+    if (!isSame) {
+        printf("The scene parsed on %zu threads doesn't match the one parsed on a single thread.\n", threadCount);
+        return false;
+    }
+    runner.run(name, vertexCount, [&]() {
+        Scene scene;
+        parseScene(text.data(), text.size(), scene, threadCount);
+        doNotOptimize(scene);
+    });
+    return true;
+}
+
+void printUsage() {
+    printf("Usage: crt_benchmark [--filter substring] [--min-time seconds] [--output file.json]\n");
+    printf("Runs the benchmarks and writes the results as JSON, to benchmark.json unless another file is given.\n");
+}
+
+}
+
+int main(int argc, const char *argv[]) {
+    std::string filter, outputFilePath="benchmark.json";
+    double minimumSeconds=0.5;
+    for (int i=1; i<argc; ++i) {
+        if (strcmp(argv[i], "--filter")==0 && i+1<argc) {
+            filter=argv[++i];
+        } else if (strcmp(argv[i], "--min-time")==0 && i+1<argc) {
+            minimumSeconds=atof(argv[++i]);
+        } else if (strcmp(argv[i], "--output")==0 && i+1<argc) {
+            outputFilePath=argv[++i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    BenchmarkRunner runner(filter, minimumSeconds);
+    benchmarkGeometry(runner);
+    // The same kernels on a single thread and on all hardware threads.
+    TileScheduler singleThread(1);
+    TileScheduler &allThreads=TileScheduler::getDefault();
+    const std::string &allThreadsName="threads:"+std::to_string(allThreads.getThreadCount());
+    benchmarkRays(runner, singleThread, "threads:1");
+    benchmarkFills(runner, singleThread, "threads:1");
+    benchmarkMeshProcessing(runner, singleThread, "threads:1");
+    if (allThreads.getThreadCount()>1) {
+        benchmarkRays(runner, allThreads, allThreadsName);
+        benchmarkFills(runner, allThreads, allThreadsName);
+        benchmarkMeshProcessing(runner, allThreads, allThreadsName);
+    }
+    benchmarkDraw(runner, "benchmark_draw.ppm");
+    benchmarkIntersection(runner);
+    if (!benchmarkSceneParsing(runner)) {
+        return 1;
+    }
+
+    FILE *file=fopen(outputFilePath.c_str(), "w");
+    if (!file) {
+        printf("Couldn't open the given file path.\n");
+        return 1;
+    }
+    runner.writeJson(file);
+    fclose(file);
+    return 0;
+}
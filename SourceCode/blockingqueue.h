@@ -0,0 +1,60 @@
+#ifndef BLOCKINGQUEUE_H
+#define BLOCKINGQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/// A first-in first-out queue between threads with a fixed capacity.
+/// push(..) waits while the queue is full and pop(..) waits while it is empty, until the queue is closed.
+template <typename T>
+class BlockingQueue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool isClosed;
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+public:
+    /// Constructors.
+    explicit BlockingQueue(size_t newCapacity)
+        : capacity(newCapacity>0 ? newCapacity : 1)
+        , isClosed(false) {}
+    BlockingQueue(const BlockingQueue &)=delete;
+    BlockingQueue &operator=(const BlockingQueue &)=delete;
+
+    /// Add an item at the back, waiting for space if the queue is full.
+    /// Returns false, dropping the item, if the queue is closed.
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]() { return isClosed || items.size()<capacity; });
+        if (isClosed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    /// Take the item at the front, waiting for one if the queue is empty.
+    /// Returns false once the queue is closed and all items are taken.
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return isClosed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item=std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    /// Stop accepting items and wake up everyone waiting. The items already in the queue can still be taken.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        isClosed=true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif
@@ -0,0 +1,369 @@
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "arena.h"
+#include "bvh.h"
+#include "profiler.h"
+
+// BoundingBox.
+void BoundingBox::expand(const Vector &point) {
+    min=Vector(std::min(min.getX(), point.getX()), std::min(min.getY(), point.getY()), std::min(min.getZ(), point.getZ()));
+    max=Vector(std::max(max.getX(), point.getX()), std::max(max.getY(), point.getY()), std::max(max.getZ(), point.getZ()));
+}
+
+void BoundingBox::expand(const BoundingBox &box) {
+    if (box.isEmpty()) {
+        return;
+    }
+    expand(box.min);
+    expand(box.max);
+}
+
+float BoundingBox::getSurfaceArea() const {
+    if (isEmpty()) {
+        return 0.0f;
+    }
+    const Vector &extent=getExtent();
+    return 2.0f*(extent.getX()*extent.getY()+extent.getY()*extent.getZ()+extent.getZ()*extent.getX());
+}
+
+namespace {
+
+/// The value of a vector along an axis - 0, 1 or 2 for X, Y and Z.
+float getAxis(const Vector &vector, int axis) {
+    return axis==0 ? vector.getX() : (axis==1 ? vector.getY() : vector.getZ());
+}
+
+/// A triangle while building - its bounds and their center.
+struct BuildReference {
+    BoundingBox box;
+    Vector centroid;
+    uint32_t index;
+};
+
+/// A node of the temporary tree the build produces before flattening. The nodes live in the arenas of the builder.
+struct BuildNode {
+    BoundingBox box;
+    BuildNode *children[2]={nullptr, nullptr};
+    /// The range of references in a leaf.
+    size_t first, count;
+    int axis;
+};
+
+/// The recursive binned SAH build. References are reordered in place, so leaves end up as ranges.
+class Builder {
+private:
+    std::vector<BuildReference> &references;
+    /// Subtrees are built on new threads up to this depth.
+    size_t parallelDepth;
+    /// Every subtree built on a thread of its own gets its own arena, and all of them go at once with the builder.
+    std::vector<std::unique_ptr<MemoryArena>> arenas;
+    std::mutex arenaMutex;
+public:
+    /// The size of the arena blocks - a few thousand nodes each.
+    static constexpr size_t arenaBlockSize=size_t(256)<<10;
+    /// Nodes with fewer references are always built on the current thread.
+    static constexpr size_t parallelThreshold=4096;
+    /// The relative cost of visiting a node compared to testing a triangle.
+    static constexpr float traversalCost=1.0f;
+
+    Builder(std::vector<BuildReference> &newReferences, size_t threadCount)
+        : references(newReferences)
+        , parallelDepth(0) {
+        while ((size_t(1)<<parallelDepth)<threadCount) {
+            ++parallelDepth;
+        }
+    }
+
+    /// A new arena for a subtree.
+    MemoryArena &createArena() {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        arenas.push_back(std::make_unique<MemoryArena>(arenaBlockSize));
+        return *arenas.back();
+    }
+    /// What all arenas did. Only while no subtree is being built.
+    ArenaStatistics getArenaStatistics() const {
+        ArenaStatistics statistics;
+        for (const std::unique_ptr<MemoryArena> &arena : arenas) {
+            statistics+=arena->getStatistics();
+        }
+        return statistics;
+    }
+
+    BuildNode *build(MemoryArena &arena, size_t first, size_t count, size_t depth) {
+        BuildNode *node=arena.create<BuildNode>();
+        BoundingBox centroidBox;
+        for (size_t i=first; i<first+count; ++i) {
+            node->box.expand(references[i].box);
+            centroidBox.expand(references[i].centroid);
+        }
+        node->first=first;
+        node->count=count;
+        node->axis=0;
+        if (count<=BVH::minLeafSize) {
+            return node;
+        }
+        // Pick the axis and bin boundary with the lowest surface area heuristic cost.
+        const Vector &centroidExtent=centroidBox.getExtent();
+        int bestAxis=-1;
+        int bestBin=0;
+        float bestCost=INFINITY;
+        const bool useMedian=depth>=BVH::stackSize/2;
+        for (int axis=0; axis<3 && !useMedian; ++axis) {
+            const float axisMin=getAxis(centroidBox.min, axis);
+            const float axisExtent=getAxis(centroidExtent, axis);
+            if (axisExtent<=0.0f) {
+                continue;
+            }
+            BoundingBox binBoxes[BVH::binCount];
+            size_t binCounts[BVH::binCount]={};
+            const float binScale=BVH::binCount*(1.0f-1e-5f)/axisExtent;
+            for (size_t i=first; i<first+count; ++i) {
+                const int bin=int((getAxis(references[i].centroid, axis)-axisMin)*binScale);
+                binBoxes[bin].expand(references[i].box);
+                ++binCounts[bin];
+            }
+            // Sweep from the right to get the area and count of everything right of each boundary.
+            float rightAreas[BVH::binCount];
+            size_t rightCounts[BVH::binCount];
+            BoundingBox rightBox;
+            size_t rightCount=0;
+            for (int bin=BVH::binCount-1; bin>0; --bin) {
+                rightBox.expand(binBoxes[bin]);
+                rightCount+=binCounts[bin];
+                rightAreas[bin]=rightBox.getSurfaceArea();
+                rightCounts[bin]=rightCount;
+            }
+            BoundingBox leftBox;
+            size_t leftCount=0;
+            for (int bin=0; bin<BVH::binCount-1; ++bin) {
+                leftBox.expand(binBoxes[bin]);
+                leftCount+=binCounts[bin];
+                if (leftCount==0 || rightCounts[bin+1]==0) {
+                    continue;
+                }
+                const float cost=leftBox.getSurfaceArea()*leftCount+rightAreas[bin+1]*rightCounts[bin+1];
+                if (cost<bestCost) {
+                    bestCost=cost;
+                    bestAxis=axis;
+                    bestBin=bin;
+                }
+            }
+        }
+        size_t middle=first;
+        const float parentArea=node->box.getSurfaceArea();
+        const float leafCost=float(count);
+        const float splitCost=parentArea>0.0f ? traversalCost+bestCost/parentArea : INFINITY;
+        if (bestAxis>=0 && (splitCost<leafCost || count>BVH::maxLeafSize)) {
+            // Split at the best bin boundary.
+            const float axisMin=getAxis(centroidBox.min, bestAxis);
+            const float binScale=BVH::binCount*(1.0f-1e-5f)/getAxis(centroidExtent, bestAxis);
+            middle=std::partition(references.begin()+first, references.begin()+first+count, [&](const BuildReference &reference) {
+                return int((getAxis(reference.centroid, bestAxis)-axisMin)*binScale)<=bestBin;
+            })-references.begin();
+            node->axis=bestAxis;
+        } else if (count>BVH::maxLeafSize || useMedian) {
+            // No useful split was found, but the node is too big for a leaf - split at the median of the widest axis.
+            const int axis=getAxis(centroidExtent, 0)>getAxis(centroidExtent, 1)
+                ? (getAxis(centroidExtent, 0)>getAxis(centroidExtent, 2) ? 0 : 2)
+                : (getAxis(centroidExtent, 1)>getAxis(centroidExtent, 2) ? 1 : 2);
+            middle=first+count/2;
+            std::nth_element(references.begin()+first, references.begin()+middle, references.begin()+first+count, [&](const BuildReference &a, const BuildReference &b) {
+                return getAxis(a.centroid, axis)<getAxis(b.centroid, axis);
+            });
+            node->axis=axis;
+        } else {
+            return node;
+        }
+        const size_t leftCount=middle-first;
+        const size_t rightCount=count-leftCount;
+        if (depth<parallelDepth && count>=parallelThreshold) {
+            MemoryArena &leftArena=createArena();
+            std::future<BuildNode *> left=std::async(std::launch::async, &Builder::build, this, std::ref(leftArena), first, leftCount, depth+1);
+            node->children[1]=build(arena, middle, rightCount, depth+1);
+            node->children[0]=left.get();
+        } else {
+            node->children[0]=build(arena, first, leftCount, depth+1);
+            node->children[1]=build(arena, middle, rightCount, depth+1);
+        }
+        return node;
+    }
+};
+
+/// Copy the bounds of a box to a node.
+void setNodeBounds(BVHNode &node, const BoundingBox &box) {
+    node.minX=box.min.getX();
+    node.minY=box.min.getY();
+    node.minZ=box.min.getZ();
+    node.maxX=box.max.getX();
+    node.maxY=box.max.getY();
+    node.maxZ=box.max.getZ();
+}
+
+/// The distance at which a ray enters a node's box, or INFINITY if it misses it or enters farther than maxDistance.
+float intersectNode(const BVHNode &node, const Vector &origin, const Vector &inverseDirection, float maxDistance) {
+    const float x0=(node.minX-origin.getX())*inverseDirection.getX();
+    const float x1=(node.maxX-origin.getX())*inverseDirection.getX();
+    const float y0=(node.minY-origin.getY())*inverseDirection.getY();
+    const float y1=(node.maxY-origin.getY())*inverseDirection.getY();
+    const float z0=(node.minZ-origin.getZ())*inverseDirection.getZ();
+    const float z1=(node.maxZ-origin.getZ())*inverseDirection.getZ();
+    const float entry=std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+    const float exit=std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), maxDistance));
+    return entry<=exit ? entry : INFINITY;
+}
+
+}
+
+// BVH.
+void BVH::build(const std::vector<Triangle> &sceneTriangles, size_t threadCount) {
+    build(buildTriangleRecords(sceneTriangles), threadCount);
+}
+
+void BVH::build(const Mesh &mesh, size_t threadCount) {
+    build(buildTriangleRecords(mesh), threadCount);
+}
+
+void BVH::build(std::vector<TriangleRecord> sceneTriangles, size_t threadCount) {
+    PROFILE_SCOPE(ProfileStage::BVHBuild);
+    const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    if (threadCount==0) {
+        threadCount=std::max(1u, std::thread::hardware_concurrency());
+    }
+    buildStatistics=BuildStatistics();
+    buildStatistics.triangleCount=sceneTriangles.size();
+    nodes.clear();
+    triangles.clear();
+    std::vector<BuildReference> references(sceneTriangles.size());
+    for (size_t i=0; i<sceneTriangles.size(); ++i) {
+        const TriangleRecord &record=sceneTriangles[i];
+        BuildReference &reference=references[i];
+        reference.box.expand(record.getV0());
+        reference.box.expand(record.getV0()+record.getEdge1());
+        reference.box.expand(record.getV0()+record.getEdge2());
+        reference.centroid=reference.box.getCenter();
+        reference.index=uint32_t(i);
+    }
+    if (!references.empty()) {
+        Builder builder(references, threadCount);
+        const BuildNode *root=builder.build(builder.createArena(), 0, references.size(), 0);
+        // Flatten depth first. The root is node 0 and node 1 is padding, so every pair of children
+        // starts at an even index and shares a cache line.
+        nodes.resize(2);
+        nodes[1]=BVHNode();
+        std::vector<std::pair<const BuildNode *, size_t>> pending;
+        pending.emplace_back(root, 0);
+        std::vector<size_t> depths(1, 1);
+        while (!pending.empty()) {
+            const BuildNode *buildNode=pending.back().first;
+            const size_t nodeIndex=pending.back().second;
+            const size_t depth=depths.back();
+            pending.pop_back();
+            depths.pop_back();
+            buildStatistics.maxDepth=std::max(buildStatistics.maxDepth, depth);
+            BVHNode node=BVHNode();
+            setNodeBounds(node, buildNode->box);
+            node.axis=uint8_t(buildNode->axis);
+            if (!buildNode->children[0]) {
+                node.offset=uint32_t(triangles.size());
+                node.triangleCount=uint16_t(buildNode->count);
+                for (size_t i=buildNode->first; i<buildNode->first+buildNode->count; ++i) {
+                    triangles.push_back(sceneTriangles[references[i].index]);
+                }
+                ++buildStatistics.leafCount;
+                buildStatistics.maxLeafSize=std::max(buildStatistics.maxLeafSize, buildNode->count);
+            } else {
+                node.offset=uint32_t(nodes.size());
+                node.triangleCount=0;
+                nodes.resize(nodes.size()+2);
+                pending.emplace_back(buildNode->children[1], node.offset+1);
+                depths.push_back(depth+1);
+                pending.emplace_back(buildNode->children[0], node.offset);
+                depths.push_back(depth+1);
+            }
+            nodes[nodeIndex]=node;
+        }
+        // The padding node doesn't count.
+        buildStatistics.nodeCount=nodes.size()-1;
+        buildStatistics.arena=builder.getArenaStatistics();
+    }
+    const std::chrono::duration<double, std::milli> elapsed=std::chrono::steady_clock::now()-start;
+    buildStatistics.buildMilliseconds=elapsed.count();
+}
+
+bool BVH::intersect(const Ray &ray, Hit &hit, TraversalStatistics *statistics) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    const Vector &origin=ray.getOrigin();
+    const Vector &direction=ray.getDirection();
+    const Vector inverseDirection(1.0f/direction.getX(), 1.0f/direction.getY(), 1.0f/direction.getZ());
+    TraversalStatistics counters;
+    counters.rays=1;
+    bool isHit=false;
+    uint32_t stack[stackSize];
+    size_t stackTop=0;
+    uint32_t nodeIndex=0;
+    ++counters.boxTests;
+    if (intersectNode(nodes[0], origin, inverseDirection, hit.distance)==INFINITY) {
+        if (statistics!=nullptr) {
+            *statistics+=counters;
+        }
+        return false;
+    }
+    while (true) {
+        const BVHNode &node=nodes[nodeIndex];
+        ++counters.nodesVisited;
+        if (node.isLeaf()) {
+            for (uint32_t i=node.offset; i<node.offset+node.triangleCount; ++i) {
+                isHit|=triangles[i].intersect(ray, hit);
+            }
+            counters.triangleTests+=node.triangleCount;
+        } else {
+            // Test both children, descend into the nearer one and keep the farther one for later.
+            const float nearDistance=intersectNode(nodes[node.offset], origin, inverseDirection, hit.distance);
+            const float farDistance=intersectNode(nodes[node.offset+1], origin, inverseDirection, hit.distance);
+            counters.boxTests+=2;
+            uint32_t nearChild=node.offset, farChild=node.offset+1;
+            float nearest=nearDistance, farthest=farDistance;
+            if (farDistance<nearDistance) {
+                std::swap(nearChild, farChild);
+                std::swap(nearest, farthest);
+            }
+            if (nearest!=INFINITY) {
+                if (farthest!=INFINITY) {
+                    stack[stackTop++]=farChild;
+                }
+                nodeIndex=nearChild;
+                continue;
+            }
+        }
+        // Pop the next node, skipping the ones the closest hit so far is already in front of.
+        bool isFound=false;
+        while (stackTop>0 && !isFound) {
+            nodeIndex=stack[--stackTop];
+            ++counters.boxTests;
+            isFound=intersectNode(nodes[nodeIndex], origin, inverseDirection, hit.distance)!=INFINITY;
+        }
+        if (!isFound) {
+            break;
+        }
+    }
+    if (statistics!=nullptr) {
+        *statistics+=counters;
+    }
+    return isHit;
+}
+
+BoundingBox BVH::getBounds() const {
+    if (nodes.empty()) {
+        return BoundingBox();
+    }
+    const BVHNode &root=nodes[0];
+    return BoundingBox(Vector(root.minX, root.minY, root.minZ), Vector(root.maxX, root.maxY, root.maxZ));
+}
@@ -0,0 +1,164 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+#include "arena.h"
+#include "geometry.h"
+#include "intersect.h"
+
+/// An axis aligned bounding box.
+struct BoundingBox {
+    Vector min, max;
+
+    /// Constructors.
+    /// An empty box, that grows to the first point it is expanded with.
+    BoundingBox() : min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {}
+    BoundingBox(const Vector &newMin, const Vector &newMax) : min(newMin), max(newMax) {}
+
+    /// Grow the box so that it contains a point or another box.
+    void expand(const Vector &point);
+    void expand(const BoundingBox &box);
+    /// Whether the box contains anything.
+    bool isEmpty() const {
+        return min.getX()>max.getX();
+    }
+    /// The size of the box along each axis.
+    Vector getExtent() const {
+        return max-min;
+    }
+    Vector getCenter() const {
+        return (min+max)*0.5f;
+    }
+    /// The surface area of the box, 0 for an empty one.
+    float getSurfaceArea() const;
+};
+
+/// A node of the flattened hierarchy - 32 bytes, so the two children of a node, which are always
+/// stored next to each other, share a single cache line.
+struct alignas(32) BVHNode {
+    /// The bounds of everything below the node.
+    float minX, minY, minZ;
+    float maxX, maxY, maxZ;
+    /// The index of the first child for inner nodes, the first triangle for leaves.
+    uint32_t offset;
+    /// The number of triangles in a leaf, 0 for inner nodes.
+    uint16_t triangleCount;
+    /// The axis the node was split along.
+    uint8_t axis;
+    uint8_t padding;
+
+    bool isLeaf() const {
+        return triangleCount!=0;
+    }
+};
+
+/// An allocator for containers that have to start on a cache line.
+template <typename Type>
+struct CacheAlignedAllocator {
+    typedef Type value_type;
+
+    CacheAlignedAllocator() {}
+    template <typename OtherType>
+    CacheAlignedAllocator(const CacheAlignedAllocator<OtherType> &) {}
+
+    Type *allocate(size_t count) {
+        const size_t bytes=(count*sizeof(Type)+63)/64*64;
+        void *memory=aligned_alloc(64, bytes);
+        if (memory==nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<Type *>(memory);
+    }
+    void deallocate(Type *memory, size_t) {
+        free(memory);
+    }
+    template <typename OtherType>
+    bool operator==(const CacheAlignedAllocator<OtherType> &) const {
+        return true;
+    }
+    template <typename OtherType>
+    bool operator!=(const CacheAlignedAllocator<OtherType> &) const {
+        return false;
+    }
+};
+
+/// Counters of the work done while tracing rays through a BVH.
+/// Each thread should use its own and add them up at the end.
+struct TraversalStatistics {
+    uint64_t rays=0;
+    uint64_t nodesVisited=0;
+    uint64_t boxTests=0;
+    uint64_t triangleTests=0;
+
+    TraversalStatistics &operator+=(const TraversalStatistics &other) {
+        rays+=other.rays;
+        nodesVisited+=other.nodesVisited;
+        boxTests+=other.boxTests;
+        triangleTests+=other.triangleTests;
+        return *this;
+    }
+};
+
+/// Information about the last build of a BVH.
+struct BuildStatistics {
+    double buildMilliseconds=0.0;
+    size_t triangleCount=0;
+    size_t nodeCount=0;
+    size_t leafCount=0;
+    size_t maxDepth=0;
+    size_t maxLeafSize=0;
+    /// The memory of the temporary tree, released in one go once it is flattened.
+    ArenaStatistics arena;
+};
+
+/// A bounding volume hierarchy over a triangle scene, built with the binned surface area heuristic.
+/// Subtrees with enough triangles are built in parallel. The result is flattened into a single
+/// cache-line-aligned node array, with the triangles reordered so every leaf is a contiguous range.
+class BVH {
+private:
+    /// The flattened nodes - the root is node 0, and the children of every inner node are a pair
+    /// starting at an even index.
+    std::vector<BVHNode, CacheAlignedAllocator<BVHNode>> nodes;
+    /// The triangles in leaf order. Their ids are the indices in the list the BVH was built from.
+    std::vector<TriangleRecord> triangles;
+    BuildStatistics buildStatistics;
+public:
+    /// The number of buckets the centroids are sorted into when looking for a split.
+    static constexpr int binCount=16;
+    /// Nodes with at most this many triangles are never split.
+    static constexpr size_t minLeafSize=2;
+    /// Nodes with more triangles are always split, even if the heuristic says otherwise.
+    static constexpr size_t maxLeafSize=16;
+    /// The size of the fixed traversal stack. Past half of this depth the build only does median splits,
+    /// so no tree it produces is deep enough to overflow it.
+    static constexpr size_t stackSize=64;
+
+    /// Build the hierarchy over a list of triangles. A thread count of 0 means one per hardware thread.
+    void build(const std::vector<Triangle> &sceneTriangles, size_t threadCount=0);
+    /// Build the hierarchy over the triangles of a mesh. The hit ids are the triangle indices in the mesh.
+    void build(const Mesh &mesh, size_t threadCount=0);
+    /// Build the hierarchy over already precomputed triangles, keeping their ids.
+    void build(std::vector<TriangleRecord> sceneTriangles, size_t threadCount=0);
+    /// Find the closest intersection of a ray with the scene, closer than hit.distance.
+    /// Updates the hit and returns true if one was found. Counts the work done if statistics is given.
+    bool intersect(const Ray &ray, Hit &hit, TraversalStatistics *statistics=nullptr) const;
+
+    /// Getters.
+    const BuildStatistics &getBuildStatistics() const {
+        return buildStatistics;
+    }
+    const std::vector<BVHNode, CacheAlignedAllocator<BVHNode>> &getNodes() const {
+        return nodes;
+    }
+    const std::vector<TriangleRecord> &getTriangles() const {
+        return triangles;
+    }
+    /// The bounds of the whole scene.
+    BoundingBox getBounds() const;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include <math.h>
+
+#include "camera.h"
+
+namespace {
+
+/// Rotate a vector around a normalized axis, by a given angle in degrees (Rodrigues' formula).
+Vector rotateAroundAxis(const Vector &vector, const Vector &axis, float degrees) {
+    const float radians=degrees*float(M_PI)/180.0f;
+    const float cosine=cosf(radians);
+    const float sine=sinf(radians);
+    return vector*cosine+axis.crossProduct(vector)*sine+axis*(axis.dotProduct(vector)*(1.0f-cosine));
+}
+
+}
+
+// Camera.
+static_assert(Camera(1920, 1080).getForward().getZ()==-1.0f, "The default camera must be a compile time constant.");
+
+void Camera::lookAt(const Vector &target, const Vector &worldUp) {
+    forward=target-position;
+    forward.normalize();
+    right=forward.crossProduct(worldUp);
+    right.normalize();
+    up=right.crossProduct(forward);
+}
+
+void Camera::dolly(float distance) {
+    position=position+forward*distance;
+}
+
+void Camera::truck(float distance) {
+    position=position+right*distance;
+}
+
+void Camera::pedestal(float distance) {
+    position=position+up*distance;
+}
+
+void Camera::pan(float degrees) {
+    right=rotateAroundAxis(right, up, degrees);
+    forward=rotateAroundAxis(forward, up, degrees);
+}
+
+void Camera::tilt(float degrees) {
+    up=rotateAroundAxis(up, right, degrees);
+    forward=rotateAroundAxis(forward, right, degrees);
+}
+
+void Camera::roll(float degrees) {
+    // Rotating counter-clockwise as seen by the camera is a negative turn around the viewing direction.
+    right=rotateAroundAxis(right, forward, -degrees);
+    up=rotateAroundAxis(up, forward, -degrees);
+}
+
+Ray Camera::generateRay(float pixelX, float pixelY) const {
+    float x=pixelX, y=pixelY;
+    // To NDC space - [0.0, 1.0].
+    x/=width;
+    y/=height;
+    // To screen space - [-1.0, 1.0].
+    x=(2.0*x)-1.0;
+    y=1.0-(2.0*y);
+    // Aspect ratio.
+    x*=float(width)/height;
+    // Direction, in the camera's orientation.
+    Vector direction=right*x+up*y+forward;
+    // Normalize vector.
+    direction.normalize();
+    return Ray(position, direction);
+}
+
+void Camera::generateRowRays(size_t i, size_t fromJ, size_t count, Ray *rays) const {
+    for (size_t j=0; j<count; ++j) {
+        rays[j]=generatePixelRay(fromJ+j, i);
+    }
+}
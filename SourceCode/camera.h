@@ -0,0 +1,117 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "geometry.h"
+#include "simd.h"
+
+/// A pinhole camera that generates the primary ray of any pixel on demand,
+/// so no per-pixel ray storage is needed.
+/// The orientation is kept as three orthonormal axes - right, up and forward. By default
+/// the camera sits at the origin and looks down -Z with +Y up.
+class Camera {
+private:
+    /// The position of the camera.
+    Vector position;
+    /// The orientation of the camera.
+    Vector right, up, forward;
+    /// The image resolution the rays are generated for.
+    size_t width, height;
+public:
+    /// Constructors. A camera with the default orientation is a compile time constant.
+    constexpr Camera(size_t newWidth, size_t newHeight)
+        : position(0.0, 0.0, 0.0)
+        , right(1.0, 0.0, 0.0)
+        , up(0.0, 1.0, 0.0)
+        , forward(0.0, 0.0, -1.0)
+        , width(newWidth)
+        , height(newHeight) {}
+    Camera(size_t newWidth, size_t newHeight, const Vector &newPosition, const Vector &target, const Vector &worldUp=Vector(0.0, 1.0, 0.0))
+        : Camera(newWidth, newHeight) {
+        position=newPosition;
+        lookAt(target, worldUp);
+    }
+
+    /// Getters.
+    constexpr const Vector &getPosition() const {
+        return position;
+    }
+    constexpr const Vector &getRight() const {
+        return right;
+    }
+    constexpr const Vector &getUp() const {
+        return up;
+    }
+    constexpr const Vector &getForward() const {
+        return forward;
+    }
+    constexpr size_t getWidth() const {
+        return width;
+    }
+    constexpr size_t getHeight() const {
+        return height;
+    }
+
+    /// Change the resolution of the image the rays are generated for.
+    void changeResolution(size_t newWidth, size_t newHeight) {
+        width=newWidth;
+        height=newHeight;
+    }
+    /// Move the camera to a new position, keeping its orientation.
+    void changePosition(const Vector &newPosition) {
+        position=newPosition;
+    }
+    /// Set the orientation directly. The axes are expected to be orthonormal.
+    void changeOrientation(const Vector &newRight, const Vector &newUp, const Vector &newForward) {
+        right=newRight;
+        up=newUp;
+        forward=newForward;
+    }
+    /// Turn the camera towards a target point.
+    void lookAt(const Vector &target, const Vector &worldUp=Vector(0.0, 1.0, 0.0));
+
+    /// Camera movements, along the camera's own axes.
+    /// Move forwards, or backwards for a negative distance.
+    void dolly(float distance);
+    /// Move to the right, or left for a negative distance.
+    void truck(float distance);
+    /// Move up, or down for a negative distance.
+    void pedestal(float distance);
+    /// Camera rotations, in degrees.
+    /// Rotate around the up axis - positive turns left.
+    void pan(float degrees);
+    /// Rotate around the right axis - positive turns up.
+    void tilt(float degrees);
+    /// Rotate around the forward axis - positive turns counter-clockwise.
+    void roll(float degrees);
+
+    /// Generate the normalized primary ray through a point of the image, in pixels.
+    /// The point (j+0.5, i+0.5) is the center of pixel (j, i).
+    Ray generateRay(float pixelX, float pixelY) const;
+    /// Generate the normalized primary ray through the center of a pixel.
+    Ray generatePixelRay(size_t j, size_t i) const {
+        return generateRay(float(j)+0.5f, float(i)+0.5f);
+    }
+    /// Generate the rays through the centers of count consecutive pixels of a row, starting at fromJ.
+    void generateRowRays(size_t i, size_t fromJ, size_t count, Ray *rays) const;
+    /// Generate the normalized directions through the centers of SIMD_WIDTH consecutive pixels of a row,
+    /// starting at fromJ. All of them start at the camera position.
+    /// The lanes are bit-identical to the directions of generatePixelRay(..).
+    SIMD_INLINE VectorPacket generateDirectionPacket(size_t i, size_t fromJ) const {
+        PacketFloat x=packetSequence(float(fromJ))+0.5f;
+        PacketFloat y=packetBroadcast(float(i)+0.5f);
+        // To NDC space - [0.0, 1.0].
+        x=x/float(width);
+        y=y/float(height);
+        // To screen space - [-1.0, 1.0].
+        x=2.0f*x-1.0f;
+        y=1.0f-2.0f*y;
+        // Aspect ratio.
+        x=x*(float(width)/height);
+        // Direction, in the camera's orientation.
+        VectorPacket directions=VectorPacket(right)*x+VectorPacket(up)*y+VectorPacket(forward);
+        directions.normalize();
+        return directions;
+    }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+
+#include "color.h"
+#include "utils.h"
+
+// Color.
+Color Color::operator+(const Color &otherColor) const {
+    const int newR=R+otherColor.R;
+    const int newG=G+otherColor.G;
+    const int newB=B+otherColor.B;
+    return Color(newR, newG, newB);
+}
+
+Color Color::operator-(const Color &otherColor) const {
+    const int newR=(R-otherColor.R);
+    const int newG=(G-otherColor.G);
+    const int newB=(B-otherColor.B);
+    return Color(newR, newG, newB);
+}
+
+Color Color::operator*(double multiplier) const {
+    if (multiplier<0) {
+        return *this;
+    }
+    const int newR=int(R*multiplier);
+    const int newG=int(G*multiplier);
+    const int newB=int(B*multiplier);
+    return Color(newR, newG, newB);
+}
+
+Color Color::invert() const {
+    return Color(abs(255-R), abs(255-G), abs(255-B));
+}
+
+Color Color::interpolate(const Color &otherColor, double multiplier) const {
+    // The steps of (otherColor-*this)*multiplier+*this, channel by channel, without the temporary colors.
+    const auto interpolateChannel=[multiplier](int from, int to) {
+        const int difference=to-from;
+        const int scaled=multiplier<0 ? difference : int(std::min(difference*multiplier, 255.0));
+        return std::min(scaled+from, 255);
+    };
+    return Color(interpolateChannel(R, otherColor.R), interpolateChannel(G, otherColor.G), interpolateChannel(B, otherColor.B));
+}
+
+Color Color::addNoise(RandomStream &random) const {
+    const int grayValue=(random.nextBelow(2)==0)
+        ? int(random.nextBelow(255))
+        : -int(random.nextBelow(255));
+    const int newR=clamp(R+grayValue, 0, 255);
+    const int newG=clamp(G+grayValue, 0, 255);
+    const int newB=clamp(B+grayValue, 0, 255);
+    return Color(newR, newG, newB);
+}
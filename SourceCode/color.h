@@ -0,0 +1,28 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include "random.h"
+
+/// A structure holding the information about a color - its
+/// red, green and blue components.
+struct Color {
+    /// The red green and blue components.
+    int R, G, B;
+
+    /// Constructors.
+    Color() : R(0), G(0), B(0) {}
+    Color(int red, int green, int blue) : R(red), G(green), B(blue) {}
+
+    /// Operators, channel by channel. They don't clamp - the channels are only clamped when the image is encoded.
+    Color operator+(const Color &otherColor) const;
+    Color operator-(const Color &otherColor) const;
+    Color operator*(double multiplier) const;
+    /// Invert a color's value.
+    Color invert() const;
+    /// Interpolate between color values.
+    Color interpolate(const Color &otherColor, double multiplier) const;
+    /// Add random gray noise to a color, drawn from the given random stream.
+    Color addNoise(RandomStream &random) const;
+};
+
+#endif
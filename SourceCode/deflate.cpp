@@ -0,0 +1,269 @@
+#include <string.h>
+#include <algorithm>
+
+#include "deflate.h"
+
+namespace {
+
+/// The size of the hash table of match candidates, in bits.
+const int hashBits=15;
+/// How far back a match can refer.
+const size_t windowSize=32768;
+/// The shortest match looked for - four bytes are hashed at once - and the longest deflate allows.
+const size_t minMatch=4;
+const size_t maxMatch=258;
+
+/// The first length and the number of extra bits of the length symbols 257..285.
+const uint16_t lengthBases[29]={
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const uint8_t lengthExtraBits[29]={
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+/// The first distance and the number of extra bits of the distance symbols 0..29.
+const uint16_t distanceBases[30]={
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const uint8_t distanceExtraBits[30]={
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+uint32_t reverseBits(uint32_t value, int length) {
+    uint32_t reversed=0;
+    for (int i=0; i<length; ++i) {
+        reversed=(reversed<<1)|((value>>i)&1);
+    }
+    return reversed;
+}
+
+/// The fixed Huffman codes and the lookups from lengths and distances to their symbols.
+/// Huffman codes are sent starting from their highest bit, so they are kept reversed, ready to be written.
+struct DeflateTables {
+    uint16_t literalCodes[288];
+    uint8_t literalLengths[288];
+    uint16_t distanceCodes[30];
+    /// The length symbol (0..28) of every length.
+    uint8_t lengthSymbols[maxMatch+1];
+    /// The distance symbol of distance d is at d-1 for d<=256 and at 256+((d-1)>>7) above, like in zlib.
+    uint8_t distanceSymbols[512];
+
+    DeflateTables() {
+        for (int symbol=0; symbol<288; ++symbol) {
+            uint32_t code;
+            int length;
+            if (symbol<144) {
+                code=0x30+symbol;
+                length=8;
+            } else if (symbol<256) {
+                code=0x190+(symbol-144);
+                length=9;
+            } else if (symbol<280) {
+                code=symbol-256;
+                length=7;
+            } else {
+                code=0xc0+(symbol-280);
+                length=8;
+            }
+            literalCodes[symbol]=uint16_t(reverseBits(code, length));
+            literalLengths[symbol]=uint8_t(length);
+        }
+        for (int symbol=0; symbol<30; ++symbol) {
+            distanceCodes[symbol]=uint16_t(reverseBits(symbol, 5));
+        }
+        for (int symbol=0; symbol<29; ++symbol) {
+            const size_t last=symbol==28 ? maxMatch : size_t(lengthBases[symbol+1])-1;
+            for (size_t length=lengthBases[symbol]; length<=last; ++length) {
+                lengthSymbols[length]=uint8_t(symbol);
+            }
+        }
+        for (int symbol=0; symbol<30; ++symbol) {
+            const size_t first=distanceBases[symbol], count=size_t(1)<<distanceExtraBits[symbol];
+            for (size_t distance=first; distance<first+count; ++distance) {
+                distanceSymbols[distance<=256 ? distance-1 : 256+((distance-1)>>7)]=uint8_t(symbol);
+            }
+        }
+    }
+};
+
+const DeflateTables &getDeflateTables() {
+    static const DeflateTables tables;
+    return tables;
+}
+
+/// Writes bit fields to a byte stream, starting from the lowest bit of each byte, as deflate expects.
+class BitWriter {
+private:
+    std::vector<char> &output;
+    uint64_t bits;
+    int bitCount;
+public:
+    /// Constructors.
+    explicit BitWriter(std::vector<char> &newOutput) : output(newOutput), bits(0), bitCount(0) {}
+
+    /// Write the lowest length bits of a value, at most 32.
+    void write(uint32_t value, int length) {
+        bits|=uint64_t(value)<<bitCount;
+        bitCount+=length;
+        if (bitCount>=32) {
+            const char bytes[4]={char(bits), char(bits>>8), char(bits>>16), char(bits>>24)};
+            output.insert(output.end(), bytes, bytes+4);
+            bits>>=32;
+            bitCount-=32;
+        }
+    }
+    /// Write out the bits that are left, padding the last byte with zeros.
+    void flushToByte() {
+        for (; bitCount>0; bitCount-=8) {
+            output.push_back(char(bits));
+            bits>>=8;
+        }
+        bits=0;
+        bitCount=0;
+    }
+};
+
+/// The hash table of match candidates of each thread. It holds positions offset by a base that grows with every
+/// call, so the entries of earlier calls are told apart by their value and the table never has to be cleared.
+thread_local std::vector<uint32_t> matchCandidates;
+thread_local uint32_t matchBase=0;
+
+uint32_t readWord(const uint8_t *data) {
+    uint32_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+uint32_t hashWord(uint32_t word) {
+    return (word*2654435761u)>>(32-hashBits);
+}
+
+}
+
+void deflateBlock(const uint8_t *data, size_t size, std::vector<char> &output) {
+    const DeflateTables &tables=getDeflateTables();
+    if (matchCandidates.empty() || uint64_t(matchBase)+size+1>=UINT32_MAX) {
+        matchCandidates.assign(size_t(1)<<hashBits, 0);
+        matchBase=0;
+    }
+    const uint32_t base=matchBase;
+    uint32_t *candidates=matchCandidates.data();
+
+    BitWriter writer(output);
+    // A non-final block with the fixed codes.
+    writer.write(0x2, 3);
+    const auto writeLiteral=[&](uint8_t literal) {
+        writer.write(tables.literalCodes[literal], tables.literalLengths[literal]);
+    };
+    size_t i=0;
+    while (i+minMatch<=size) {
+        const uint32_t word=readWord(data+i);
+        const uint32_t hash=hashWord(word);
+        const uint32_t candidate=candidates[hash];
+        candidates[hash]=base+uint32_t(i)+1;
+        // Only the entries above the base were added by this call.
+        if (candidate>base) {
+            const size_t matchPosition=candidate-base-1;
+            if (i-matchPosition<=windowSize && readWord(data+matchPosition)==word) {
+                const size_t limit=std::min(maxMatch, size-i);
+                size_t length=minMatch;
+                while (length<limit && data[matchPosition+length]==data[i+length]) {
+                    ++length;
+                }
+                const size_t distance=i-matchPosition;
+                const int lengthSymbol=tables.lengthSymbols[length];
+                writer.write(tables.literalCodes[257+lengthSymbol], tables.literalLengths[257+lengthSymbol]);
+                writer.write(uint32_t(length-lengthBases[lengthSymbol]), lengthExtraBits[lengthSymbol]);
+                const int distanceSymbol=tables.distanceSymbols[distance<=256 ? distance-1 : 256+((distance-1)>>7)];
+                writer.write(tables.distanceCodes[distanceSymbol], 5);
+                writer.write(uint32_t(distance-distanceBases[distanceSymbol]), distanceExtraBits[distanceSymbol]);
+                // Remember the positions inside the match as well, for the matches that follow.
+                const size_t end=std::min(i+length, size-minMatch+1);
+                for (size_t j=i+1; j<end; ++j) {
+                    candidates[hashWord(readWord(data+j))]=base+uint32_t(j)+1;
+                }
+                i+=length;
+                continue;
+            }
+        }
+        writeLiteral(data[i]);
+        ++i;
+    }
+    for (; i<size; ++i) {
+        writeLiteral(data[i]);
+    }
+    // The end of the block, then the sync flush - an empty non-final stored block, which ends on a byte boundary.
+    writer.write(tables.literalCodes[256], tables.literalLengths[256]);
+    writer.write(0x0, 3);
+    writer.flushToByte();
+    const char emptyStoredBlock[4]={0x00, 0x00, char(0xff), char(0xff)};
+    output.insert(output.end(), emptyStoredBlock, emptyStoredBlock+4);
+    matchBase=base+uint32_t(size)+1;
+}
+
+void appendDeflateEnd(std::vector<char> &output) {
+    // A final block with the fixed codes (the bits 1, 01), holding only the end of block symbol (seven zero bits).
+    output.push_back(0x03);
+    output.push_back(0x00);
+}
+
+uint32_t computeAdler32(const uint8_t *data, size_t size, uint32_t adler) {
+    const uint32_t modulus=65521;
+    // The most bytes that can be summed before the sums have to be reduced, to not overflow.
+    const size_t maxRun=5552;
+    uint32_t a=adler&0xffff, b=adler>>16;
+    while (size>0) {
+        const size_t run=std::min(size, maxRun);
+        for (size_t i=0; i<run; ++i) {
+            a+=data[i];
+            b+=a;
+        }
+        a%=modulus;
+        b%=modulus;
+        data+=run;
+        size-=run;
+    }
+    return (b<<16)|a;
+}
+
+uint32_t combineAdler32(uint32_t firstAdler, uint32_t secondAdler, size_t secondSize) {
+    // The same as zlib's adler32_combine.
+    const uint32_t modulus=65521;
+    const uint32_t remainder=uint32_t(secondSize%modulus);
+    uint32_t a=firstAdler&0xffff;
+    uint32_t b=uint32_t((uint64_t(remainder)*a)%modulus);
+    a+=(secondAdler&0xffff)+modulus-1;
+    b+=(firstAdler>>16)+(secondAdler>>16)+modulus-remainder;
+    if (a>=modulus) {
+        a-=modulus;
+    }
+    if (a>=modulus) {
+        a-=modulus;
+    }
+    if (b>=2*modulus) {
+        b-=2*modulus;
+    }
+    if (b>=modulus) {
+        b-=modulus;
+    }
+    return (b<<16)|a;
+}
+
+uint32_t computeCrc32(const uint8_t *data, size_t size, uint32_t crc) {
+    static const std::vector<uint32_t> table=[]() {
+        std::vector<uint32_t> newTable(256);
+        for (uint32_t i=0; i<256; ++i) {
+            uint32_t value=i;
+            for (int bit=0; bit<8; ++bit) {
+                value=(value&1) ? 0xedb88320u^(value>>1) : value>>1;
+            }
+            newTable[i]=value;
+        }
+        return newTable;
+    }();
+    crc=~crc;
+    for (size_t i=0; i<size; ++i) {
+        crc=table[(crc^data[i])&0xff]^(crc>>8);
+    }
+    return ~crc;
+}
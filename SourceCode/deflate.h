@@ -0,0 +1,27 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// A small, dependency-free deflate compressor and the checksums of the zlib and PNG formats.
+///
+/// The data is compressed with greedy LZ77 matching and the fixed Huffman codes of deflate. Every call compresses
+/// its data independently and ends with a sync flush - an empty stored block that leaves the output byte aligned.
+/// So pieces compressed on different threads can be concatenated into a single valid stream, which is then closed
+/// with appendDeflateEnd(..).
+
+/// Compress data as non-final deflate blocks, appended to the output.
+void deflateBlock(const uint8_t *data, size_t size, std::vector<char> &output);
+/// Append the final, empty deflate block that ends a stream.
+void appendDeflateEnd(std::vector<char> &output);
+
+/// The Adler-32 checksum of the zlib format, continued from the checksum of the data before.
+uint32_t computeAdler32(const uint8_t *data, size_t size, uint32_t adler=1);
+/// The Adler-32 checksum of two pieces of data, from the checksums of each and the size of the second one.
+uint32_t combineAdler32(uint32_t firstAdler, uint32_t secondAdler, size_t secondSize);
+/// The CRC-32 checksum of the PNG chunks, continued from the checksum of the data before.
+uint32_t computeCrc32(const uint8_t *data, size_t size, uint32_t crc=0);
+
+#endif
@@ -0,0 +1,496 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+
+#include "distributed.h"
+#include "draw.h"
+
+namespace {
+
+/// The messages between the coordinator and a worker. Both run on the same machine, so everything goes
+/// in the layout and byte order of the machine.
+enum class MessageType : uint32_t {
+    /// Coordinator to worker - a JobMessage.
+    Job=1,
+    /// Worker to coordinator - a ResultMessage followed by the pixels of the tile, row by row.
+    Result=2,
+    /// Coordinator to worker - finish and exit.
+    Shutdown=3
+};
+
+struct MessageHeader {
+    MessageType type;
+    /// The bytes after the header.
+    uint32_t size;
+};
+
+struct JobMessage {
+    uint32_t jobIndex;
+    uint32_t imageWidth, imageHeight;
+    uint32_t fromX, fromY, width, height;
+    float position[3], right[3], up[3], forward[3];
+};
+
+struct ResultMessage {
+    uint32_t jobIndex;
+    uint32_t width, height;
+};
+
+/// The most a single read takes from a worker socket.
+const size_t receiveChunkSize=size_t(1)<<16;
+
+#ifdef FAULT_INJECTION
+/// The jobs after which a worker exits, 0 for never.
+size_t crashJobCount=0;
+#endif
+
+void storeVector(float *destination, const Vector &vector) {
+    destination[0]=vector.getX();
+    destination[1]=vector.getY();
+    destination[2]=vector.getZ();
+}
+
+Vector loadVector(const float *source) {
+    return Vector(source[0], source[1], source[2]);
+}
+
+/// Send all bytes, continuing after partial sends. A peer that went away gives false instead of SIGPIPE.
+bool sendAll(int socket, const void *data, size_t size) {
+    const char *bytes=static_cast<const char *>(data);
+    while (size>0) {
+        const ssize_t sent=send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent<0) {
+            if (errno==EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes+=sent;
+        size-=size_t(sent);
+    }
+    return true;
+}
+
+/// Receive exactly size bytes. Returns false on an error or if the peer went away.
+bool receiveAll(int socket, void *data, size_t size) {
+    char *bytes=static_cast<char *>(data);
+    while (size>0) {
+        const ssize_t count=recv(socket, bytes, size, 0);
+        if (count<0 && errno==EINTR) {
+            continue;
+        }
+        if (count<=0) {
+            return false;
+        }
+        bytes+=count;
+        size-=size_t(count);
+    }
+    return true;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+}
+
+}
+
+// RenderCoordinator.
+RenderCoordinator::~RenderCoordinator() {
+    stop();
+}
+
+bool RenderCoordinator::start() {
+    if (!workers.empty()) {
+        printf("The render workers are already started.\n");
+        return false;
+    }
+    workers.resize(std::max<size_t>(settings.workerCount, 1));
+    size_t startedCount=0;
+    for (Worker &worker : workers) {
+        startedCount+=startWorker(worker) ? 1 : 0;
+    }
+    if (startedCount==0) {
+        workers.clear();
+        printf("None of the render workers could be started.\n");
+        return false;
+    }
+    return true;
+}
+
+void RenderCoordinator::stop() {
+    const MessageHeader header={MessageType::Shutdown, 0};
+    for (Worker &worker : workers) {
+        if (worker.isAlive()) {
+            sendAll(worker.socket, &header, sizeof(header));
+        }
+    }
+    for (Worker &worker : workers) {
+        endWorker(worker);
+    }
+    workers.clear();
+}
+
+size_t RenderCoordinator::getAliveWorkerCount() const {
+    return size_t(std::count_if(workers.begin(), workers.end(), [](const Worker &worker) {
+        return worker.isAlive();
+    }));
+}
+
+bool RenderCoordinator::startWorker(Worker &worker) {
+    // Both ends are closed on exec, so the workers don't inherit each other's sockets. The child clears
+    // the flag on its own end only.
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sockets)!=0) {
+        printf("Couldn't create a socket for a render worker: %s.\n", strerror(errno));
+        return false;
+    }
+    std::vector<std::string> argumentStrings={
+        settings.workerExecutable,
+        "worker",
+        std::to_string(sockets[1]),
+        std::to_string(settings.workerThreadCount)
+    };
+    argumentStrings.insert(argumentStrings.end(), settings.workerArguments.begin(), settings.workerArguments.end());
+    // Everything the child needs is prepared before the fork, since it may only make async-signal-safe calls.
+    std::vector<char *> arguments;
+    for (std::string &argument : argumentStrings) {
+        arguments.push_back(&argument[0]);
+    }
+    arguments.push_back(nullptr);
+
+    const pid_t processId=fork();
+    if (processId==0) {
+        fcntl(sockets[1], F_SETFD, 0);
+        execv(arguments[0], arguments.data());
+        _exit(127);
+    }
+    close(sockets[1]);
+    if (processId<0) {
+        printf("Couldn't start a render worker: %s.\n", strerror(errno));
+        close(sockets[0]);
+        return false;
+    }
+    worker.processId=processId;
+    worker.socket=sockets[0];
+    worker.jobsInFlight.clear();
+    worker.sendTimes.clear();
+    worker.receivedSize=0;
+    ++statistics.workersStarted;
+    return true;
+}
+
+void RenderCoordinator::endWorker(Worker &worker) {
+    if (worker.socket>=0) {
+        close(worker.socket);
+        worker.socket=-1;
+    }
+    if (worker.processId<0) {
+        return;
+    }
+    // A worker exits once its socket is closed, unless it is stuck - it gets a second to finish the job it is on.
+    int status=0;
+    pid_t result=0;
+    for (int attempt=0; attempt<100 && result==0; ++attempt) {
+        result=waitpid(worker.processId, &status, WNOHANG);
+        if (result==0) {
+            usleep(10000);
+        }
+    }
+    if (result==0) {
+        kill(worker.processId, SIGKILL);
+        waitpid(worker.processId, &status, 0);
+    }
+    worker.processId=-1;
+}
+
+bool RenderCoordinator::loseWorker(Worker &worker, std::deque<size_t> &pendingJobs, std::vector<size_t> &jobAttempts) {
+    const pid_t processId=worker.processId;
+    const size_t lostCount=worker.jobsInFlight.size();
+    // Whatever state it is in, it won't get another job.
+    if (processId>=0) {
+        kill(processId, SIGKILL);
+    }
+    endWorker(worker);
+    printf("Render worker %d was lost with %zu jobs, they go to the other workers.\n", int(processId), lostCount);
+    ++statistics.workersLost;
+    statistics.jobsRequeued+=lostCount;
+
+    bool isRecoverable=true;
+    // Back to the front, in their order, so the frame still fills in roughly in order.
+    while (!worker.jobsInFlight.empty()) {
+        const size_t jobIndex=worker.jobsInFlight.back();
+        worker.jobsInFlight.pop_back();
+        if (++jobAttempts[jobIndex]>=settings.maxJobAttempts) {
+            printf("Job %zu was lost with %zu workers, giving up on it.\n", jobIndex, jobAttempts[jobIndex]);
+            isRecoverable=false;
+        }
+        pendingJobs.push_front(jobIndex);
+    }
+    worker.sendTimes.clear();
+    if (workerRestarts<settings.maxWorkerRestarts) {
+        ++workerRestarts;
+        startWorker(worker);
+    }
+    return isRecoverable;
+}
+
+bool RenderCoordinator::sendJob(Worker &worker, size_t jobIndex, const RenderJob &job) {
+    const MessageHeader header={MessageType::Job, uint32_t(sizeof(JobMessage))};
+    JobMessage message;
+    message.jobIndex=uint32_t(jobIndex);
+    message.imageWidth=uint32_t(job.camera.getWidth());
+    message.imageHeight=uint32_t(job.camera.getHeight());
+    message.fromX=uint32_t(job.tile.fromX);
+    message.fromY=uint32_t(job.tile.fromY);
+    message.width=uint32_t(job.tile.width);
+    message.height=uint32_t(job.tile.height);
+    storeVector(message.position, job.camera.getPosition());
+    storeVector(message.right, job.camera.getRight());
+    storeVector(message.up, job.camera.getUp());
+    storeVector(message.forward, job.camera.getForward());
+    char bytes[sizeof(header)+sizeof(message)];
+    memcpy(bytes, &header, sizeof(header));
+    memcpy(bytes+sizeof(header), &message, sizeof(message));
+    if (!sendAll(worker.socket, bytes, sizeof(bytes))) {
+        return false;
+    }
+    worker.jobsInFlight.push_back(jobIndex);
+    worker.sendTimes.push_back(std::chrono::steady_clock::now());
+    return true;
+}
+
+bool RenderCoordinator::receive(Worker &worker, const std::vector<RenderJob> &jobs, const RenderJobCallback &onJobFinished, size_t &finishedCount) {
+    // Take everything there is without blocking.
+    bool isOpen=true;
+    for (;;) {
+        if (worker.received.size()-worker.receivedSize<receiveChunkSize) {
+            worker.received.resize(std::max(worker.received.size()*2, worker.receivedSize+receiveChunkSize));
+        }
+        const ssize_t count=recv(worker.socket, worker.received.data()+worker.receivedSize, receiveChunkSize, MSG_DONTWAIT);
+        if (count>0) {
+            worker.receivedSize+=size_t(count);
+            statistics.bytesReceived+=uint64_t(count);
+            continue;
+        }
+        if (count<0 && errno==EINTR) {
+            continue;
+        }
+        isOpen=count<0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+        break;
+    }
+
+    size_t offset=0;
+    while (worker.receivedSize-offset>=sizeof(MessageHeader)) {
+        MessageHeader header;
+        memcpy(&header, worker.received.data()+offset, sizeof(header));
+        if (worker.receivedSize-offset-sizeof(header)<header.size) {
+            break;
+        }
+        const char *payload=worker.received.data()+offset+sizeof(header);
+        ResultMessage result;
+        if (header.type!=MessageType::Result || header.size<sizeof(result)) {
+            printf("Render worker %d sent an unknown message.\n", int(worker.processId));
+            return false;
+        }
+        memcpy(&result, payload, sizeof(result));
+        // A worker works through its jobs in order, so the result is always for the oldest one.
+        if (worker.jobsInFlight.empty() || worker.jobsInFlight.front()!=result.jobIndex) {
+            printf("Render worker %d sent a job it didn't have.\n", int(worker.processId));
+            return false;
+        }
+        const RenderJob &job=jobs[result.jobIndex];
+        const size_t pixelCount=job.tile.width*job.tile.height;
+        if (result.width!=job.tile.width || result.height!=job.tile.height || header.size!=sizeof(result)+pixelCount*sizeof(Color)) {
+            printf("Render worker %d sent a tile of the wrong size.\n", int(worker.processId));
+            return false;
+        }
+        // Every message is a whole number of 4-byte values, so the pixels stay aligned for Color.
+        onJobFinished(job, reinterpret_cast<const Color *>(payload+sizeof(result)));
+        worker.jobsInFlight.pop_front();
+        worker.sendTimes.pop_front();
+        ++finishedCount;
+        ++statistics.jobsFinished;
+        offset+=sizeof(header)+header.size;
+    }
+    // What is left of a message moves to the front, for the next read to complete it.
+    worker.receivedSize-=offset;
+    memmove(worker.received.data(), worker.received.data()+offset, worker.receivedSize);
+    return isOpen;
+}
+
+bool RenderCoordinator::run(const std::vector<RenderJob> &jobs, const RenderJobCallback &onJobFinished) {
+    if (workers.empty() && !start()) {
+        return false;
+    }
+    const std::chrono::steady_clock::time_point startTime=std::chrono::steady_clock::now();
+    std::deque<size_t> pendingJobs;
+    for (size_t i=0; i<jobs.size(); ++i) {
+        pendingJobs.push_back(i);
+    }
+    std::vector<size_t> jobAttempts(jobs.size(), 0);
+    std::vector<pollfd> descriptors;
+    std::vector<Worker *> polledWorkers;
+    size_t finishedCount=0;
+    bool isSuccessful=true;
+    while (finishedCount<jobs.size() && isSuccessful) {
+        // Keep every worker busy with the next jobs in line.
+        for (Worker &worker : workers) {
+            while (worker.isAlive() && worker.jobsInFlight.size()<settings.jobsPerWorker && !pendingJobs.empty()) {
+                const size_t jobIndex=pendingJobs.front();
+                pendingJobs.pop_front();
+                if (!sendJob(worker, jobIndex, jobs[jobIndex])) {
+                    pendingJobs.push_front(jobIndex);
+                    isSuccessful=loseWorker(worker, pendingJobs, jobAttempts) && isSuccessful;
+                }
+            }
+        }
+        if (!isSuccessful) {
+            break;
+        }
+
+        descriptors.clear();
+        polledWorkers.clear();
+        int timeout=-1;
+        for (Worker &worker : workers) {
+            if (!worker.isAlive()) {
+                continue;
+            }
+            descriptors.push_back(pollfd{worker.socket, POLLIN, 0});
+            polledWorkers.push_back(&worker);
+            if (settings.jobTimeoutMilliseconds>0.0 && !worker.sendTimes.empty()) {
+                const double remaining=settings.jobTimeoutMilliseconds-millisecondsSince(worker.sendTimes.front());
+                const int workerTimeout=std::max(int(remaining)+1, 0);
+                timeout=timeout<0 ? workerTimeout : std::min(timeout, workerTimeout);
+            }
+        }
+        if (descriptors.empty()) {
+            printf("Every render worker is gone, %zu of %zu jobs are unfinished.\n", jobs.size()-finishedCount, jobs.size());
+            isSuccessful=false;
+            break;
+        }
+        if (poll(descriptors.data(), descriptors.size(), timeout)<0 && errno!=EINTR) {
+            printf("Couldn't wait for the render workers: %s.\n", strerror(errno));
+            isSuccessful=false;
+            break;
+        }
+        for (size_t i=0; i<descriptors.size(); ++i) {
+            Worker &worker=*polledWorkers[i];
+            if (descriptors[i].revents!=0 && !receive(worker, jobs, onJobFinished, finishedCount)) {
+                isSuccessful=loseWorker(worker, pendingJobs, jobAttempts) && isSuccessful;
+            }
+        }
+        // A worker that sits on a job for too long is taken for hung.
+        if (settings.jobTimeoutMilliseconds>0.0) {
+            for (Worker &worker : workers) {
+                if (worker.isAlive() && !worker.sendTimes.empty() && millisecondsSince(worker.sendTimes.front())>settings.jobTimeoutMilliseconds) {
+                    printf("Render worker %d didn't finish a job in %.0f ms.\n", int(worker.processId), settings.jobTimeoutMilliseconds);
+                    isSuccessful=loseWorker(worker, pendingJobs, jobAttempts) && isSuccessful;
+                }
+            }
+        }
+    }
+    // The jobs still out belong to a render that is over, so the workers go and the next run starts new ones.
+    if (!isSuccessful) {
+        for (Worker &worker : workers) {
+            if (worker.isAlive() && !worker.jobsInFlight.empty()) {
+                kill(worker.processId, SIGKILL);
+            }
+        }
+        stop();
+    }
+    statistics.milliseconds+=millisecondsSince(startTime);
+    return isSuccessful;
+}
+
+bool RenderCoordinator::renderFrame(const Camera &camera, FrameBuffer<Color> &pixels) {
+    if (pixels.getWidth()!=camera.getWidth() || pixels.getHeight()!=camera.getHeight()) {
+        printf("The frame buffer resolution doesn't match the camera.\n");
+        return false;
+    }
+    const size_t tileSize=std::max<size_t>(settings.tileSize, 1);
+    std::vector<RenderJob> jobs;
+    for (size_t fromY=0; fromY<pixels.getHeight(); fromY+=tileSize) {
+        for (size_t fromX=0; fromX<pixels.getWidth(); fromX+=tileSize) {
+            const Tile tile={fromX, fromY, std::min(tileSize, pixels.getWidth()-fromX), std::min(tileSize, pixels.getHeight()-fromY)};
+            jobs.push_back(RenderJob(0, camera, tile));
+        }
+    }
+    return run(jobs, [&](const RenderJob &job, const Color *tilePixels) {
+        for (size_t i=0; i<job.tile.height; ++i) {
+            memcpy(pixels.row(job.tile.fromY+i)+job.tile.fromX, tilePixels+i*job.tile.width, job.tile.width*sizeof(Color));
+        }
+    });
+}
+
+// The worker.
+#ifdef FAULT_INJECTION
+void injectWorkerCrash(size_t jobCount) {
+    crashJobCount=jobCount;
+}
+#endif
+
+bool runRenderWorker(int socket, const BVH *scene, const Color &backgroundColor, size_t threadCount) {
+    TileScheduler scheduler(std::max<size_t>(threadCount, 1));
+    // The drawer is made for the resolution of the jobs, and made again only when it changes.
+    std::unique_ptr<RayDrawer> drawer;
+    std::vector<char> message;
+#ifdef FAULT_INJECTION
+    size_t jobCount=0;
+#endif
+    for (;;) {
+        MessageHeader header;
+        if (!receiveAll(socket, &header, sizeof(header))) {
+            return false;
+        }
+        if (header.type==MessageType::Shutdown) {
+            return true;
+        }
+        JobMessage job;
+        if (header.type!=MessageType::Job || header.size!=sizeof(job) || !receiveAll(socket, &job, sizeof(job))) {
+            printf("The render worker got a broken job.\n");
+            return false;
+        }
+        if (!drawer || drawer->getCamera().getWidth()!=job.imageWidth || drawer->getCamera().getHeight()!=job.imageHeight) {
+            drawer=std::make_unique<RayDrawer>("", job.imageWidth, job.imageHeight);
+            drawer->changeScheduler(scheduler);
+            if (scene) {
+                drawer->changeScene(*scene, backgroundColor);
+            }
+        }
+        Camera camera(job.imageWidth, job.imageHeight);
+        camera.changePosition(loadVector(job.position));
+        camera.changeOrientation(loadVector(job.right), loadVector(job.up), loadVector(job.forward));
+        drawer->changeCamera(camera);
+        const Tile tile={job.fromX, job.fromY, job.width, job.height};
+        drawer->fillRegionFromRays(tile);
+
+        // The header, the result and the rows of the tile go out as a single message.
+        const size_t pixelBytes=tile.width*tile.height*sizeof(Color);
+        const ResultMessage result={job.jobIndex, job.width, job.height};
+        const MessageHeader resultHeader={MessageType::Result, uint32_t(sizeof(result)+pixelBytes)};
+        message.resize(sizeof(resultHeader)+sizeof(result)+pixelBytes);
+        memcpy(message.data(), &resultHeader, sizeof(resultHeader));
+        memcpy(message.data()+sizeof(resultHeader), &result, sizeof(result));
+        char *rowBytes=message.data()+sizeof(resultHeader)+sizeof(result);
+        const FrameBuffer<Color> &pixels=drawer->getFrameBuffer();
+        for (size_t i=0; i<tile.height; ++i) {
+            memcpy(rowBytes+i*tile.width*sizeof(Color), pixels.row(tile.fromY+i)+tile.fromX, tile.width*sizeof(Color));
+        }
+#ifdef FAULT_INJECTION
+        if (++jobCount==crashJobCount) {
+            _exit(1);
+        }
+#endif
+        if (!sendAll(socket, message.data(), message.size())) {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+/// Rendering on several worker processes of the same machine, coordinated by the renderer.
+///
+/// The coordinator starts the workers as "<executable> worker <socket> <threads> <worker arguments...>", each with
+/// its own end of a local socket pair. A worker loads the scene once, keeps it with its BVH for as long as it
+/// runs and renders the jobs it gets one after the other - a tile of a frame, or a whole frame. The finished
+/// pixels stream back and the coordinator merges them. A worker that dies or stops answering loses its
+/// unfinished jobs to the other workers, and a new one is started in its place.
+
+/// A piece of work for a worker - a tile of the frame a camera sees. A whole frame is a tile covering it.
+struct RenderJob {
+    size_t frameIndex;
+    Camera camera;
+    Tile tile;
+
+    /// Constructor.
+    RenderJob(size_t newFrameIndex, const Camera &newCamera, const Tile &newTile)
+        : frameIndex(newFrameIndex)
+        , camera(newCamera)
+        , tile(newTile) {}
+};
+
+/// The settings of the coordinator and its workers.
+struct DistributedSettings {
+    /// The number of worker processes.
+    size_t workerCount=4;
+    /// The threads each worker renders a job with. The workers together should not have more than the machine.
+    size_t workerThreadCount=1;
+    /// The side of the tiles a frame is split into by renderFrame(..).
+    size_t tileSize=64;
+    /// The jobs a worker can have at once, so it starts on the next one while the last one is on its way back.
+    size_t jobsPerWorker=2;
+    /// A worker whose oldest job takes longer than this is taken for hung and killed, 0 to wait forever.
+    double jobTimeoutMilliseconds=0.0;
+    /// How often a job can be lost with a worker before the render gives up on it.
+    size_t maxJobAttempts=3;
+    /// How many lost workers are replaced by new ones over the life of the coordinator.
+    size_t maxWorkerRestarts=8;
+    /// The renderer executable to start the workers from - the running one by default.
+    std::string workerExecutable="/proc/self/exe";
+    /// What the workers get after their socket and thread count, e.g. the scene file.
+    std::vector<std::string> workerArguments;
+};
+
+/// What the coordinator did, since it started.
+struct DistributedStatistics {
+    size_t jobsFinished;
+    /// The jobs that were lost with a worker and handed to another one.
+    size_t jobsRequeued;
+    size_t workersStarted;
+    size_t workersLost;
+    uint64_t bytesReceived;
+    double milliseconds;
+
+    /// Constructor.
+    DistributedStatistics() : jobsFinished(0), jobsRequeued(0), workersStarted(0), workersLost(0), bytesReceived(0), milliseconds(0.0) {}
+};
+
+/// Called for every finished job with its pixels, tile.width of them per row and no padding between the rows.
+using RenderJobCallback=std::function<void(const RenderJob &job, const Color *pixels)>;
+
+/// Hands out render jobs to local worker processes and collects their pixels.
+class RenderCoordinator {
+private:
+    /// A worker process and the coordinator's end of its socket.
+    struct Worker {
+        pid_t processId=-1;
+        int socket=-1;
+        /// The jobs sent to the worker and not finished yet, in the order they were sent, and when they were sent.
+        std::deque<size_t> jobsInFlight;
+        std::deque<std::chrono::steady_clock::time_point> sendTimes;
+        /// What was received but doesn't make a whole message yet, in the first receivedSize bytes.
+        /// The buffer only grows, so reading from the socket doesn't resize it every time.
+        std::vector<char> received;
+        size_t receivedSize=0;
+
+        bool isAlive() const {
+            return socket>=0;
+        }
+    };
+
+    DistributedSettings settings;
+    std::vector<Worker> workers;
+    size_t workerRestarts;
+    DistributedStatistics statistics;
+
+    /// Start a worker process. Returns false with a message if it couldn't be started.
+    bool startWorker(Worker &worker);
+    /// Close the socket of a worker and wait for the process to end, killing it if it doesn't.
+    void endWorker(Worker &worker);
+    /// Put the jobs of a dead worker back in front of the pending ones and replace the worker if it may be.
+    /// Returns false if one of the jobs was lost too often.
+    bool loseWorker(Worker &worker, std::deque<size_t> &pendingJobs, std::vector<size_t> &jobAttempts);
+    bool sendJob(Worker &worker, size_t jobIndex, const RenderJob &job);
+    /// Read what a worker sent and hand over its finished jobs. Returns false if the worker is gone or sent garbage.
+    bool receive(Worker &worker, const std::vector<RenderJob> &jobs, const RenderJobCallback &onJobFinished, size_t &finishedCount);
+public:
+    /// Constructors.
+    explicit RenderCoordinator(const DistributedSettings &newSettings) : settings(newSettings), workerRestarts(0) {}
+    RenderCoordinator(const RenderCoordinator &)=delete;
+    RenderCoordinator &operator=(const RenderCoordinator &)=delete;
+    /// Tells the workers to end and waits for them.
+    ~RenderCoordinator();
+
+    /// Start the workers. Returns false with a message if none of them could be started.
+    bool start();
+    /// Tell the workers to end and wait for them.
+    void stop();
+
+    /// Getters.
+    const DistributedSettings &getSettings() const {
+        return settings;
+    }
+    const DistributedStatistics &getStatistics() const {
+        return statistics;
+    }
+    size_t getAliveWorkerCount() const;
+
+    /// Render the jobs on the workers and call onJobFinished for each of them, in the order they finish, on the
+    /// calling thread. Returns false with a message if a job couldn't be finished, e.g. because every worker is gone.
+    bool run(const std::vector<RenderJob> &jobs, const RenderJobCallback &onJobFinished);
+    /// Render a frame tile by tile on the workers, right into the pixels.
+    bool renderFrame(const Camera &camera, FrameBuffer<Color> &pixels);
+};
+
+/// The loop of a worker process. Reads jobs from the socket, renders them against the scene - or colors them by
+/// the ray directions without one - and sends the pixels back, until the coordinator says to end or goes away.
+/// Returns false if the connection broke.
+bool runRenderWorker(int socket, const BVH *scene, const Color &backgroundColor, size_t threadCount);
+
+#ifdef FAULT_INJECTION
+/// Only for testing the fault handling - the render workers of this process exit without a word after that many jobs,
+/// like crashed ones. 0 turns it off.
+void injectWorkerCrash(size_t jobCount);
+#endif
+
+#endif
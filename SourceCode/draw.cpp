@@ -1,197 +1,518 @@
 #include <math.h>
 #include <stdio.h>
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
+#include "arena.h"
 #include "draw.h"
+#include "pixelkernels.h"
+#include "profiler.h"
 #include "utils.h"
 
-#define EPSILON 0.0001
+// ImageDrawer.
+void ImageDrawer::fillSolidBackground(const Color &backgroundColor) {
+    PROFILE_SCOPE(ProfileStage::Fill);
+    scheduler->runRows(0, height, [&](size_t fromRow, size_t toRow) {
+        PROFILE_COUNT(ProfileCounter::PixelsWritten, (toRow-fromRow)*width);
+        for (size_t i=fromRow; i<toRow; ++i) {
+            fillPixels(pixels.row(i), width, backgroundColor);
+        }
+    });
+}
 
-// Color.
-Color &Color::operator=(const Color &otherColor) {
-    R=otherColor.R;
-    B=otherColor.B;
-    G=otherColor.G;
+void ImageDrawer::fillGradientBackground(const Color &color1, const Color &color2) {
+    PROFILE_SCOPE(ProfileStage::Fill);
+    scheduler->runRows(0, height, [&](size_t fromRow, size_t toRow) {
+        PROFILE_COUNT(ProfileCounter::PixelsWritten, (toRow-fromRow)*width);
+        for (size_t i=fromRow; i<toRow; ++i) {
+            const Color interpolatedColor=color1.interpolate(color2, (double(i)/height));
+            fillPixels(pixels.row(i), width, interpolatedColor);
+        }
+    });
+}
 
-    return *this;
+void ImageDrawer::clearAccumulation() {
+    if (accumulation.getWidth()!=width || accumulation.getHeight()!=height) {
+        accumulation=FrameBuffer<AccumulatedColor>(width, height);
+        return;
+    }
+    scheduler->runRows(0, height, [&](size_t fromRow, size_t toRow) {
+        for (size_t i=fromRow; i<toRow; ++i) {
+            std::fill(accumulation.row(i), accumulation.row(i)+width, AccumulatedColor());
+        }
+    });
 }
 
-Color Color::operator+(const Color &otherColor) const {
-    const int newR=std::min(R+otherColor.R, 255);
-    const int newG=std::min(G+otherColor.G, 255);
-    const int newB=std::min(B+otherColor.B, 255);
-    return Color(newR, newG, newB);
+void ImageDrawer::resolveAccumulation() {
+    if (accumulation.getWidth()!=width || accumulation.getHeight()!=height) {
+        printf("There are no accumulated samples to resolve.\n");
+        return;
+    }
+    PROFILE_SCOPE(ProfileStage::Resolve);
+    const ToneMapper toneMapper(toneMapping, maxValue);
+    scheduler->runRows(0, height, [&](size_t fromRow, size_t toRow) {
+        PROFILE_COUNT(ProfileCounter::PixelsWritten, (toRow-fromRow)*width);
+        for (size_t i=fromRow; i<toRow; ++i) {
+            resolvePixels(accumulation.row(i), width, toneMapper, pixels.row(i));
+        }
+    });
 }
 
-Color Color::operator-(const Color &otherColor) const {
-    const int newR=(R-otherColor.R);
-    const int newG=(G-otherColor.G);
-    const int newB=(B-otherColor.B);
-    return Color(newR, newG, newB);
+void ImageDrawer::fillShapes(const ShapeBatch &shapes) {
+    shapes.rasterize(pixels, *scheduler);
 }
 
-Color Color::operator*(double multiplier) const {
-    if (multiplier<0) {
-        return *this;
+void ImageDrawer::draw() const {
+    // Write the pixels block by block in the chosen format.
+    // The compressing formats encode the rows of each block in parallel.
+    const std::unique_ptr<ImageWriter> writer=createImageWriter(outputFormat, outputFilePath);
+    writer->changeScheduler(scheduler);
+    if (!writer->writeImage(pixels, maxValue)) {
+        return;
     }
-    const int newR=int(std::min(R*multiplier, 255.0));
-    const int newG=int(std::min(G*multiplier, 255.0));
-    const int newB=int(std::min(B*multiplier, 255.0));
-    return Color(newR, newG, newB);
+    const ImageWriterStatistics &statistics=writer->getStatistics();
+    printf("Image drawn: %zu bytes, %.2fx compression, encoded at %.1f MB/s.\n", statistics.encodedBytes,
+           statistics.getCompressionRatio(), statistics.getEncodeMegabytesPerSecond());
 }
 
-Color Color::invert() const {
-    return Color(abs(255-R), abs(255-G), abs(255-B));
+// CircleDrawer.
+void CircleDrawer::fillSolidCircle(const Color &color) {
+    ShapeBatch shapes;
+    shapes.add(Shape::makeCircle(centerX, centerY, radius, color));
+    fillShapes(shapes);
 }
 
-Color Color::interpolate(const Color &otherColor, double multiplier) const {
-    return (otherColor-(*this))*multiplier+(*this);
+void CircleDrawer::fillGradientCircle(const Color &color1, const Color &color2) {
+    ShapeBatch shapes;
+    shapes.add(Shape::makeGradientCircle(centerX, centerY, radius, color1, color2));
+    fillShapes(shapes);
 }
 
-Color Color::addNoise() const {
-    const int grayValue=((rand()%2)==0)
-        ? rand()%255
-        : -rand()%255;
-    const int newR=clamp(R+grayValue, 0, 255);
-    const int newG=clamp(G+grayValue, 0, 255);
-    const int newB=clamp(B+grayValue, 0, 255);
-    return Color(newR, newG, newB);
+// RectangleDrawer.
+void RectangleDrawer::fillSolidRectangle(const Color &color) {
+    ShapeBatch shapes;
+    shapes.add(Shape::makeRectangle(fromX, fromY, sizeX, sizeY, color));
+    fillShapes(shapes);
 }
 
-// ImageDrawer.
-void ImageDrawer::fillSolidBackground(const Color &backgroundColor) {
-    for (int i=0; i<height; ++i) {
-        for (int j=0; j<width; ++j) {
-            pixels[i][j]=backgroundColor;
+void RectangleDrawer::fillGradientRectangle(const Color &color1, const Color &color2) {
+    ShapeBatch shapes;
+    shapes.add(Shape::makeGradientRectangle(fromX, fromY, sizeX, sizeY, color1, color2));
+    fillShapes(shapes);
+}
+
+void RectangleDrawer::fillNoiseRectangle(const Color &color, uint64_t seed) {
+    PROFILE_SCOPE(ProfileStage::Fill);
+    const int startX=std::max(fromX, 0);
+    const int startY=std::max(fromY, 0);
+    const int lengthX=std::min(fromX+sizeX, int(width));
+    const int lengthY=std::min(fromY+sizeY, int(height));
+    if (startX>=lengthX || startY>=lengthY) {
+        return;
+    }
+    scheduler->runRows(startY, lengthY-startY, [&](size_t fromRow, size_t toRow) {
+        PROFILE_COUNT(ProfileCounter::PixelsWritten, (toRow-fromRow)*size_t(lengthX-startX));
+        for (size_t i=fromRow; i<toRow; ++i) {
+            Color *row=pixels.row(i);
+            for (int j=startX; j<lengthX; ++j) {
+                RandomStream random(seed, j, i);
+                row[j]=color.addNoise(random);
+            }
         }
+    });
+}
+
+// RayDrawer.
+namespace {
+
+/// Color a pixel by the absolute value of its normalized ray direction.
+void fillPixelFromRay(const Camera &camera, Color &pixel, size_t i, size_t j) {
+    const Ray &ray=camera.generatePixelRay(j, i);
+    const Vector &currentDirection=ray.getDirection().absolute()*255.0;
+    pixel.R=int(currentDirection.getX());
+    pixel.G=int(currentDirection.getY());
+    pixel.B=int(currentDirection.getZ());
+}
+
+/// Color a pixel by the triangle its ray hits, or with the background color if it hits nothing.
+void fillPixelFromScene(const Ray &ray, const BVH &scene, const std::vector<Vector> &normals,
+                        const Color &backgroundColor, Color &pixel, TraversalStatistics *statistics) {
+    Hit hit;
+    if (!scene.intersect(ray, hit, statistics)) {
+        pixel=backgroundColor;
+        return;
     }
+    const Vector &normal=normals[hit.triangleId];
+    const float facing=fabsf(normal.dotProduct(ray.getDirection()));
+    const Vector &shade=normal.absolute()*(255.0f*facing);
+    pixel.R=int(shade.getX());
+    pixel.G=int(shade.getY());
+    pixel.B=int(shade.getZ());
 }
 
-void ImageDrawer::fillGradientBackground(const Color &color1, const Color &color2) {
-    for (int i=0; i<height; ++i) {
-        const Color &interpolatedColor=color1.interpolate(color2, (double(i)/height));
-        for (int j=0; j<width; ++j) {
-            pixels[i][j]=interpolatedColor;
+/// The luminance of a linear color, which the noise of a pixel is estimated by.
+float findLuminance(float red, float green, float blue) {
+    return 0.2126f*red+0.7152f*green+0.0722f*blue;
+}
+
+/// Find where a sample goes inside its pixel, in [0, 1) on both axes.
+/// The first strataSide*strataSide samples of a pixel each go to their own cell of a grid over the pixel,
+/// the rest anywhere in it.
+void findSampleOffset(uint64_t seed, size_t i, size_t j, uint32_t sample, uint32_t strataSide, float &offsetX, float &offsetY) {
+    RandomStream random(seed, j, i, sample);
+    offsetX=random.nextFloat();
+    offsetY=random.nextFloat();
+    if (sample<strataSide*strataSide) {
+        offsetX=(float(sample%strataSide)+offsetX)/strataSide;
+        offsetY=(float(sample/strataSide)+offsetY)/strataSide;
+    }
+}
+
+/// Color the pixels [fromJ, toJ) of a row, SIMD_WIDTH pixels per iteration.
+SIMD_DISPATCH
+void fillRowFromRayPackets(const Camera &camera, Color *row, size_t i, size_t fromJ, size_t toJ) {
+    size_t j=fromJ;
+    for (; j+SIMD_WIDTH<=toJ; j+=SIMD_WIDTH) {
+        const VectorPacket &directions=camera.generateDirectionPacket(i, j).absolute()*255.0f;
+        const PacketInt red=packetToInt(directions.getX());
+        const PacketInt green=packetToInt(directions.getY());
+        const PacketInt blue=packetToInt(directions.getZ());
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+            row[j+lane].R=red[lane];
+            row[j+lane].G=green[lane];
+            row[j+lane].B=blue[lane];
         }
     }
+    // The pixels that don't fill a whole packet.
+    for (; j<toJ; ++j) {
+        fillPixelFromRay(camera, row[j], i, j);
+    }
 }
 
-void ImageDrawer::draw() const {
-    // Open the output stream.
-    std::ofstream outputStream(outputFilePath, std::ofstream::out);
-    // If it's not valid, print an error and early return.
-    if (!outputStream.is_open()) {
-        printf("Couldn't open the given file path.\n");
-        return;
+}
+
+void RayDrawer::changeScene(const BVH &newScene, const Color &newBackgroundColor) {
+    scene=&newScene;
+    backgroundColor=newBackgroundColor;
+    const std::vector<TriangleRecord> &triangles=scene->getTriangles();
+    // The ids are indices into the list the BVH was built from, but records built elsewhere may skip some.
+    uint32_t idCount=0;
+    for (const TriangleRecord &triangle : triangles) {
+        idCount=std::max(idCount, triangle.getId()+1);
     }
-    // Print the magic number.
-    outputStream<<magicNumber<<'\n';
-    // Print the resolution.
-    outputStream<<width<<' '<<height<<'\n';
-    // Print the max intensity for a Color value.
-    outputStream<<maxValue<<'\n';
-    // Print the Color values per Color.
-    for (int i=0; i<height; ++i) {
-        for (int j=0; j<width; ++j) {
-            outputStream<<pixels[i][j].R<<' '<<pixels[i][j].G<<' '<<pixels[i][j].B<<'\t';
-        }
-        outputStream<<'\n';
+    sceneNormals.assign(idCount, Vector());
+    for (const TriangleRecord &triangle : triangles) {
+        sceneNormals[triangle.getId()]=triangle.getNormal();
     }
-    // Close the output stream.
-    outputStream.close();
-    printf("Image drawn.\n");
 }
 
-// CircleDrawer.
-void CircleDrawer::fillSolidCircle(const Color &color) {
-    for (int i=0; i<height; ++i) {
-        for (int j=0; j<width; ++j) {
-            const double dX=pow(j-centerX, 2);
-            const double dY=pow(i-centerY, 2);
-            const double raduisSquared=pow(radius, 2);
-            if ((dX+dY-raduisSquared)<EPSILON) {
-                pixels[i][j]=color;
+void RayDrawer::fillPixelsFromRays() {
+    fillRegionFromRays(Tile{0, 0, width, height});
+}
+
+void RayDrawer::fillRegionFromRays(const Tile &region) {
+    // The wavefront renders whole images only.
+    if (useWavefront && region.width==width && region.height==height) {
+        wavefront.render(camera, scene, sceneNormals, backgroundColor, pixels, *scheduler);
+        return;
+    }
+    PROFILE_SCOPE(ProfileStage::Render);
+    scheduler->run(region.fromX, region.fromY, region.width, region.height, [&](const Tile &tile) {
+        if (scene) {
+            fillTileFromScene(tile);
+            return;
+        }
+        PROFILE_COUNT(ProfileCounter::RaysGenerated, tile.width*tile.height);
+        PROFILE_COUNT(ProfileCounter::PixelsWritten, tile.width*tile.height);
+        for (size_t i=tile.fromY; i<tile.fromY+tile.height; ++i) {
+            Color *row=pixels.row(i);
+            if (usePackets) {
+                fillRowFromRayPackets(camera, row, i, tile.fromX, tile.fromX+tile.width);
+                continue;
+            }
+            for (size_t j=tile.fromX; j<tile.fromX+tile.width; ++j) {
+                fillPixelFromRay(camera, row[j], i, j);
             }
         }
-    }
+    });
 }
 
-void CircleDrawer::fillGradientCircle(const Color &color1, const Color &color2) {
-    for (int i=0; i<height; ++i) {
-        for (int j=0; j<width; ++j) {
-            const double dX=pow(j-centerX, 2);
-            const double dY=pow(i-centerY, 2);
-            const double raduisSquared=pow(radius, 2);
-            if ((dX+dY-raduisSquared)<EPSILON) {
-                pixels[i][j]=color1.interpolate(color2, (double(i)/height));
-            }
+void RayDrawer::fillTileFromScene(const Tile &tile) {
+    ScratchScope scratch;
+    Ray *rays=scratch.allocateArray<Ray>(tile.width);
+    TraversalStatistics statistics;
+    // The traversal is only counted while profiling, to keep the counting off the hot path otherwise.
+    TraversalStatistics *countedStatistics=Profiler::getInstance().isEnabled() ? &statistics : nullptr;
+    for (size_t i=tile.fromY; i<tile.fromY+tile.height; ++i) {
+        {
+            PROFILE_TIMER(ProfileStage::RayGeneration);
+            camera.generateRowRays(i, tile.fromX, tile.width, rays);
+        }
+        PROFILE_TIMER(ProfileStage::Shading);
+        Color *row=pixels.row(i);
+        for (size_t j=0; j<tile.width; ++j) {
+            fillPixelFromScene(rays[j], *scene, sceneNormals, backgroundColor, row[tile.fromX+j], countedStatistics);
         }
     }
+    PROFILE_COUNT(ProfileCounter::RaysGenerated, tile.width*tile.height);
+    PROFILE_COUNT(ProfileCounter::PixelsWritten, tile.width*tile.height);
+    PROFILE_COUNT(ProfileCounter::NodesVisited, statistics.nodesVisited);
+    PROFILE_COUNT(ProfileCounter::BoxTests, statistics.boxTests);
+    PROFILE_COUNT(ProfileCounter::TriangleTests, statistics.triangleTests);
 }
 
-// RectangleDrawer.
-void RectangleDrawer::fillSolidRectangle(const Color &color) {
-    const int lengthX=std::min(fromX+sizeX, int(width));
-    const int lengthY=std::min(fromY+sizeY, int(height));
-    for (int i=fromY; i<lengthY; ++i) {
-        for (int j=fromX; j<lengthX; ++j) {
-            pixels[i][j]=color;
-        }
+void RayDrawer::accumulatePixelsFromRays() {
+    if (accumulation.getWidth()!=width || accumulation.getHeight()!=height) {
+        clearAccumulation();
     }
+    PROFILE_SCOPE(ProfileStage::Render);
+    scheduler->run(width, height, [&](const Tile &tile) {
+        accumulateTile(tile);
+    });
 }
 
-void RectangleDrawer::fillGradientRectangle(const Color &color1, const Color &color2) {
-    const int lengthX=std::min(fromX+sizeX, int(width));
-    const int lengthY=std::min(fromY+sizeY, int(height));
-    for (int i=fromY; i<lengthY; ++i) {
-        for (int j=fromX; j<lengthX; ++j) {
-            pixels[i][j]=color1.interpolate(color2, (double(i)/height));
+void RayDrawer::accumulateTile(const Tile &tile) {
+    ScratchScope scratch;
+    Ray *rays=scratch.allocateArray<Ray>(tile.width);
+    TraversalStatistics statistics;
+    TraversalStatistics *countedStatistics=Profiler::getInstance().isEnabled() ? &statistics : nullptr;
+    const float inverseMaxValue=1.0f/maxValue;
+    const Vector background(backgroundColor.R*inverseMaxValue, backgroundColor.G*inverseMaxValue, backgroundColor.B*inverseMaxValue);
+    for (size_t i=tile.fromY; i<tile.fromY+tile.height; ++i) {
+        {
+            PROFILE_TIMER(ProfileStage::RayGeneration);
+            camera.generateRowRays(i, tile.fromX, tile.width, rays);
+        }
+        PROFILE_TIMER(ProfileStage::Shading);
+        AccumulatedColor *row=accumulation.row(i)+tile.fromX;
+        for (size_t j=0; j<tile.width; ++j) {
+            const Vector &shade=traceSample(rays[j], background, countedStatistics);
+            row[j].addSample(shade.getX(), shade.getY(), shade.getZ());
         }
     }
+    PROFILE_COUNT(ProfileCounter::RaysGenerated, tile.width*tile.height);
+    PROFILE_COUNT(ProfileCounter::NodesVisited, statistics.nodesVisited);
+    PROFILE_COUNT(ProfileCounter::BoxTests, statistics.boxTests);
+    PROFILE_COUNT(ProfileCounter::TriangleTests, statistics.triangleTests);
 }
 
-void RectangleDrawer::fillNoiseRectangle(const Color &color) {
-    const int lengthX=std::min(fromX+sizeX, int(width));
-    const int lengthY=std::min(fromY+sizeY, int(height));
-    for (int i=fromY; i<lengthY; ++i) {
-        for (int j=fromX; j<lengthX; ++j) {
-            pixels[i][j]=color.addNoise();
-        }
+Vector RayDrawer::traceSample(const Ray &ray, const Vector &background, TraversalStatistics *statistics) const {
+    if (!scene) {
+        return ray.getDirection().absolute();
+    }
+    Hit hit;
+    if (!scene->intersect(ray, hit, statistics)) {
+        return background;
     }
+    const Vector &normal=sceneNormals[hit.triangleId];
+    return normal.absolute()*fabsf(normal.dotProduct(ray.getDirection()));
 }
 
-// RayDrawer.
-void RayDrawer::prepareRays() {
-    for (int i=0; i<height; ++i) {
-        for (int j=0; j<width; ++j) {
-            float x=j, y=i;
-            // Find center.
-            x+=0.5;
-            y+=0.5;
-            // To NDC space - [0.0, 1.0].
-            x/=width;
-            y/=height;
-            // To screen space - [-1.0, 1.0].
-            x=(2.0*x)-1.0;
-            y=1.0-(2.0*y);
-            // Aspect ratio.
-            x*=float(width)/height;
-            // Direction.
-            Vector direction=Vector(x, y, -1);
-            // Normalize vector.
-            direction.normalize();
-            rays[i][j]=Ray(cameraPosition, direction);
+SamplingStatistics RayDrawer::fillPixelsFromRaysAdaptive(const SamplingSettings &settings) {
+    PROFILE_SCOPE(ProfileStage::Render);
+    const std::chrono::steady_clock::time_point startTime=std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::time_point deadline=startTime
+        +std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(settings.timeBudgetMilliseconds));
+    const bool hasTimeBudget=settings.timeBudgetMilliseconds>0.0;
+    const uint32_t initialSamples=std::max(settings.initialSamples, 1u);
+    const uint32_t samplesPerPass=std::max(settings.samplesPerPass, 1u);
+    const uint32_t maxSamples=std::max(settings.maxSamples, initialSamples);
+    const uint32_t strataSide=uint32_t(sqrtf(float(initialSamples)));
+    const float squaredThreshold=settings.errorThreshold*settings.errorThreshold;
+    const float inverseMaxValue=1.0f/maxValue;
+    const Vector background(backgroundColor.R*inverseMaxValue, backgroundColor.G*inverseMaxValue, backgroundColor.B*inverseMaxValue);
+
+    clearAccumulation();
+    if (luminanceMoments.getWidth()!=width || luminanceMoments.getHeight()!=height) {
+        luminanceMoments=FrameBuffer<LuminanceMoments>(width, height);
+        passSamples=FrameBuffer<uint32_t>(width, height);
+    }
+    // The samples of every row in the current refinement pass.
+    ScratchScope scratch;
+    uint64_t *rowSamples=scratch.allocateArray<uint64_t>(height);
+    std::atomic<uint64_t> samplesTaken(0);
+    std::atomic<size_t> refinedPixels(0);
+    bool budgetExhausted=false;
+    std::atomic<bool> timeExhausted(false);
+
+    // Take the next samples of a pixel.
+    const auto takeSamples=[&](size_t i, size_t j, uint32_t fromSample, uint32_t count, TraversalStatistics *statistics) {
+        AccumulatedColor &sum=accumulation.at(j, i);
+        LuminanceMoments &moments=luminanceMoments.at(j, i);
+        for (uint32_t sample=fromSample; sample<fromSample+count; ++sample) {
+            float offsetX, offsetY;
+            findSampleOffset(settings.seed, i, j, sample, strataSide, offsetX, offsetY);
+            const Vector &shade=traceSample(camera.generateRay(float(j)+offsetX, float(i)+offsetY), background, statistics);
+            sum.addSample(shade.getX(), shade.getY(), shade.getZ());
+            moments.addSample(findLuminance(shade.getX(), shade.getY(), shade.getZ()));
+        }
+    };
+    // How many samples a pixel takes in a refinement pass - none once it is converged or at the cap.
+    const auto findPassSamples=[&](size_t i, size_t j) -> uint32_t {
+        const LuminanceMoments &moments=luminanceMoments.at(j, i);
+        if (moments.count>=maxSamples) {
+            return 0;
+        }
+        // The variance of the mean is the variance of the samples over their count.
+        if (moments.count>1 && moments.findVariance()/moments.count<=squaredThreshold) {
+            return 0;
+        }
+        return std::min(samplesPerPass, maxSamples-moments.count);
+    };
+
+    SamplingStatistics statistics;
+    for (size_t pass=0; ; ++pass) {
+        if (pass>0) {
+            if (hasTimeBudget && std::chrono::steady_clock::now()>=deadline) {
+                timeExhausted=true;
+                break;
+            }
+            // Find what every pixel asks for, then hand out the budget in row order before any sample is taken,
+            // so the pixels that are cut short don't depend on which thread gets to its rows first.
+            scheduler->runRows(0, height, [&](size_t fromRow, size_t toRow) {
+                for (size_t i=fromRow; i<toRow; ++i) {
+                    uint32_t *samples=passSamples.row(i);
+                    uint64_t rowTotal=0;
+                    for (size_t j=0; j<width; ++j) {
+                        samples[j]=findPassSamples(i, j);
+                        rowTotal+=samples[j];
+                    }
+                    rowSamples[i]=rowTotal;
+                }
+            });
+            if (settings.sampleBudget>0) {
+                uint64_t remaining=settings.sampleBudget-std::min(samplesTaken.load(), settings.sampleBudget);
+                for (size_t i=0; i<height; ++i) {
+                    if (rowSamples[i]<=remaining) {
+                        remaining-=rowSamples[i];
+                        continue;
+                    }
+                    budgetExhausted=true;
+                    // The pixels of the row that the budget doesn't reach, and all the rows below it, take nothing.
+                    uint32_t *samples=passSamples.row(i);
+                    rowSamples[i]=remaining;
+                    for (size_t j=0; j<width; ++j) {
+                        samples[j]=uint32_t(std::min<uint64_t>(samples[j], remaining));
+                        remaining-=samples[j];
+                    }
+                }
+                if (budgetExhausted && samplesTaken.load()>=settings.sampleBudget) {
+                    break;
+                }
+            }
+        }
+        refinedPixels=0;
+        scheduler->run(width, height, [&](const Tile &tile) {
+            TraversalStatistics traversal;
+            TraversalStatistics *countedStatistics=Profiler::getInstance().isEnabled() ? &traversal : nullptr;
+            uint64_t tileSamples=0;
+            size_t tileRefinedPixels=0;
+            for (size_t i=tile.fromY; i<tile.fromY+tile.height; ++i) {
+                if (pass==0) {
+                    std::fill(luminanceMoments.row(i)+tile.fromX, luminanceMoments.row(i)+tile.fromX+tile.width, LuminanceMoments());
+                    for (size_t j=tile.fromX; j<tile.fromX+tile.width; ++j) {
+                        takeSamples(i, j, 0, initialSamples, countedStatistics);
+                    }
+                    tileSamples+=uint64_t(initialSamples)*tile.width;
+                    continue;
+                }
+                if (rowSamples[i]==0) {
+                    continue;
+                }
+                if (hasTimeBudget && std::chrono::steady_clock::now()>=deadline) {
+                    timeExhausted=true;
+                    break;
+                }
+                const uint32_t *samples=passSamples.row(i);
+                for (size_t j=tile.fromX; j<tile.fromX+tile.width; ++j) {
+                    if (samples[j]==0) {
+                        continue;
+                    }
+                    takeSamples(i, j, luminanceMoments.at(j, i).count, samples[j], countedStatistics);
+                    ++tileRefinedPixels;
+                    tileSamples+=samples[j];
+                }
+            }
+            samplesTaken+=tileSamples;
+            refinedPixels+=tileRefinedPixels;
+            PROFILE_COUNT(ProfileCounter::RaysGenerated, tileSamples);
+            PROFILE_COUNT(ProfileCounter::NodesVisited, traversal.nodesVisited);
+            PROFILE_COUNT(ProfileCounter::BoxTests, traversal.boxTests);
+            PROFILE_COUNT(ProfileCounter::TriangleTests, traversal.triangleTests);
+        });
+        ++statistics.passes;
+        if (maxSamples==initialSamples || (pass>0 && refinedPixels==0) || budgetExhausted || timeExhausted) {
+            break;
         }
     }
+    resolveAccumulation();
+    statistics.samplesTaken=samplesTaken;
+    statistics.budgetExhausted=budgetExhausted || timeExhausted;
+    statistics.milliseconds=std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-startTime).count();
+    return statistics;
 }
 
-void RayDrawer::fillPixelsFromRays() {
-    for (int i=0; i<height; ++i) {
-        for (int j=0; j<width; ++j) {
-            const Vector &currentDirection=rays[i][j].getDirection().absolute()*255.0;
-            pixels[i][j].R=int(currentDirection.getX());
-            pixels[i][j].G=int(currentDirection.getY());
-            pixels[i][j].B=int(currentDirection.getZ());
+PreviewStatistics RayDrawer::fillPixelsProgressive(const PreviewSettings &settings, FramePublisher *publisher) {
+    PreviewStatistics statistics;
+    if (width==0 || height==0) {
+        return statistics;
+    }
+    PROFILE_SCOPE(ProfileStage::Render);
+    const std::chrono::steady_clock::time_point startTime=std::chrono::steady_clock::now();
+    // The largest power of two that isn't above the requested size, so every block splits into four.
+    size_t firstBlockSize=1;
+    while (firstBlockSize*2<=settings.firstBlockSize) {
+        firstBlockSize*=2;
+    }
+    const bool isCounting=Profiler::getInstance().isEnabled();
+    uint32_t pass=0;
+    for (size_t blockSize=firstBlockSize; blockSize>=1; blockSize/=2, ++pass) {
+        PreviewPass previewPass;
+        previewPass.index=pass;
+        previewPass.blockSize=uint32_t(blockSize);
+        if (publisher!=nullptr) {
+            publisher->beginPass(previewPass);
+        }
+        // Every row of blocks is a separate item, so the blocks of different items never overlap.
+        scheduler->runItems((height+blockSize-1)/blockSize, [&](size_t blockRow) {
+            TraversalStatistics traversal;
+            const size_t i=blockRow*blockSize;
+            const size_t rowCount=std::min(blockSize, height-i);
+            // The blocks of the rows at multiples of twice the block size alternate with the ones the pass before traced.
+            const bool isHalfTraced=pass>0 && i%(2*blockSize)==0;
+            const size_t step=isHalfTraced ? 2*blockSize : blockSize;
+            size_t tracedCount=0;
+            for (size_t j=isHalfTraced ? blockSize : 0; j<width; j+=step) {
+                Color color;
+                if (scene) {
+                    fillPixelFromScene(camera.generatePixelRay(j, i), *scene, sceneNormals, backgroundColor, color,
+                                       isCounting ? &traversal : nullptr);
+                } else {
+                    fillPixelFromRay(camera, color, i, j);
+                }
+                const size_t blockWidth=std::min(blockSize, width-j);
+                for (size_t k=i; k<i+rowCount; ++k) {
+                    fillPixels(pixels.row(k)+j, blockWidth, color);
+                }
+                ++tracedCount;
+            }
+            PROFILE_COUNT(ProfileCounter::RaysGenerated, tracedCount);
+            PROFILE_COUNT(ProfileCounter::PixelsWritten, rowCount*width);
+            PROFILE_COUNT(ProfileCounter::NodesVisited, traversal.nodesVisited);
+            PROFILE_COUNT(ProfileCounter::BoxTests, traversal.boxTests);
+            PROFILE_COUNT(ProfileCounter::TriangleTests, traversal.triangleTests);
+        });
+        const std::chrono::nanoseconds elapsed=std::chrono::steady_clock::now()-startTime;
+        previewPass.nanoseconds=uint64_t(elapsed.count());
+        if (publisher!=nullptr && !publisher->publish(pixels, maxValue, previewPass)) {
+            statistics.isPublished=false;
+        }
+        if (pass==0) {
+            statistics.firstImageMilliseconds=std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-startTime).count();
         }
+        ++statistics.passes;
     }
+    statistics.milliseconds=std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-startTime).count();
+    return statistics;
 }
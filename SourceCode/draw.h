@@ -1,73 +1,120 @@
 #ifndef DRAW_H
 #define DRAW_H
 
+#include <stdio.h>
 #include <iostream>
+#include <vector>
 
+#include "accumulation.h"
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "distributed.h"
+#include "framebuffer.h"
 #include "geometry.h"
-
-/// A structure holding the information about a color - its
-/// red, green and blue components.
-struct Color {
-    /// The red green and blue components.
-    int R, G, B;
-
-    /// Constructors.
-    Color() : R(0), G(0), B(0) {}
-    Color(int red, int green, int blue) : R(red), G(green), B(blue) {}
-
-    /// Operators.
-    Color &operator=(const Color &otherColor);
-    Color operator+(const Color &otherColor) const;
-    Color operator-(const Color &otherColor) const;
-    Color operator*(double multiplier) const;
-    /// Invert a color's value.
-    Color invert() const;
-    /// Interpolate between color values.
-    Color interpolate(const Color &otherColor, double multiplier) const;
-    /// Add random noise to a color.
-    Color addNoise() const;
-};
+#include "imagewriter.h"
+#include "preview.h"
+#include "rasterizer.h"
+#include "scheduler.h"
+#include "wavefront.h"
 
 /// A base class to draw to a .ppm file.
 class ImageDrawer {
 private:
-    /// The magic number for the .ppm file.
-    const std::string magicNumber="P3";
     /// The path to the output .ppm file.
     std::string outputFilePath;
+    /// The format draw() writes the output file in.
+    ImageFormat outputFormat;
 protected:
     /// The file resolution.
     size_t width, height;
-    /// A matrix of pixels.
-    Color **pixels;
+    /// The pixels of the image in a single contiguous buffer.
+    FrameBuffer<Color> pixels;
     /// The max intensity value for a Color.
     const int maxValue=255;
+    /// The scheduler that splits the fill functions into tiles and runs them in parallel.
+    TileScheduler *scheduler;
+    /// The float sums of the samples of each pixel. Empty until clearAccumulation() is called.
+    FrameBuffer<AccumulatedColor> accumulation;
+    /// How resolveAccumulation() turns the sums into pixels.
+    ToneMapping toneMapping;
 public:
     /// Constructors.
     ImageDrawer(const std::string &newOutputFilePath, size_t newWidth, size_t newHeight)
         : outputFilePath(newOutputFilePath)
+        , outputFormat(ImageFormat::PPMBinary)
         , width(newWidth)
-        , height(newHeight) {
-        pixels=new Color*[height];
-        for (int i=0; i<height; ++i) {
-            pixels[i]=new Color[width];
-        }
-    }
-    ~ImageDrawer() {
-        for (int i=0; i<height; ++i) {
-            delete [] pixels[i];
-        }
-        delete [] pixels;
-    }
+        , height(newHeight)
+        , pixels(newWidth, newHeight)
+        , scheduler(&TileScheduler::getDefault()) {}
 
     /// A function to change the output .ppm file.
     void changeOutputFile(const std::string &newOutputFilePath) {
         outputFilePath=newOutputFilePath;
     }
+    /// A function to change the format of the output file. Binary .ppm is the default,
+    /// ImageFormat::PPMText can be used for debugging.
+    void changeOutputFormat(ImageFormat newOutputFormat) {
+        outputFormat=newOutputFormat;
+    }
+    /// A function to change the scheduler running the fill functions, e.g. to use fewer threads or other tiles.
+    /// The scheduler must outlive the drawer.
+    void changeScheduler(TileScheduler &newScheduler) {
+        scheduler=&newScheduler;
+    }
+    /// Access the pixels of the image.
+    FrameBuffer<Color> &getFrameBuffer() {
+        return pixels;
+    }
+    const FrameBuffer<Color> &getFrameBuffer() const {
+        return pixels;
+    }
+    /// Hand the pixels over to another stage without copying them.
+    /// The drawer is left with a fresh buffer of the same resolution.
+    FrameBuffer<Color> releaseFrameBuffer() {
+        FrameBuffer<Color> released(std::move(pixels));
+        pixels=FrameBuffer<Color>(width, height);
+        return released;
+    }
+    /// Take over a buffer from another stage, e.g. a recycled one. It must match the image resolution.
+    void adoptFrameBuffer(FrameBuffer<Color> &&newPixels) {
+        if (newPixels.getWidth()!=width || newPixels.getHeight()!=height) {
+            printf("The frame buffer resolution doesn't match the image.\n");
+            return;
+        }
+        pixels=std::move(newPixels);
+    }
+    /// Swap the pixels with another buffer of the same resolution, e.g. one recycled by a later stage,
+    /// and return the pixels drawn so far. If the resolution doesn't match, the drawer keeps its pixels
+    /// and the given buffer is returned.
+    FrameBuffer<Color> exchangeFrameBuffer(FrameBuffer<Color> &&newPixels) {
+        if (newPixels.getWidth()!=width || newPixels.getHeight()!=height) {
+            printf("The frame buffer resolution doesn't match the image.\n");
+            return std::move(newPixels);
+        }
+        FrameBuffer<Color> released(std::move(pixels));
+        pixels=std::move(newPixels);
+        return released;
+    }
+    /// Access the sums of the samples of each pixel. Samples can be added to it directly, each thread to its own pixels.
+    FrameBuffer<AccumulatedColor> &getAccumulationBuffer() {
+        return accumulation;
+    }
+    /// Start accumulating samples from scratch. The buffer is allocated on the first call.
+    void clearAccumulation();
+    /// Change how the accumulated samples are averaged into pixels.
+    void changeToneMapping(const ToneMapping &newToneMapping) {
+        toneMapping=newToneMapping;
+    }
+    /// Average the accumulated samples of every pixel, tone map them and quantize them into the pixels,
+    /// all in a single pass. This is the step between accumulating samples and draw().
+    void resolveAccumulation();
     /// Fill the image with a solid background color.
     void fillSolidBackground(const Color &backgroundColor);
     /// Fill the image with a gradient - interpolate between two given colors.
     void fillGradientBackground(const Color &color1, const Color &color2);
+    /// Composite a batch of shapes over the image in a single pass, later shapes on top.
+    void fillShapes(const ShapeBatch &shapes);
     /// Output the image to the .ppm file, based on the pixels stored in this class.
     void draw() const;
 };
@@ -159,34 +206,160 @@ public:
     /// circles in the same image. To draw a background color fillSolidBackground(..) or fillGradientBackground(..)
     /// must be called beforehand.
     void fillGradientRectangle(const Color &color1, const Color &color2);
-    void fillNoiseRectangle(const Color &color);
+    /// Fill a rectangle with a color and random gray noise on top of it.
+    /// The noise of each pixel only depends on the seed and the pixel, so the same seed gives the same image.
+    void fillNoiseRectangle(const Color &color, uint64_t seed=0);
+};
+
+/// The settings of adaptive anti-aliasing. Every pixel first takes a few jittered samples, then passes over
+/// the image add more samples only to the pixels whose estimated noise is still above the threshold.
+struct SamplingSettings {
+    /// The samples every pixel starts with. If it is a square number, they are spread over a grid inside the pixel.
+    uint32_t initialSamples;
+    /// The samples a noisy pixel gets in each of the following passes.
+    uint32_t samplesPerPass;
+    /// The most samples a single pixel can take.
+    uint32_t maxSamples;
+    /// A pixel stops taking samples once the standard error of its mean luminance, in [0, 1], is below this.
+    float errorThreshold;
+    /// The most samples for the whole image, 0 for no limit. The initial pass always runs in full, then each
+    /// refinement pass hands out what is left of the budget to the pixels in row order, so it cuts the same pixels short
+    /// for any thread count.
+    uint64_t sampleBudget;
+    /// The most time for the whole image, 0 for no limit.
+    double timeBudgetMilliseconds;
+    /// The seed of the jitter. The same seed and settings give the same image, unless a time budget cuts it short.
+    uint64_t seed;
+
+    /// Constructor.
+    SamplingSettings()
+        : initialSamples(4)
+        , samplesPerPass(4)
+        , maxSamples(64)
+        , errorThreshold(0.01f)
+        , sampleBudget(0)
+        , timeBudgetMilliseconds(0.0)
+        , seed(0) {}
+};
+
+/// What an adaptive render did.
+struct SamplingStatistics {
+    uint64_t samplesTaken;
+    /// The passes over the image, including the initial one.
+    size_t passes;
+    double milliseconds;
+    /// Whether the sample or time budget stopped the refinement before every pixel was done.
+    bool budgetExhausted;
+
+    /// Constructor.
+    SamplingStatistics() : samplesTaken(0), passes(0), milliseconds(0.0), budgetExhausted(false) {}
+};
+
+/// The settings of a progressive preview render.
+struct PreviewSettings {
+    /// The side of the blocks of the first pass, a power of two - 16 shows the first image at 1/16 of the resolution
+    /// along each axis. Every pass after it halves the blocks, down to single pixels.
+    size_t firstBlockSize=16;
+};
+
+/// What a progressive preview render did.
+struct PreviewStatistics {
+    size_t passes;
+    /// From the start of the render until the first pass was published - what the viewer waits for.
+    double firstImageMilliseconds;
+    double milliseconds;
+    /// Whether every pass could be published.
+    bool isPublished;
+
+    /// Constructor.
+    PreviewStatistics() : passes(0), firstImageMilliseconds(0.0), milliseconds(0.0), isPublished(true) {}
 };
 
 /// A class that draws based on rays from a camera.
+/// The rays are generated on the fly while filling the pixels, so no per-pixel rays are stored.
 class RayDrawer : public ImageDrawer {
 private:
-    Vector cameraPosition;
-    Ray **rays;
+    Camera camera;
+    /// Whether to process SIMD_WIDTH pixels at a time with packets, or one pixel at a time.
+    bool usePackets;
+    /// Whether to render the rays as a wavefront, stage by stage, instead of pixel by pixel.
+    bool useWavefront;
+    WavefrontRenderer wavefront;
+    /// The scene the rays are traced against, or nullptr to color the pixels by the ray directions.
+    const BVH *scene;
+    /// The color of the pixels whose rays miss the scene.
+    Color backgroundColor;
+    /// The normals of the scene triangles, indexed by the triangle ids of the hits.
+    std::vector<Vector> sceneNormals;
+
+    /// Trace the rays of a tile against the scene.
+    void fillTileFromScene(const Tile &tile);
+    /// The luminance statistics of the samples of each pixel, to estimate their noise.
+    FrameBuffer<LuminanceMoments> luminanceMoments;
+    /// The samples each pixel takes in the current refinement pass, after the sample budget is split.
+    FrameBuffer<uint32_t> passSamples;
+
+    /// Trace the rays of a tile and add their shades to the accumulation buffer.
+    void accumulateTile(const Tile &tile);
+    /// Find the shade of a ray in [0, 1] per channel - what it hits in the scene, or its direction without a scene.
+    Vector traceSample(const Ray &ray, const Vector &background, TraversalStatistics *statistics) const;
 public:
     /// Constructors.
     RayDrawer(const std::string &newOutputFilePath, size_t newWidth, size_t newHeight)
         : ImageDrawer(newOutputFilePath, newWidth, newHeight)
-        , cameraPosition(0.0, 0.0, 0.0) {
-        rays=new Ray*[height];
-        for (int i=0; i<height; ++i) {
-            rays[i]=new Ray[width];
-        }
+        , camera(newWidth, newHeight)
+        , usePackets(true)
+        , useWavefront(false)
+        , scene(nullptr) {}
+    /// Access the camera the rays are generated from.
+    const Camera &getCamera() const {
+        return camera;
     }
-    ~RayDrawer() {
-        for (int i=0; i<height; ++i) {
-            delete [] rays[i];
-        }
-        delete [] rays;
+    /// Change the camera position and orientation. The resolution is kept at the one of the image.
+    void changeCamera(const Camera &newCamera) {
+        camera=newCamera;
+        camera.changeResolution(width, height);
+    }
+    /// Switch between the packet path (the default) and the scalar per-pixel path. Both give the same image.
+    void changeUsePackets(bool newUsePackets) {
+        usePackets=newUsePackets;
+    }
+    /// Switch between the wavefront mode and the per-pixel path (the default). Both give the same image, but the
+    /// wavefront keeps every stage on its own for a whole queue of rays, which uses the caches better on large scenes.
+    void changeWavefront(bool newUseWavefront, const WavefrontSettings &settings=WavefrontSettings()) {
+        useWavefront=newUseWavefront;
+        wavefront.changeSettings(settings);
     }
-    /// Centralize and normalize the rays per pixel for screen space.
-    void prepareRays();
-    /// Draw a color in each pixel depending on the corresponding normalized ray to the pixel.
+    /// Trace the rays against a scene instead of coloring them by their directions. The hit triangles
+    /// are shaded by their normals and how much they face the camera. The BVH must outlive the drawer.
+    void changeScene(const BVH &newScene, const Color &newBackgroundColor);
+    /// Go back to coloring the pixels by the ray directions.
+    void clearScene() {
+        scene=nullptr;
+        sceneNormals.clear();
+    }
+    /// Draw a color in each pixel depending on the corresponding normalized ray to the pixel,
+    /// or on what the ray hits if a scene is set.
     void fillPixelsFromRays();
+    /// Draw the pixels of a region of the image only, like fillPixelsFromRays() does for the whole image.
+    void fillRegionFromRays(const Tile &region);
+    /// Draw the image on the worker processes of a coordinator, tile by tile. The workers need the same scene
+    /// as the drawer, and the image is the same as the one of fillPixelsFromRays(). Returns false if it couldn't be finished.
+    bool fillPixelsDistributed(RenderCoordinator &coordinator) {
+        return coordinator.renderFrame(camera, pixels);
+    }
+    /// Trace a ray through every pixel, like fillPixelsFromRays(), but add the shade to the accumulation buffer
+    /// as a float sample instead of writing the pixel. resolveAccumulation() turns the samples into pixels.
+    void accumulatePixelsFromRays();
+    /// Draw the image anti-aliased, with more samples only where the pixels are noisy, e.g. along edges.
+    /// The first pass always gives every pixel its initial samples, the budgets only limit the passes after it.
+    /// The samples are accumulated and resolved into the pixels, ready for draw().
+    SamplingStatistics fillPixelsFromRaysAdaptive(const SamplingSettings &settings);
+    /// Draw the image coarse to fine and publish every pass, so a viewer sees something right away.
+    /// Each pass traces one pixel per block of the pixels it hasn't traced yet and fills the block with it,
+    /// so every ray is traced once and the last pass leaves the same image as fillPixelsFromRays().
+    /// To publish without copying, exchange the frame buffer for the one of the publisher first.
+    PreviewStatistics fillPixelsProgressive(const PreviewSettings &settings, FramePublisher *publisher=nullptr);
 };
 
 #endif
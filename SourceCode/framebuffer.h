@@ -0,0 +1,195 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include <numeric>
+#include <utility>
+
+/// The alignment of every framebuffer allocation and of the start of every row.
+const size_t frameBufferAlignment=64;
+
+/// A non-owning view over a rectangular region of a framebuffer.
+template <typename PixelType>
+class TileView {
+private:
+    /// The first pixel of the region.
+    PixelType *data;
+    /// The region resolution.
+    size_t width, height;
+    /// The distance between two consecutive rows, in pixels.
+    size_t stride;
+public:
+    /// Constructors.
+    TileView() : data(nullptr), width(0), height(0), stride(0) {}
+    TileView(PixelType *newData, size_t newWidth, size_t newHeight, size_t newStride)
+        : data(newData)
+        , width(newWidth)
+        , height(newHeight)
+        , stride(newStride) {}
+    /// Getters.
+    size_t getWidth() const {
+        return width;
+    }
+    size_t getHeight() const {
+        return height;
+    }
+    size_t getStride() const {
+        return stride;
+    }
+    /// Access a row of the region.
+    PixelType *row(size_t y) const {
+        return data+y*stride;
+    }
+    /// Access a single pixel of the region.
+    PixelType &at(size_t x, size_t y) const {
+        return data[y*stride+x];
+    }
+};
+
+/// A single contiguous, aligned block of pixels with a fixed resolution.
+/// Rows are padded so that every one of them starts on an aligned address.
+/// The buffer owns its memory, unless it was made over external memory, and can only be moved, not copied.
+template <typename PixelType>
+class FrameBuffer {
+private:
+    /// The pixels, row after row.
+    PixelType *data;
+    /// The image resolution.
+    size_t width, height;
+    /// The distance between two consecutive rows, in pixels.
+    size_t stride;
+    /// Whether the memory was allocated by the buffer and is freed with it.
+    bool ownsData;
+
+    void release() {
+        if (data==nullptr) {
+            return;
+        }
+        for (size_t i=0; i<stride*height; ++i) {
+            data[i].~PixelType();
+        }
+        if (ownsData) {
+            free(data);
+        }
+        data=nullptr;
+    }
+public:
+    /// Find the row length in pixels, padded so that every row starts on an aligned address.
+    static size_t computeStride(size_t width) {
+        const size_t pixelsPerAlignment=frameBufferAlignment/std::gcd(frameBufferAlignment, sizeof(PixelType));
+        return (width+pixelsPerAlignment-1)/pixelsPerAlignment*pixelsPerAlignment;
+    }
+
+    /// Constructors.
+    FrameBuffer() : data(nullptr), width(0), height(0), stride(0), ownsData(true) {}
+    /// A buffer over memory owned elsewhere, e.g. a shared memory mapping, so the pixels are drawn right where they
+    /// are read from. The memory must be aligned, hold computeStride(newWidth)*newHeight pixels and outlive the buffer.
+    FrameBuffer(PixelType *externalData, size_t newWidth, size_t newHeight)
+        : data(externalData)
+        , width(newWidth)
+        , height(newHeight)
+        , stride(computeStride(newWidth))
+        , ownsData(false) {
+        for (size_t i=0; data!=nullptr && i<stride*height; ++i) {
+            new (data+i) PixelType();
+        }
+    }
+    FrameBuffer(size_t newWidth, size_t newHeight)
+        : data(nullptr)
+        , width(newWidth)
+        , height(newHeight)
+        , stride(computeStride(newWidth))
+        , ownsData(true) {
+        const size_t count=stride*height;
+        if (count==0) {
+            return;
+        }
+        // aligned_alloc requires the size to be a multiple of the alignment.
+        size_t bytes=count*sizeof(PixelType);
+        bytes=(bytes+frameBufferAlignment-1)/frameBufferAlignment*frameBufferAlignment;
+        data=static_cast<PixelType *>(aligned_alloc(frameBufferAlignment, bytes));
+        if (data==nullptr) {
+            throw std::bad_alloc();
+        }
+        for (size_t i=0; i<count; ++i) {
+            new (data+i) PixelType();
+        }
+    }
+    FrameBuffer(const FrameBuffer &)=delete;
+    FrameBuffer(FrameBuffer &&otherBuffer)
+        : data(otherBuffer.data)
+        , width(otherBuffer.width)
+        , height(otherBuffer.height)
+        , stride(otherBuffer.stride)
+        , ownsData(otherBuffer.ownsData) {
+        otherBuffer.data=nullptr;
+        otherBuffer.width=otherBuffer.height=otherBuffer.stride=0;
+    }
+    ~FrameBuffer() {
+        release();
+    }
+
+    /// Operators.
+    FrameBuffer &operator=(const FrameBuffer &)=delete;
+    FrameBuffer &operator=(FrameBuffer &&otherBuffer) {
+        if (this!=&otherBuffer) {
+            release();
+            data=otherBuffer.data;
+            width=otherBuffer.width;
+            height=otherBuffer.height;
+            stride=otherBuffer.stride;
+            ownsData=otherBuffer.ownsData;
+            otherBuffer.data=nullptr;
+            otherBuffer.width=otherBuffer.height=otherBuffer.stride=0;
+        }
+        return *this;
+    }
+
+    /// Getters.
+    size_t getWidth() const {
+        return width;
+    }
+    size_t getHeight() const {
+        return height;
+    }
+    size_t getStride() const {
+        return stride;
+    }
+    PixelType *getData() {
+        return data;
+    }
+    const PixelType *getData() const {
+        return data;
+    }
+    /// Access a row of the image.
+    PixelType *row(size_t y) {
+        return data+y*stride;
+    }
+    const PixelType *row(size_t y) const {
+        return data+y*stride;
+    }
+    /// Access a single pixel of the image.
+    PixelType &at(size_t x, size_t y) {
+        return data[y*stride+x];
+    }
+    const PixelType &at(size_t x, size_t y) const {
+        return data[y*stride+x];
+    }
+    /// Get a view of a rectangular region. The region is clipped to the image.
+    TileView<PixelType> tile(size_t fromX, size_t fromY, size_t tileWidth, size_t tileHeight) {
+        if (fromX>=width || fromY>=height) {
+            return TileView<PixelType>();
+        }
+        const size_t clippedWidth=std::min(tileWidth, width-fromX);
+        const size_t clippedHeight=std::min(tileHeight, height-fromY);
+        return TileView<PixelType>(data+fromY*stride+fromX, clippedWidth, clippedHeight, stride);
+    }
+    /// Get a view of the whole image.
+    TileView<PixelType> view() {
+        return TileView<PixelType>(data, width, height, stride);
+    }
+};
+
+#endif
@@ -1,42 +1,32 @@
 #include "geometry.h"
 
 // Vector.
-void Vector::normalize() {
-    float vectorLength=length();
-    x=x/vectorLength;
-    y=y/vectorLength;
-    z=z/vectorLength;
-}
-
-Vector Vector::crossProduct(const Vector &otherVector) const {
-    return Vector(
-        y*otherVector.z-z*otherVector.y,
-        z*otherVector.x-x*otherVector.z,
-        x*otherVector.y-y*otherVector.x
-    );
-}
-
-float Vector::findParallelogramArea(const Vector &otherVector) const {
-    return crossProduct(otherVector).length();
-}
+// The expressions are evaluated at compile time when their operands are constants.
+static_assert((Vector(1, 2, 3)+Vector(4, 5, 6)*2.0f).getZ()==15.0f, "Vector expressions must be constexpr.");
+static_assert(Vector(1, 0, 0).crossProduct(Vector(0, 1, 0)).getZ()==1.0f, "Vector products must be constexpr.");
 
 std::ofstream &operator<<(std::ofstream &outputStream, const Vector &vector) {
-    outputStream<<"Vector("<<vector.x<<", "<<vector.y<<", "<<vector.z<<")";
+    outputStream<<"Vector("<<vector.getX()<<", "<<vector.getY()<<", "<<vector.getZ()<<")";
+    return outputStream;
 }
 
 // Triangle.
-Vector Triangle::getNormalVector() const {
+Vector findTriangleNormal(const Vector &v0, const Vector &v1, const Vector &v2) {
     // Get the vector between the first and second vertex.
     const Vector &e0=v1-v0;
     // Get the vector between the first and the third vertex.
     const Vector &e1=v2-v0;
     // Their cross product normalized is the normal vector of the triangle.
     Vector normalVector=e0.crossProduct(e1);
+    // A degenerate triangle has no normal, and normalizing its zero cross product would give NaNs.
+    if (!(normalVector.length()>0.0f)) {
+        return Vector();
+    }
     normalVector.normalize();
     return normalVector;
 }
 
-float Triangle::getArea() const {
+float findTriangleArea(const Vector &v0, const Vector &v1, const Vector &v2) {
     // Get the vector between the first and second vertex.
     const Vector &e0=v1-v0;
     // Get the vector between the first and the third vertex.
@@ -46,6 +36,14 @@ float Triangle::getArea() const {
     return e0.findParallelogramArea(e1)*0.5;
 }
 
+Vector Triangle::getNormalVector() const {
+    return findTriangleNormal(v0, v1, v2);
+}
+
+float Triangle::getArea() const {
+    return findTriangleArea(v0, v1, v2);
+}
+
 std::ofstream &operator<<(std::ofstream &outputStream, const Triangle &triangle) {
     outputStream<<"Triangle(\n\t";
     outputStream<<triangle.getV0();
@@ -54,4 +52,5 @@ std::ofstream &operator<<(std::ofstream &outputStream, const Triangle &triangle)
     outputStream<<",\n\t";
     outputStream<<triangle.getV2();
     outputStream<<"\n)";
+    return outputStream;
 }
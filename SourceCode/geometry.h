@@ -2,74 +2,240 @@
 #define GEOMETRY_H
 
 #include <math.h>
+#include <cmath>
 #include <fstream>
 
-/// A class that describes a vector and operations with it.
-class Vector {
+template <typename T>
+class Vector3;
+template <typename Operand>
+class VectorAbsoluteExpression;
+
+/// The base of vectors and of vector expressions.
+/// The operators don't compute anything - a+b*2.0f is an expression object that only refers to a and b.
+/// It is evaluated coordinate by coordinate once it is stored into a Vector3, so a whole chain of operations
+/// compiles to the same arithmetic as writing out each coordinate by hand, without temporary vectors.
+/// The coordinates are computed with the same operations in the same order as evaluating step by step.
+/// Expressions refer to the vectors they are made of, so they must be stored into a Vector3 (not kept with auto)
+/// before those vectors go away.
+template <typename Derived, typename T>
+class VectorExpression {
+public:
+    typedef T ValueType;
+
+    constexpr const Derived &derived() const {
+        return static_cast<const Derived &>(*this);
+    }
+    /// Getters.
+    constexpr T getX() const {
+        return derived().getX();
+    }
+    constexpr T getY() const {
+        return derived().getY();
+    }
+    constexpr T getZ() const {
+        return derived().getZ();
+    }
+    /// Operations that give a number, or a vector whose coordinates depend on more than one coordinate each.
+    template <typename Other>
+    constexpr T dotProduct(const VectorExpression<Other, T> &otherVector) const {
+        return getX()*otherVector.getX()+getY()*otherVector.getY()+getZ()*otherVector.getZ();
+    }
+    T length() const {
+        return std::sqrt(dotProduct(*this));
+    }
+    template <typename Other>
+    constexpr Vector3<T> crossProduct(const VectorExpression<Other, T> &otherVector) const {
+        const Vector3<T> a(*this), b(otherVector);
+        return Vector3<T>(
+            a.getY()*b.getZ()-a.getZ()*b.getY(),
+            a.getZ()*b.getX()-a.getX()*b.getZ(),
+            a.getX()*b.getY()-a.getY()*b.getX()
+        );
+    }
+    constexpr VectorAbsoluteExpression<Derived> absolute() const {
+        return VectorAbsoluteExpression<Derived>(derived());
+    }
+    template <typename Other>
+    T findParallelogramArea(const VectorExpression<Other, T> &otherVector) const {
+        return crossProduct(otherVector).length();
+    }
+};
+
+/// A vector and the operations on it, for any number type - Vector is the float one the renderer uses.
+/// Everything except the operations that need a square root is constexpr, so constant vectors can be computed
+/// at compile time.
+template <typename T>
+class Vector3 : public VectorExpression<Vector3<T>, T> {
 private:
     /// The coordinates of the vector.
-    float x, y, z;
+    T x, y, z;
 public:
     /// Constructors.
-    Vector() : x(0.0), y(0.0), z(0.0) {}
-    Vector(float xCoordinate, float yCoordinate, float zCoordinate)
+    constexpr Vector3() : x(0), y(0), z(0) {}
+    constexpr Vector3(T xCoordinate, T yCoordinate, T zCoordinate)
         : x(xCoordinate)
         , y(yCoordinate)
         , z(zCoordinate) {}
-    Vector(const Vector &otherVector)
-        : x(otherVector.x)
-        , y(otherVector.y)
-        , z(otherVector.z) {}
-    /// Operations.
-    Vector operator+(const Vector& otherVector) const {
-        return Vector(x+otherVector.x, y+otherVector.y, z+otherVector.z);
+    /// Evaluate an expression.
+    template <typename Expression>
+    constexpr Vector3(const VectorExpression<Expression, T> &expression)
+        : x(expression.getX())
+        , y(expression.getY())
+        , z(expression.getZ()) {}
+    template <typename Expression>
+    constexpr Vector3 &operator=(const VectorExpression<Expression, T> &expression) {
+        // Every coordinate only depends on the same coordinate of the operands, so the vector itself can be one of them.
+        x=expression.getX();
+        y=expression.getY();
+        z=expression.getZ();
+        return *this;
     }
-    Vector operator-(const Vector& otherVector) const {
-        return Vector(x-otherVector.x, y-otherVector.y, z-otherVector.z);
+    void normalize() {
+        const T vectorLength=this->length();
+        x=x/vectorLength;
+        y=y/vectorLength;
+        z=z/vectorLength;
     }
-    Vector operator*(float multiplier) const {
-        return Vector(x*multiplier, y*multiplier, z*multiplier);
-    }
-    float length() const {
-        return std::sqrt(x*x+y*y+z*z);
-    }
-    void normalize();
-    float dotProduct(const Vector &otherVector) {
-        return x*otherVector.x+y*otherVector.y+z*otherVector.z;
-    }
-    Vector crossProduct(const Vector &otherVector) const;
-    Vector absolute() const {
-        return Vector(fabs(x), fabs(y), fabs(z));
-    }
-    float findParallelogramArea(const Vector &otherVector) const;
     /// Getters.
-    float getX() const {
+    constexpr T getX() const {
         return x;
     }
-    float getY() const {
+    constexpr T getY() const {
         return y;
     }
-    float getZ() const {
+    constexpr T getZ() const {
         return z;
     }
-    /// Output operator.
-    friend std::ofstream &operator<<(std::ofstream &outputStream, const Vector &vector);
 };
 
+typedef Vector3<float> Vector;
+
+/// How an expression holds its operands - vectors by reference, nested expressions by value.
+template <typename Operand>
+struct VectorOperand {
+    typedef const Operand Type;
+};
+template <typename T>
+struct VectorOperand<Vector3<T>> {
+    typedef const Vector3<T> &Type;
+};
+
+/// The operations of the expressions, applied to a single coordinate.
+struct VectorAddition {
+    template <typename T>
+    static constexpr T apply(T a, T b) {
+        return a+b;
+    }
+};
+struct VectorSubtraction {
+    template <typename T>
+    static constexpr T apply(T a, T b) {
+        return a-b;
+    }
+};
+struct VectorMultiplication {
+    template <typename T>
+    static constexpr T apply(T a, T b) {
+        return a*b;
+    }
+};
+
+/// The coordinate-wise operation of two vector expressions.
+template <typename Left, typename Right, typename Operation>
+class VectorBinaryExpression : public VectorExpression<VectorBinaryExpression<Left, Right, Operation>, typename Left::ValueType> {
+private:
+    typedef typename Left::ValueType T;
+    typename VectorOperand<Left>::Type left;
+    typename VectorOperand<Right>::Type right;
+public:
+    constexpr VectorBinaryExpression(const Left &newLeft, const Right &newRight) : left(newLeft), right(newRight) {}
+    constexpr T getX() const {
+        return Operation::apply(left.getX(), right.getX());
+    }
+    constexpr T getY() const {
+        return Operation::apply(left.getY(), right.getY());
+    }
+    constexpr T getZ() const {
+        return Operation::apply(left.getZ(), right.getZ());
+    }
+};
+
+/// A vector expression multiplied by a number.
+template <typename Operand>
+class VectorScaleExpression : public VectorExpression<VectorScaleExpression<Operand>, typename Operand::ValueType> {
+private:
+    typedef typename Operand::ValueType T;
+    typename VectorOperand<Operand>::Type operand;
+    T multiplier;
+public:
+    constexpr VectorScaleExpression(const Operand &newOperand, T newMultiplier) : operand(newOperand), multiplier(newMultiplier) {}
+    constexpr T getX() const {
+        return operand.getX()*multiplier;
+    }
+    constexpr T getY() const {
+        return operand.getY()*multiplier;
+    }
+    constexpr T getZ() const {
+        return operand.getZ()*multiplier;
+    }
+};
+
+/// The absolute values of the coordinates of a vector expression.
+template <typename Operand>
+class VectorAbsoluteExpression : public VectorExpression<VectorAbsoluteExpression<Operand>, typename Operand::ValueType> {
+private:
+    typedef typename Operand::ValueType T;
+    typename VectorOperand<Operand>::Type operand;
+
+    /// Like fabs - negative zero becomes zero too.
+    static constexpr T findAbsolute(T value) {
+        return value<0 ? -value : (value==0 ? T(0) : value);
+    }
+public:
+    constexpr explicit VectorAbsoluteExpression(const Operand &newOperand) : operand(newOperand) {}
+    constexpr T getX() const {
+        return findAbsolute(operand.getX());
+    }
+    constexpr T getY() const {
+        return findAbsolute(operand.getY());
+    }
+    constexpr T getZ() const {
+        return findAbsolute(operand.getZ());
+    }
+};
+
+/// Operations.
+template <typename Left, typename Right, typename T>
+constexpr VectorBinaryExpression<Left, Right, VectorAddition> operator+(const VectorExpression<Left, T> &a, const VectorExpression<Right, T> &b) {
+    return VectorBinaryExpression<Left, Right, VectorAddition>(a.derived(), b.derived());
+}
+template <typename Left, typename Right, typename T>
+constexpr VectorBinaryExpression<Left, Right, VectorSubtraction> operator-(const VectorExpression<Left, T> &a, const VectorExpression<Right, T> &b) {
+    return VectorBinaryExpression<Left, Right, VectorSubtraction>(a.derived(), b.derived());
+}
+/// The multiplier is converted to the coordinate type, e.g. a double to float.
+template <typename Operand, typename T>
+constexpr VectorScaleExpression<Operand> operator*(const VectorExpression<Operand, T> &a, typename VectorExpression<Operand, T>::ValueType multiplier) {
+    return VectorScaleExpression<Operand>(a.derived(), multiplier);
+}
+
+/// Output operator.
+std::ofstream &operator<<(std::ofstream &outputStream, const Vector &vector);
+
 /// A structure that represents a ray by its origin and direction.
 class Ray {
 private:
     Vector origin;
     Vector direction;
 public:
-    Ray() : origin(), direction() {}
-    Ray(const Vector &originParameter, const Vector directionParameter)
+    constexpr Ray() : origin(), direction() {}
+    constexpr Ray(const Vector &originParameter, const Vector &directionParameter)
     : origin(originParameter)
     , direction(directionParameter) {}
-    const Vector &getOrigin() const {
+    constexpr const Vector &getOrigin() const {
         return origin;
     }
-    const Vector &getDirection() const {
+    constexpr const Vector &getDirection() const {
         return direction;
     }
 };
@@ -80,17 +246,17 @@ private:
     Vector v0, v1, v2;
 public:
     /// Constructors.
-    Triangle(): v0(), v1(), v2() {}
-    Triangle(const Vector &vector0, const Vector &vector1, const Vector &vector2)
+    constexpr Triangle(): v0(), v1(), v2() {}
+    constexpr Triangle(const Vector &vector0, const Vector &vector1, const Vector &vector2)
         : v0(vector0), v1(vector1), v2(vector2) {}
     /// Getters.
-    const Vector &getV0() const {
+    constexpr const Vector &getV0() const {
         return v0;
     }
-    const Vector &getV1() const {
+    constexpr const Vector &getV1() const {
         return v1;
     }
-    const Vector &getV2() const {
+    constexpr const Vector &getV2() const {
         return v2;
     }
     /// Find the normal vector of the triangle.
@@ -101,4 +267,9 @@ public:
     friend std::ofstream &operator<<(std::ofstream &outputStream, const Triangle &trianle);
 };
 
+/// Find the normal vector of the triangle with the given vertices.
+Vector findTriangleNormal(const Vector &v0, const Vector &v1, const Vector &v2);
+/// Calculate the area of the triangle with the given vertices.
+float findTriangleArea(const Vector &v0, const Vector &v1, const Vector &v2);
+
 #endif
@@ -0,0 +1,465 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+
+#include "arena.h"
+#include "deflate.h"
+#include "imagewriter.h"
+#include "pixelkernels.h"
+#include "profiler.h"
+#include "utils.h"
+
+namespace {
+
+/// Append a number as text.
+void appendNumber(std::vector<char> &output, size_t number) {
+    char digits[24];
+    const std::to_chars_result result=std::to_chars(digits, digits+sizeof(digits), number);
+    output.insert(output.end(), digits, result.ptr);
+}
+
+void appendNumber(std::vector<char> &output, int number) {
+    char digits[16];
+    const std::to_chars_result result=std::to_chars(digits, digits+sizeof(digits), number);
+    output.insert(output.end(), digits, result.ptr);
+}
+
+/// Append the common .ppm header - magic number, resolution and max intensity.
+void appendPPMHeader(std::vector<char> &output, const char *magicNumber, size_t width, size_t height, int maxValue) {
+    output.insert(output.end(), magicNumber, magicNumber+2);
+    output.push_back('\n');
+    appendNumber(output, width);
+    output.push_back(' ');
+    appendNumber(output, height);
+    output.push_back('\n');
+    appendNumber(output, maxValue);
+    output.push_back('\n');
+}
+
+/// Append a number as 4 big-endian bytes, like the QOI and PNG formats store them.
+void appendBigEndian(std::vector<char> &output, uint32_t number) {
+    const char bytes[4]={char(number>>24), char(number>>16), char(number>>8), char(number)};
+    output.insert(output.end(), bytes, bytes+4);
+}
+
+/// Quantize a row to 8-bit RGB. Channels are clamped to [0, maxValue] and rescaled to [0, 255] if needed.
+void quantizeRow(const Color *row, size_t width, int maxValue, uint8_t *bytes) {
+    quantizePixels(row, width, maxValue, bytes);
+    if (maxValue!=255 && maxValue>0) {
+        for (size_t i=0; i<width*3; ++i) {
+            bytes[i]=uint8_t((bytes[i]*255+maxValue/2)/maxValue);
+        }
+    }
+}
+
+/// Append a PNG chunk - its length, type, data and the CRC of the type and data.
+void appendPNGChunk(std::vector<char> &output, const char *type, const char *data, size_t size) {
+    appendBigEndian(output, uint32_t(size));
+    const size_t typeOffset=output.size();
+    output.insert(output.end(), type, type+4);
+    output.insert(output.end(), data, data+size);
+    appendBigEndian(output, computeCrc32(reinterpret_cast<const uint8_t *>(output.data()+typeOffset), size+4));
+}
+
+/// The Paeth predictor of PNG - whichever of the left, up and upper left bytes is closest to left+up-upperLeft.
+uint8_t predictPaeth(int left, int up, int upperLeft) {
+    const int estimate=left+up-upperLeft;
+    const int leftDistance=abs(estimate-left), upDistance=abs(estimate-up), upperLeftDistance=abs(estimate-upperLeft);
+    if (leftDistance<=upDistance && leftDistance<=upperLeftDistance) {
+        return uint8_t(left);
+    }
+    return uint8_t(upDistance<=upperLeftDistance ? up : upperLeft);
+}
+
+/// Filter a row of bytes for PNG with whichever of the five filters makes it the most compressible, by the usual
+/// heuristic of the smallest sum of the filtered bytes taken as signed. The output starts with the filter type.
+void filterPNGRow(const uint8_t *row, const uint8_t *previousRow, size_t size, uint8_t *output) {
+    const size_t pixelSize=3;
+    // The costs of all filters are summed in one pass, then only the best one is written.
+    uint64_t costs[5]={};
+    const auto findCost=[](int filtered) {
+        const uint8_t byte=uint8_t(filtered);
+        return byte<128 ? byte : 256-byte;
+    };
+    for (size_t i=0; i<size; ++i) {
+        const int left=i>=pixelSize ? row[i-pixelSize] : 0;
+        const int up=previousRow[i];
+        const int upperLeft=i>=pixelSize ? previousRow[i-pixelSize] : 0;
+        costs[0]+=findCost(row[i]);
+        costs[1]+=findCost(row[i]-left);
+        costs[2]+=findCost(row[i]-up);
+        costs[3]+=findCost(row[i]-(left+up)/2);
+        costs[4]+=findCost(row[i]-predictPaeth(left, up, upperLeft));
+    }
+    const uint8_t filter=uint8_t(std::min_element(costs, costs+5)-costs);
+    output[0]=filter;
+    for (size_t i=0; i<size; ++i) {
+        const int left=i>=pixelSize ? row[i-pixelSize] : 0;
+        const int up=previousRow[i];
+        const int upperLeft=i>=pixelSize ? previousRow[i-pixelSize] : 0;
+        int prediction=0;
+        switch (filter) {
+        case 1:
+            prediction=left;
+            break;
+        case 2:
+            prediction=up;
+            break;
+        case 3:
+            prediction=(left+up)/2;
+            break;
+        case 4:
+            prediction=predictPaeth(left, up, upperLeft);
+            break;
+        default:
+            break;
+        }
+        output[i+1]=uint8_t(row[i]-prediction);
+    }
+}
+
+}
+
+// ImageWriter.
+ImageWriter::~ImageWriter() {
+    if (file!=nullptr) {
+        fclose(file);
+    }
+}
+
+bool ImageWriter::writeBytes(const std::vector<char> &bytes) {
+    PROFILE_SCOPE(ProfileStage::Write);
+    PROFILE_COUNT(ProfileCounter::BytesOutput, bytes.size());
+    statistics.encodedBytes+=bytes.size();
+    if (fwrite(bytes.data(), 1, bytes.size(), file)!=bytes.size()) {
+        printf("Couldn't write to %s.\n", outputFilePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ImageWriter::begin(size_t newWidth, size_t newHeight, int newMaxValue) {
+    if (file!=nullptr) {
+        printf("The image is already being written.\n");
+        return false;
+    }
+    file=fopen(outputFilePath.c_str(), "wb");
+    if (file==nullptr) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    // The blocks are already big, so skip the stdio buffer and write them directly.
+    setvbuf(file, nullptr, _IONBF, 0);
+    width=newWidth;
+    height=newHeight;
+    maxValue=newMaxValue;
+    rowsWritten=0;
+    statistics=ImageWriterStatistics();
+    encodedBlock.clear();
+    encodeHeader(encodedBlock);
+    return writeBytes(encodedBlock);
+}
+
+bool ImageWriter::writeRows(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount) {
+    if (file==nullptr) {
+        printf("The image writer is not started.\n");
+        return false;
+    }
+    if (fromRow!=rowsWritten || fromRow+rowCount>height || pixels.getWidth()!=width) {
+        printf("The rows must be written in order and match the image resolution.\n");
+        return false;
+    }
+    {
+        PROFILE_SCOPE(ProfileStage::Encode);
+        const std::chrono::steady_clock::time_point encodeStart=std::chrono::steady_clock::now();
+        encodedBlock.clear();
+        encodeBlock(pixels, fromRow, rowCount, encodedBlock);
+        statistics.encodeNanoseconds+=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-encodeStart).count();
+        statistics.rawBytes+=rowCount*width*3;
+    }
+    if (!writeBytes(encodedBlock)) {
+        return false;
+    }
+    rowsWritten+=rowCount;
+    return true;
+}
+
+bool ImageWriter::finish() {
+    if (file==nullptr) {
+        printf("The image writer is not started.\n");
+        return false;
+    }
+    bool isValid=true;
+    if (rowsWritten!=height) {
+        printf("Only %zu of %zu rows were written to %s.\n", rowsWritten, height, outputFilePath.c_str());
+        isValid=false;
+    }
+    encodedBlock.clear();
+    encodeFooter(encodedBlock);
+    if (!encodedBlock.empty() && !writeBytes(encodedBlock)) {
+        isValid=false;
+    }
+    if (fclose(file)!=0) {
+        printf("Couldn't close %s.\n", outputFilePath.c_str());
+        isValid=false;
+    }
+    file=nullptr;
+    return isValid;
+}
+
+void ImageWriter::encodeBlock(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount, std::vector<char> &output) {
+    for (size_t i=fromRow; i<fromRow+rowCount; ++i) {
+        encodeRow(pixels.row(i), output);
+    }
+}
+
+void ImageWriter::encodeParts(size_t fromRow, size_t rowCount, size_t rowsPerPart, std::vector<char> &output,
+                              const std::function<void(size_t, size_t, size_t, std::vector<char> &)> &encodePart) {
+    const size_t partCount=(rowCount+rowsPerPart-1)/rowsPerPart;
+    if (encodedParts.size()<partCount) {
+        encodedParts.resize(partCount);
+    }
+    const auto encodeIndex=[&](size_t index) {
+        std::vector<char> &partOutput=encodedParts[index];
+        partOutput.clear();
+        const size_t partFromRow=fromRow+index*rowsPerPart;
+        encodePart(index, partFromRow, std::min(rowsPerPart, fromRow+rowCount-partFromRow), partOutput);
+    };
+    if (scheduler!=nullptr) {
+        scheduler->runItems(partCount, encodeIndex);
+    } else {
+        for (size_t i=0; i<partCount; ++i) {
+            encodeIndex(i);
+        }
+    }
+    for (size_t i=0; i<partCount; ++i) {
+        output.insert(output.end(), encodedParts[i].begin(), encodedParts[i].end());
+    }
+}
+
+bool ImageWriter::writeImage(const FrameBuffer<Color> &pixels, int newMaxValue) {
+    if (!begin(pixels.getWidth(), pixels.getHeight(), newMaxValue)) {
+        return false;
+    }
+    const size_t blockRows=rowsPerBlock*(scheduler!=nullptr ? scheduler->getThreadCount() : 1);
+    for (size_t i=0; i<height; i+=blockRows) {
+        if (!writeRows(pixels, i, std::min(blockRows, height-i))) {
+            return false;
+        }
+    }
+    return finish();
+}
+
+// BinaryPPMWriter.
+void BinaryPPMWriter::encodeHeader(std::vector<char> &output) const {
+    appendPPMHeader(output, "P6", width, height, maxValue);
+}
+
+void BinaryPPMWriter::encodeRow(const Color *row, std::vector<char> &output) const {
+    const size_t offset=output.size();
+    output.resize(offset+width*3);
+    quantizePixels(row, width, maxValue, reinterpret_cast<uint8_t *>(output.data()+offset));
+}
+
+// TextPPMWriter.
+void TextPPMWriter::encodeHeader(std::vector<char> &output) const {
+    appendPPMHeader(output, "P3", width, height, maxValue);
+}
+
+void TextPPMWriter::encodeRow(const Color *row, std::vector<char> &output) const {
+    // Clamped to the maxval of the header, the same as the binary writer.
+    for (size_t j=0; j<width; ++j) {
+        appendNumber(output, clamp(row[j].R, 0, maxValue));
+        output.push_back(' ');
+        appendNumber(output, clamp(row[j].G, 0, maxValue));
+        output.push_back(' ');
+        appendNumber(output, clamp(row[j].B, 0, maxValue));
+        output.push_back('\t');
+    }
+    output.push_back('\n');
+}
+
+// QOIWriter.
+namespace {
+
+/// A pixel as the QOI format sees it.
+struct QOIPixel {
+    uint8_t R, G, B, A;
+
+    bool operator==(const QOIPixel &otherPixel) const {
+        return R==otherPixel.R && G==otherPixel.G && B==otherPixel.B && A==otherPixel.A;
+    }
+};
+
+/// The operations of the QOI format.
+const uint8_t qoiIndex=0x00, qoiDifference=0x40, qoiLuma=0x80, qoiRun=0xc0, qoiRGB=0xfe;
+
+int findQOIHash(const QOIPixel &pixel) {
+    return (pixel.R*3+pixel.G*5+pixel.B*7+pixel.A*11)%64;
+}
+
+/// Encode rows of 8-bit RGB pixels as QOI operations, continuing from a given previous pixel with an empty index.
+void encodeQOIRows(const uint8_t *bytes, size_t pixelCount, QOIPixel previous, std::vector<char> &output) {
+    QOIPixel index[64]={};
+    int run=0;
+    for (size_t i=0; i<pixelCount; ++i) {
+        const QOIPixel pixel={bytes[3*i], bytes[3*i+1], bytes[3*i+2], 255};
+        if (pixel==previous) {
+            ++run;
+            if (run==62) {
+                output.push_back(char(qoiRun|(run-1)));
+                run=0;
+            }
+            continue;
+        }
+        if (run>0) {
+            output.push_back(char(qoiRun|(run-1)));
+            run=0;
+        }
+        const int hash=findQOIHash(pixel);
+        if (index[hash]==pixel) {
+            output.push_back(char(qoiIndex|hash));
+        } else {
+            index[hash]=pixel;
+            // The differences wrap around, like the decoder adds them.
+            const int8_t differenceR=int8_t(pixel.R-previous.R);
+            const int8_t differenceG=int8_t(pixel.G-previous.G);
+            const int8_t differenceB=int8_t(pixel.B-previous.B);
+            const int differenceRG=differenceR-differenceG;
+            const int differenceBG=differenceB-differenceG;
+            if (differenceR>=-2 && differenceR<=1 && differenceG>=-2 && differenceG<=1 && differenceB>=-2 && differenceB<=1) {
+                output.push_back(char(qoiDifference|((differenceR+2)<<4)|((differenceG+2)<<2)|(differenceB+2)));
+            } else if (differenceG>=-32 && differenceG<=31 && differenceRG>=-8 && differenceRG<=7 && differenceBG>=-8 && differenceBG<=7) {
+                output.push_back(char(qoiLuma|(differenceG+32)));
+                output.push_back(char(((differenceRG+8)<<4)|(differenceBG+8)));
+            } else {
+                const char literal[4]={char(qoiRGB), char(pixel.R), char(pixel.G), char(pixel.B)};
+                output.insert(output.end(), literal, literal+4);
+            }
+        }
+        previous=pixel;
+    }
+    if (run>0) {
+        output.push_back(char(qoiRun|(run-1)));
+    }
+}
+
+}
+
+void QOIWriter::encodeHeader(std::vector<char> &output) const {
+    output.insert(output.end(), {'q', 'o', 'i', 'f'});
+    appendBigEndian(output, uint32_t(width));
+    appendBigEndian(output, uint32_t(height));
+    // 3 channels, sRGB.
+    output.push_back(3);
+    output.push_back(0);
+}
+
+void QOIWriter::encodeBlock(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount, std::vector<char> &output) {
+    encodeParts(fromRow, rowCount, rowsPerPart, output, [&](size_t, size_t partFromRow, size_t partRowCount, std::vector<char> &partOutput) {
+        ScratchScope scratch;
+        const size_t byteCount=partRowCount*width*3;
+        uint8_t *bytes=scratch.allocateArray<uint8_t>(byteCount);
+        for (size_t i=0; i<partRowCount; ++i) {
+            quantizeRow(pixels.row(partFromRow+i), width, maxValue, bytes+i*width*3);
+        }
+        // Every part continues from the last pixel of the row before it, which the decoder will have read by then.
+        QOIPixel previous={0, 0, 0, 255};
+        if (partFromRow>0 && width>0) {
+            uint8_t last[3];
+            quantizeRow(pixels.row(partFromRow-1)+width-1, 1, maxValue, last);
+            previous={last[0], last[1], last[2], 255};
+        }
+        partOutput.reserve(byteCount/2);
+        encodeQOIRows(bytes, partRowCount*width, previous, partOutput);
+    });
+}
+
+void QOIWriter::encodeFooter(std::vector<char> &output) const {
+    output.insert(output.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+}
+
+// PNGWriter.
+void PNGWriter::encodeHeader(std::vector<char> &output) const {
+    const char signature[8]={char(0x89), 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    output.insert(output.end(), signature, signature+8);
+    std::vector<char> header;
+    appendBigEndian(header, uint32_t(width));
+    appendBigEndian(header, uint32_t(height));
+    // 8 bits per channel, RGB, deflate, the adaptive filters, no interlacing.
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    appendPNGChunk(output, "IHDR", header.data(), header.size());
+    // The zlib header of the compressed rows - deflate with a 32K window, no preset dictionary.
+    const char zlibHeader[2]={0x78, 0x01};
+    appendPNGChunk(output, "IDAT", zlibHeader, 2);
+}
+
+void PNGWriter::encodeBlock(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount, std::vector<char> &output) {
+    if (fromRow==0) {
+        adler=1;
+    }
+    const size_t partCount=(rowCount+rowsPerPart-1)/rowsPerPart;
+    partAdlers.assign(partCount, 1);
+    partSizes.assign(partCount, 0);
+    encodeParts(fromRow, rowCount, rowsPerPart, output, [&](size_t partIndex, size_t partFromRow, size_t partRowCount, std::vector<char> &partOutput) {
+        const size_t rowSize=width*3;
+        // The filters look at the row above, so the part starts from the last row before it.
+        ScratchScope scratch;
+        uint8_t *previousRow=scratch.allocateArray<uint8_t>(rowSize);
+        uint8_t *currentRow=scratch.allocateArray<uint8_t>(rowSize);
+        if (partFromRow>0) {
+            quantizeRow(pixels.row(partFromRow-1), width, maxValue, previousRow);
+        }
+        const size_t filteredSize=partRowCount*(rowSize+1);
+        uint8_t *filtered=scratch.allocateArray<uint8_t>(filteredSize);
+        for (size_t i=0; i<partRowCount; ++i) {
+            quantizeRow(pixels.row(partFromRow+i), width, maxValue, currentRow);
+            filterPNGRow(currentRow, previousRow, rowSize, filtered+i*(rowSize+1));
+            std::swap(previousRow, currentRow);
+        }
+        partAdlers[partIndex]=computeAdler32(filtered, filteredSize);
+        partSizes[partIndex]=filteredSize;
+        std::vector<char> compressed;
+        compressed.reserve(filteredSize/2);
+        deflateBlock(filtered, filteredSize, compressed);
+        appendPNGChunk(partOutput, "IDAT", compressed.data(), compressed.size());
+    });
+    for (size_t i=0; i<partCount; ++i) {
+        adler=combineAdler32(adler, partAdlers[i], partSizes[i]);
+    }
+}
+
+void PNGWriter::encodeFooter(std::vector<char> &output) const {
+    std::vector<char> end;
+    appendDeflateEnd(end);
+    appendBigEndian(end, adler);
+    appendPNGChunk(output, "IDAT", end.data(), end.size());
+    appendPNGChunk(output, "IEND", nullptr, 0);
+}
+
+ImageFormat findImageFormat(const std::string &filePath) {
+    const size_t dot=filePath.find_last_of('.');
+    const std::string &extension=dot==std::string::npos ? std::string() : filePath.substr(dot+1);
+    if (extension=="qoi") {
+        return ImageFormat::QOI;
+    }
+    if (extension=="png") {
+        return ImageFormat::PNG;
+    }
+    return ImageFormat::PPMBinary;
+}
+
+std::unique_ptr<ImageWriter> createImageWriter(ImageFormat format, const std::string &outputFilePath) {
+    switch (format) {
+    case ImageFormat::PPMText:
+        return std::make_unique<TextPPMWriter>(outputFilePath);
+    case ImageFormat::QOI:
+        return std::make_unique<QOIWriter>(outputFilePath);
+    case ImageFormat::PNG:
+        return std::make_unique<PNGWriter>(outputFilePath);
+    case ImageFormat::PPMBinary:
+    default:
+        return std::make_unique<BinaryPPMWriter>(outputFilePath);
+    }
+}
@@ -0,0 +1,188 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "color.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+/// The image formats an ImageDrawer can output to.
+enum class ImageFormat {
+    /// Binary "P6" .ppm - the default.
+    PPMBinary,
+    /// ASCII "P3" .ppm - slow and large, meant for debugging.
+    PPMText,
+    /// .qoi - "Quite OK Image" lossless compression, fast to encode.
+    QOI,
+    /// .png with deflate compression - smaller than .qoi and readable everywhere, slower to encode.
+    PNG
+};
+
+/// Find the format of a file by its extension - .qoi, .png, or .ppm for anything else.
+ImageFormat findImageFormat(const std::string &filePath);
+
+/// How big an image became and how fast it was encoded.
+struct ImageWriterStatistics {
+    /// The size of the pixels as raw 8-bit RGB.
+    uint64_t rawBytes=0;
+    /// The size of the file.
+    uint64_t encodedBytes=0;
+    /// The time spent encoding the pixels, without writing them.
+    uint64_t encodeNanoseconds=0;
+
+    /// How many times smaller than raw RGB the file is.
+    double getCompressionRatio() const {
+        return encodedBytes>0 ? double(rawBytes)/double(encodedBytes) : 0.0;
+    }
+    /// The raw RGB megabytes encoded per second.
+    double getEncodeMegabytesPerSecond() const {
+        return encodeNanoseconds>0 ? double(rawBytes)*1e3/double(encodeNanoseconds) : 0.0;
+    }
+};
+
+/// A base class for the output stage of an image.
+/// The image is written in order, a block of rows at a time, so rows can be streamed
+/// to the file as soon as they are finished instead of waiting for the whole image.
+class ImageWriter {
+private:
+    /// The output file.
+    FILE *file;
+    /// The number of rows written so far.
+    size_t rowsWritten;
+    /// A reusable buffer holding the encoded bytes of a block of rows.
+    std::vector<char> encodedBlock;
+    /// The reusable buffers of the parts of a block encoded in parallel.
+    std::vector<std::vector<char>> encodedParts;
+    ImageWriterStatistics statistics;
+protected:
+    /// The path to the output file.
+    std::string outputFilePath;
+    /// The image resolution.
+    size_t width, height;
+    /// The max intensity value for a Color.
+    int maxValue;
+    /// The scheduler the blocks are encoded in parallel with, or nullptr to encode on the calling thread.
+    TileScheduler *scheduler;
+
+    /// Write the bytes that come before the pixel data.
+    virtual void encodeHeader(std::vector<char> &output) const=0;
+    /// Append the encoded pixels of a single row, for the formats encoded row by row by the default encodeBlock(..).
+    virtual void encodeRow(const Color *, std::vector<char> &) const {}
+    /// Append the encoded pixels of a block of rows. By default row by row, with encodeRow(..).
+    virtual void encodeBlock(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount, std::vector<char> &output);
+    /// Write the bytes that come after the pixel data.
+    virtual void encodeFooter(std::vector<char> &) const {}
+    /// Encode the rows [fromRow, fromRow+rowCount) in independent parts of rowsPerPart rows, in parallel if there
+    /// is a scheduler, and append the parts in order. The parts start at multiples of rowsPerPart from fromRow.
+    void encodeParts(size_t fromRow, size_t rowCount, size_t rowsPerPart, std::vector<char> &output,
+                     const std::function<void(size_t partIndex, size_t partFromRow, size_t partRowCount, std::vector<char> &partOutput)> &encodePart);
+    /// Write out raw bytes.
+    bool writeBytes(const std::vector<char> &bytes);
+public:
+    /// The number of rows encoded and written with a single write call by writeImage(..).
+    static constexpr size_t rowsPerBlock=64;
+
+    /// Constructors.
+    explicit ImageWriter(const std::string &newOutputFilePath)
+        : file(nullptr)
+        , rowsWritten(0)
+        , outputFilePath(newOutputFilePath)
+        , width(0)
+        , height(0)
+        , maxValue(255)
+        , scheduler(nullptr) {}
+    ImageWriter(const ImageWriter &)=delete;
+    ImageWriter &operator=(const ImageWriter &)=delete;
+    virtual ~ImageWriter();
+
+    /// Encode the blocks of the rows in parallel with a scheduler, or on the calling thread with nullptr, the default.
+    /// Only the formats that split blocks into independent parts use it. The scheduler must outlive the writer.
+    void changeScheduler(TileScheduler *newScheduler) {
+        scheduler=newScheduler;
+    }
+    /// Open the output file and write the header.
+    bool begin(size_t newWidth, size_t newHeight, int newMaxValue);
+    /// Write the next rowCount rows of the image, starting at fromRow.
+    /// The rows must come in order - fromRow must be the first row that is not written yet.
+    bool writeRows(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount);
+    /// Write the footer and close the file. Fails if not all rows were written.
+    bool finish();
+    /// Write a whole image at once, block by block. With a scheduler, each block has rowsPerBlock rows per thread.
+    bool writeImage(const FrameBuffer<Color> &pixels, int newMaxValue);
+    /// The number of rows written so far.
+    size_t getRowsWritten() const {
+        return rowsWritten;
+    }
+    /// The sizes and encode time of the image, since begin(..).
+    const ImageWriterStatistics &getStatistics() const {
+        return statistics;
+    }
+};
+
+/// Writes binary "P6" .ppm files - a header followed by the raw RGB bytes.
+class BinaryPPMWriter : public ImageWriter {
+protected:
+    void encodeHeader(std::vector<char> &output) const override;
+    void encodeRow(const Color *row, std::vector<char> &output) const override;
+public:
+    /// Constructors.
+    explicit BinaryPPMWriter(const std::string &newOutputFilePath) : ImageWriter(newOutputFilePath) {}
+};
+
+/// Writes ASCII "P3" .ppm files. Only meant for debugging, as the output is several times bigger.
+class TextPPMWriter : public ImageWriter {
+protected:
+    void encodeHeader(std::vector<char> &output) const override;
+    void encodeRow(const Color *row, std::vector<char> &output) const override;
+public:
+    /// Constructors.
+    explicit TextPPMWriter(const std::string &newOutputFilePath) : ImageWriter(newOutputFilePath) {}
+};
+
+/// Writes .qoi files (https://qoiformat.org), RGB without alpha.
+/// The parts of a block are encoded independently - each starts with an empty index of recent colors and
+/// continues from the last pixel before it, which is known from the frame buffer. Any decoder then reads the
+/// concatenated parts as a single ordinary stream.
+class QOIWriter : public ImageWriter {
+protected:
+    void encodeHeader(std::vector<char> &output) const override;
+    void encodeBlock(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount, std::vector<char> &output) override;
+    void encodeFooter(std::vector<char> &output) const override;
+public:
+    /// The rows of each independently encoded part.
+    static constexpr size_t rowsPerPart=16;
+
+    /// Constructors.
+    explicit QOIWriter(const std::string &newOutputFilePath) : ImageWriter(newOutputFilePath) {}
+};
+
+/// Writes 8-bit RGB .png files. Every row gets the PNG filter that makes it the most compressible, and the
+/// parts of a block are deflated independently, each into its own IDAT chunk, so they can be compressed in parallel.
+class PNGWriter : public ImageWriter {
+private:
+    /// The Adler-32 checksum of the filtered rows compressed so far.
+    uint32_t adler;
+    /// The checksums and sizes of the filtered rows of the parts of the current block.
+    std::vector<uint32_t> partAdlers;
+    std::vector<size_t> partSizes;
+protected:
+    void encodeHeader(std::vector<char> &output) const override;
+    void encodeBlock(const FrameBuffer<Color> &pixels, size_t fromRow, size_t rowCount, std::vector<char> &output) override;
+    void encodeFooter(std::vector<char> &output) const override;
+public:
+    /// The rows of each independently compressed part.
+    static constexpr size_t rowsPerPart=16;
+
+    /// Constructors.
+    explicit PNGWriter(const std::string &newOutputFilePath) : ImageWriter(newOutputFilePath), adler(1) {}
+};
+
+/// Create the writer for a given format.
+std::unique_ptr<ImageWriter> createImageWriter(ImageFormat format, const std::string &outputFilePath);
+
+#endif
@@ -0,0 +1,163 @@
+#include <math.h>
+
+#include "intersect.h"
+
+// HitPacket.
+Hit HitPacket::getLane(int lane) const {
+    Hit hit(distance[lane]);
+    hit.u=u[lane];
+    hit.v=v[lane];
+    hit.triangleId=uint32_t(triangleId[lane]);
+    return hit;
+}
+
+// TriangleRecord.
+TriangleRecord::TriangleRecord(const Vector &vertex0, const Vector &vertex1, const Vector &vertex2, uint32_t newId)
+    : v0(vertex0)
+    , edge1(vertex1-vertex0)
+    , edge2(vertex2-vertex0)
+    , normal(edge1.crossProduct(edge2))
+    , planeDistance(0.0f)
+    , id(newId) {
+    // Degenerate triangles keep a zero normal instead of dividing by a zero length.
+    if (normal.length()>0.0f) {
+        normal.normalize();
+    }
+    planeDistance=normal.dotProduct(v0);
+}
+
+bool TriangleRecord::intersect(const Ray &ray, Hit &hit) const {
+    const Vector &direction=ray.getDirection();
+    const Vector &pVector=direction.crossProduct(edge2);
+    const float determinant=edge1.dotProduct(pVector);
+    // The ray is parallel to the triangle's plane.
+    if (fabsf(determinant)<intersectionEpsilon) {
+        return false;
+    }
+    const float inverseDeterminant=1.0f/determinant;
+    const Vector &tVector=ray.getOrigin()-v0;
+    const float u=tVector.dotProduct(pVector)*inverseDeterminant;
+    if (u<0.0f || u>1.0f) {
+        return false;
+    }
+    const Vector &qVector=tVector.crossProduct(edge1);
+    const float v=direction.dotProduct(qVector)*inverseDeterminant;
+    if (v<0.0f || u+v>1.0f) {
+        return false;
+    }
+    const float distance=edge2.dotProduct(qVector)*inverseDeterminant;
+    if (distance<=intersectionEpsilon || distance>=hit.distance) {
+        return false;
+    }
+    hit.distance=distance;
+    hit.u=u;
+    hit.v=v;
+    hit.triangleId=id;
+    return true;
+}
+
+SIMD_DISPATCH
+void TriangleRecord::intersect(const VectorPacket &origins, const VectorPacket &directions, HitPacket &hits) const {
+    const VectorPacket edge1Packet(edge1), edge2Packet(edge2);
+    const VectorPacket &pVector=directions.crossProduct(edge2Packet);
+    const PacketFloat determinant=edge1Packet.dotProduct(pVector);
+    // Lanes with a zero determinant become inf or NaN, which every comparison below rejects.
+    const PacketFloat inverseDeterminant=1.0f/determinant;
+    const VectorPacket &tVector=origins-VectorPacket(v0);
+    const PacketFloat u=tVector.dotProduct(pVector)*inverseDeterminant;
+    const VectorPacket &qVector=tVector.crossProduct(edge1Packet);
+    const PacketFloat v=directions.dotProduct(qVector)*inverseDeterminant;
+    const PacketFloat distance=edge2Packet.dotProduct(qVector)*inverseDeterminant;
+    const PacketFloat zero=packetBroadcast(0.0f);
+    const PacketInt isHit=packetLessEqual(packetBroadcast(intersectionEpsilon), packetAbs(determinant))
+        & packetLessEqual(zero, u)
+        & packetLessEqual(zero, v)
+        & packetLessEqual(u+v, packetBroadcast(1.0f))
+        & packetLess(packetBroadcast(intersectionEpsilon), distance)
+        & packetLess(distance, hits.distance);
+    hits.distance=packetSelect(isHit, distance, hits.distance);
+    hits.u=packetSelect(isHit, u, hits.u);
+    hits.v=packetSelect(isHit, v, hits.v);
+    hits.triangleId=packetSelect(isHit, packetBroadcastInt(int32_t(id)), hits.triangleId);
+}
+
+// TrianglePacket.
+void TrianglePacket::setLane(int lane, const TriangleRecord &record) {
+    v0.setLane(lane, record.getV0());
+    edge1.setLane(lane, record.getEdge1());
+    edge2.setLane(lane, record.getEdge2());
+    ids[lane]=int32_t(record.getId());
+}
+
+SIMD_DISPATCH
+bool TrianglePacket::intersect(const Ray &ray, Hit &hit) const {
+    const VectorPacket direction(ray.getDirection());
+    const VectorPacket &pVector=direction.crossProduct(edge2);
+    const PacketFloat determinant=edge1.dotProduct(pVector);
+    // Padding lanes have zero edges, so their determinant is zero and they are rejected like parallel rays.
+    const PacketFloat inverseDeterminant=1.0f/determinant;
+    const VectorPacket &tVector=VectorPacket(ray.getOrigin())-v0;
+    const PacketFloat u=tVector.dotProduct(pVector)*inverseDeterminant;
+    const VectorPacket &qVector=tVector.crossProduct(edge1);
+    const PacketFloat v=direction.dotProduct(qVector)*inverseDeterminant;
+    const PacketFloat distance=edge2.dotProduct(qVector)*inverseDeterminant;
+    const PacketFloat zero=packetBroadcast(0.0f);
+    const PacketInt isHit=packetLessEqual(packetBroadcast(intersectionEpsilon), packetAbs(determinant))
+        & packetLessEqual(zero, u)
+        & packetLessEqual(zero, v)
+        & packetLessEqual(u+v, packetBroadcast(1.0f))
+        & packetLess(packetBroadcast(intersectionEpsilon), distance)
+        & packetLess(distance, packetBroadcast(hit.distance));
+    if (!packetAny(isHit)) {
+        return false;
+    }
+    // Reduce to the closest of the lanes that hit.
+    int closestLane=-1;
+    float closestDistance=hit.distance;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        if (isHit[lane] && distance[lane]<closestDistance) {
+            closestDistance=distance[lane];
+            closestLane=lane;
+        }
+    }
+    hit.distance=closestDistance;
+    hit.u=u[closestLane];
+    hit.v=v[closestLane];
+    hit.triangleId=uint32_t(ids[closestLane]);
+    return true;
+}
+
+std::vector<TriangleRecord> buildTriangleRecords(const std::vector<Triangle> &triangles) {
+    std::vector<TriangleRecord> records;
+    records.reserve(triangles.size());
+    for (size_t i=0; i<triangles.size(); ++i) {
+        records.emplace_back(triangles[i], uint32_t(i));
+    }
+    return records;
+}
+
+std::vector<TriangleRecord> buildTriangleRecords(const Mesh &mesh) {
+    std::vector<TriangleRecord> records;
+    records.reserve(mesh.getTriangleCount());
+    for (size_t i=0; i<mesh.getTriangleCount(); ++i) {
+        const TriangleView &triangle=mesh.getTriangle(i);
+        records.emplace_back(triangle.getV0(), triangle.getV1(), triangle.getV2(), uint32_t(i));
+    }
+    return records;
+}
+
+std::vector<TrianglePacket> buildTrianglePackets(const std::vector<TriangleRecord> &records) {
+    std::vector<TrianglePacket> packets((records.size()+SIMD_WIDTH-1)/SIMD_WIDTH);
+    for (size_t i=0; i<records.size(); ++i) {
+        packets[i/SIMD_WIDTH].setLane(int(i%SIMD_WIDTH), records[i]);
+    }
+    return packets;
+}
+
+bool intersectTriangles(const Ray &ray, const std::vector<TrianglePacket> &packets, Hit &hit) {
+    bool isHit=false;
+    for (const TrianglePacket &packet : packets) {
+        isHit|=packet.intersect(ray, hit);
+    }
+    return isHit;
+}
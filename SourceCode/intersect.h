@@ -0,0 +1,122 @@
+#ifndef INTERSECT_H
+#define INTERSECT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "geometry.h"
+#include "mesh.h"
+#include "simd.h"
+
+/// The id of a missing triangle - used for misses and for the padding lanes of a TrianglePacket.
+const uint32_t invalidTriangleId=0xFFFFFFFF;
+/// Determinants and distances below this are treated as no intersection.
+const float intersectionEpsilon=1e-7f;
+
+/// The closest intersection found so far along a ray.
+struct Hit {
+    /// The distance along the (normalized) ray direction.
+    float distance;
+    /// The barycentric coordinates of the hit point - the weights of v1 and v2.
+    float u, v;
+    /// The id of the triangle that was hit.
+    uint32_t triangleId;
+
+    /// Constructors.
+    /// A miss at a given maximum distance - only closer hits are accepted.
+    explicit Hit(float maxDistance=INFINITY) : distance(maxDistance), u(0.0f), v(0.0f), triangleId(invalidTriangleId) {}
+
+    /// Whether a triangle was hit.
+    bool isValid() const {
+        return triangleId!=invalidTriangleId;
+    }
+};
+
+/// The closest intersections of SIMD_WIDTH rays, one per lane.
+struct HitPacket {
+    PacketFloat distance;
+    PacketFloat u, v;
+    PacketInt triangleId;
+
+    /// Constructors.
+    explicit HitPacket(float maxDistance=INFINITY)
+        : distance(packetBroadcast(maxDistance))
+        , u(packetBroadcast(0.0f))
+        , v(packetBroadcast(0.0f))
+        , triangleId(packetBroadcastInt(int32_t(invalidTriangleId))) {}
+
+    /// Extract the hit of a single lane.
+    Hit getLane(int lane) const;
+};
+
+/// A triangle with everything the intersection test needs precomputed once -
+/// the edges from the first vertex, the normal and the distance of its plane from the origin.
+class TriangleRecord {
+private:
+    Vector v0;
+    Vector edge1, edge2;
+    Vector normal;
+    float planeDistance;
+    uint32_t id;
+public:
+    /// Constructors.
+    TriangleRecord() : planeDistance(0.0f), id(invalidTriangleId) {}
+    TriangleRecord(const Vector &vertex0, const Vector &vertex1, const Vector &vertex2, uint32_t newId);
+    TriangleRecord(const Triangle &triangle, uint32_t newId)
+        : TriangleRecord(triangle.getV0(), triangle.getV1(), triangle.getV2(), newId) {}
+
+    /// Getters.
+    const Vector &getV0() const {
+        return v0;
+    }
+    const Vector &getEdge1() const {
+        return edge1;
+    }
+    const Vector &getEdge2() const {
+        return edge2;
+    }
+    const Vector &getNormal() const {
+        return normal;
+    }
+    float getPlaneDistance() const {
+        return planeDistance;
+    }
+    uint32_t getId() const {
+        return id;
+    }
+
+    /// Intersect a single ray (Möller–Trumbore). Both sides of the triangle count.
+    /// Updates the hit and returns true only if the intersection is closer than the hit so far.
+    bool intersect(const Ray &ray, Hit &hit) const;
+    /// Intersect SIMD_WIDTH rays at once, updating the lanes whose hit gets closer.
+    void intersect(const VectorPacket &origins, const VectorPacket &directions, HitPacket &hits) const;
+};
+
+/// SIMD_WIDTH triangles stored as structure of arrays, so that a single ray is tested against all of them at once.
+class TrianglePacket {
+private:
+    VectorPacket v0;
+    VectorPacket edge1, edge2;
+    PacketInt ids;
+public:
+    /// Constructors.
+    /// An empty packet - every lane is a degenerate triangle that is never hit.
+    TrianglePacket() : ids(packetBroadcastInt(int32_t(invalidTriangleId))) {}
+
+    /// Put a triangle in a lane.
+    void setLane(int lane, const TriangleRecord &record);
+    /// Intersect a single ray with all triangles of the packet.
+    /// Updates the hit and returns true only if one of them is closer than the hit so far.
+    bool intersect(const Ray &ray, Hit &hit) const;
+};
+
+/// Precompute the records of a list of triangles. The ids are the indices in the list.
+std::vector<TriangleRecord> buildTriangleRecords(const std::vector<Triangle> &triangles);
+/// Precompute the records of the triangles of a mesh. The ids are the triangle indices in the mesh.
+std::vector<TriangleRecord> buildTriangleRecords(const Mesh &mesh);
+/// Pack a list of records into packets of SIMD_WIDTH, padding the last one.
+std::vector<TrianglePacket> buildTrianglePackets(const std::vector<TriangleRecord> &records);
+/// Find the closest intersection of a ray with any of the packed triangles.
+bool intersectTriangles(const Ray &ray, const std::vector<TrianglePacket> &packets, Hit &hit);
+
+#endif
@@ -1,7 +1,14 @@
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <fstream>
 
+#include "animation.h"
+#include "batch.h"
 #include "draw.h"
+#include "meshprocessing.h"
+#include "profiler.h"
+#include "sceneloader.h"
 
 /// Draws a sun image to a given .ppm file. The sun is a circle with a gradient, and
 /// the sky is background with a gradient.
@@ -18,9 +25,11 @@ void drawSun(const std::string &outputFilePath, size_t width, size_t height) {
     sunDrawer.draw();
 }
 
-/// Draws a rectangle with noise based on a given color.
-void drawNoiseGrid(const std::string &outputFilePath, size_t width, size_t height) {
-    srand(time(0));
+/// Draws a grid of rectangles with noise, each based on a random color.
+/// The colors and the noise are drawn from the seed, so the same seed gives the same image.
+void drawNoiseGrid(const std::string &outputFilePath, size_t width, size_t height, uint64_t seed) {
+    // The colors use a different sample index than the noise, so they are independent of it.
+    RandomStream colorRandom(seed, 0, 0, 1);
     RectangleDrawer rectangleDrawer(outputFilePath, width, height);
     const int oneFourthWidth=width/4;
     const int oneForthHeight=height/4;
@@ -29,8 +38,10 @@ void drawNoiseGrid(const std::string &outputFilePath, size_t width, size_t heigh
         for (int j=0; j<4; ++j) {
             const int fromX=j*oneFourthWidth;
             rectangleDrawer.changeRectangle(fromX, fromY, oneFourthWidth, oneForthHeight);
-            const Color randomColor(rand()%255, rand()%255, rand()%255);
-            rectangleDrawer.fillNoiseRectangle(randomColor);
+            const int red=colorRandom.nextBelow(255);
+            const int green=colorRandom.nextBelow(255);
+            const int blue=colorRandom.nextBelow(255);
+            rectangleDrawer.fillNoiseRectangle(Color(red, green, blue), seed);
         }
     }
      rectangleDrawer.draw();
@@ -39,12 +50,11 @@ void drawNoiseGrid(const std::string &outputFilePath, size_t width, size_t heigh
 // Homework task 2.
 void task2() {
     drawSun("../Images/Homework_2/circle.ppm", 1920, 1080);
-    drawNoiseGrid("../Images/Homework_2/grid.ppm", 1920, 1080);
+    drawNoiseGrid("../Images/Homework_2/grid.ppm", 1920, 1080, 2);
 }
 
 void task3() {
     RayDrawer rayDrawer("../Images/Homework_3/normalized.ppm", 1920, 1080);
-    rayDrawer.prepareRays();
     rayDrawer.fillPixelsFromRays();
     rayDrawer.draw();
 }
@@ -122,8 +132,337 @@ void task4() {
     printf("File written.\n");
 }
 
+/// A pyramid standing on a floor, for when no scene file is given.
+Mesh createPyramidMesh() {
+    Mesh mesh;
+    const uint32_t floor0=mesh.addVertex(Vector(-4, -1, -4)), floor1=mesh.addVertex(Vector(4, -1, -4));
+    const uint32_t floor2=mesh.addVertex(Vector(4, -1, 4)), floor3=mesh.addVertex(Vector(-4, -1, 4));
+    mesh.addTriangle(floor0, floor2, floor1);
+    mesh.addTriangle(floor0, floor3, floor2);
+    const uint32_t base0=mesh.addVertex(Vector(-1, -1, -1)), base1=mesh.addVertex(Vector(1, -1, -1));
+    const uint32_t base2=mesh.addVertex(Vector(1, -1, 1)), base3=mesh.addVertex(Vector(-1, -1, 1));
+    const uint32_t top=mesh.addVertex(Vector(0, 1, 0));
+    mesh.addTriangle(base0, base1, top);
+    mesh.addTriangle(base1, base2, top);
+    mesh.addTriangle(base2, base3, top);
+    mesh.addTriangle(base3, base0, top);
+    return mesh;
+}
+
+/// Load a scene file, or make the pyramid scene if no file is given.
+bool createScene(const char *sceneFilePath, Scene &scene) {
+    // An empty path, e.g. to give the arguments after it, also means the built-in scene.
+    if (sceneFilePath && sceneFilePath[0]!='\0') {
+        return loadScene(sceneFilePath, scene);
+    }
+    SceneObject pyramid;
+    pyramid.mesh=createPyramidMesh();
+    scene.getObjects().push_back(std::move(pyramid));
+    scene.changeBackgroundColor(Color(173, 216, 230));
+    return true;
+}
+
+/// How far from the center of a scene a camera has to be to see all of it.
+float findOrbitRadius(const BoundingBox &bounds) {
+    return std::max(bounds.getExtent().length()*0.6f, 1.0f);
+}
+
+/// A camera path circling once around a scene, looking at its center.
+CameraPath createOrbitPath(const BoundingBox &bounds) {
+    const Vector &center=bounds.getCenter();
+    const float radius=findOrbitRadius(bounds);
+    CameraPath path;
+    for (int keyframe=0; keyframe<=4; ++keyframe) {
+        const float angle=float(keyframe)*float(M_PI)/2.0f;
+        const Vector offset(radius*sinf(angle), radius*0.4f, radius*cosf(angle));
+        path.addKeyframe(CameraKeyframe(float(keyframe), center+offset, center));
+    }
+    return path;
+}
+
+/// A camera looking at the center of a scene from above and to the side, at the distance of the orbit.
+Camera createOrbitCamera(const BoundingBox &bounds, size_t width, size_t height) {
+    const Vector &center=bounds.getCenter();
+    const float radius=findOrbitRadius(bounds);
+    return Camera(width, height, center+Vector(radius*0.6f, radius*0.4f, radius*0.8f), center);
+}
+
+// Homework task 6 - a camera flying around a scene, one image per frame.
+void task6(const char *sceneFilePath, size_t frameCount, const std::string &extension, bool useWavefront) {
+    Scene scene;
+    if (!createScene(sceneFilePath, scene)) {
+        return;
+    }
+    // The scene and its BVH are built once and shared by all frames.
+    BVH bvh;
+    bvh.build(scene.mergeObjects());
+    const CameraPath &path=createOrbitPath(bvh.getBounds());
+
+    mkdir("../Images/Homework_6", 0755);
+    AnimationSettings settings;
+    settings.outputFilePattern="../Images/Homework_6/frame_%04d."+extension;
+    settings.outputFormat=findImageFormat(settings.outputFilePattern);
+    settings.width=scene.getImageWidth();
+    settings.height=scene.getImageHeight();
+    settings.frameCount=frameCount;
+    settings.backgroundColor=scene.getBackgroundColor();
+    settings.useWavefront=useWavefront;
+    AnimationRenderer renderer(bvh, settings);
+    renderer.render(path);
+}
+
+// Homework task 7 - an anti-aliased image of a scene, with more samples along the edges.
+void task7(const char *sceneFilePath, double timeBudgetMilliseconds) {
+    Scene scene;
+    if (!createScene(sceneFilePath, scene)) {
+        return;
+    }
+    BVH bvh;
+    bvh.build(scene.mergeObjects());
+
+    mkdir("../Images/Homework_7", 0755);
+    RayDrawer rayDrawer("../Images/Homework_7/antialiased.ppm", scene.getImageWidth(), scene.getImageHeight());
+    rayDrawer.changeScene(bvh, scene.getBackgroundColor());
+    rayDrawer.changeCamera(createOrbitCamera(bvh.getBounds(), scene.getImageWidth(), scene.getImageHeight()));
+    SamplingSettings settings;
+    settings.timeBudgetMilliseconds=timeBudgetMilliseconds;
+    const SamplingStatistics &statistics=rayDrawer.fillPixelsFromRaysAdaptive(settings);
+    printf("%llu samples (%.2f per pixel) in %zu passes, %.1f ms%s.\n",
+        (unsigned long long)statistics.samplesTaken,
+        double(statistics.samplesTaken)/(scene.getImageWidth()*scene.getImageHeight()),
+        statistics.passes,
+        statistics.milliseconds,
+        statistics.budgetExhausted ? ", cut short by the budget" : "");
+    rayDrawer.draw();
+}
+
+// Homework task 8 - a progressive preview of a scene, published pass by pass to a viewer.
+void task8(const char *sceneFilePath, const std::string &outputDescription) {
+    Scene scene;
+    if (!createScene(sceneFilePath, scene)) {
+        return;
+    }
+    BVH bvh;
+    bvh.build(scene.mergeObjects());
+
+    mkdir("../Images/Homework_8", 0755);
+    const size_t width=scene.getImageWidth(), height=scene.getImageHeight();
+    // The publisher goes first, so it outlives a drawer that draws into its memory.
+    const std::unique_ptr<FramePublisher> &publisher=createFramePublisher(outputDescription, width, height);
+    if (!publisher) {
+        return;
+    }
+    RayDrawer rayDrawer("../Images/Homework_8/preview.ppm", width, height);
+    rayDrawer.changeScene(bvh, scene.getBackgroundColor());
+    rayDrawer.changeCamera(createOrbitCamera(bvh.getBounds(), width, height));
+    // Draw right into the publisher's memory if it has any, so publishing a pass copies nothing.
+    FrameBuffer<Color> publishedPixels=publisher->createFrameBuffer();
+    if (publishedPixels.getWidth()>0) {
+        rayDrawer.exchangeFrameBuffer(std::move(publishedPixels));
+    }
+    const PreviewStatistics &statistics=rayDrawer.fillPixelsProgressive(PreviewSettings(), publisher.get());
+    printf("First image after %.2f ms, %zu passes in %.1f ms%s.\n", statistics.firstImageMilliseconds, statistics.passes,
+           statistics.milliseconds, statistics.isPublished ? "" : ", some of them couldn't be published");
+    rayDrawer.draw();
+}
+
+// Homework task 9 - a scene rendered by several worker processes, a single frame tile by tile or an animation frame by frame.
+void task9(const char *sceneFilePath, size_t workerCount, size_t frameCount, size_t workerJobLimit) {
+    Scene scene;
+    if (!createScene(sceneFilePath, scene)) {
+        return;
+    }
+    BVH bvh;
+    bvh.build(scene.mergeObjects());
+    const size_t width=scene.getImageWidth(), height=scene.getImageHeight();
+
+    DistributedSettings settings;
+    settings.workerCount=workerCount;
+    // Every worker loads the scene on its own, once.
+    settings.workerArguments.push_back(sceneFilePath ? sceneFilePath : "");
+    if (workerJobLimit>0) {
+#ifdef FAULT_INJECTION
+        settings.workerArguments.push_back(std::to_string(workerJobLimit));
+        settings.maxWorkerRestarts=size_t(-1);
+#else
+        printf("The worker job limit needs a build configured with -DCRT_FAULT_INJECTION=ON, rendering without it.\n");
+#endif
+    }
+    RenderCoordinator coordinator(settings);
+    if (!coordinator.start()) {
+        return;
+    }
+    mkdir("../Images/Homework_9", 0755);
+    RayDrawer rayDrawer("../Images/Homework_9/distributed.ppm", width, height);
+    rayDrawer.changeScene(bvh, scene.getBackgroundColor());
+    const CameraPath &path=createOrbitPath(bvh.getBounds());
+    if (frameCount==0) {
+        rayDrawer.changeCamera(path.evaluate(path.getStartTime(), width, height));
+        if (!rayDrawer.fillPixelsDistributed(coordinator)) {
+            return;
+        }
+        rayDrawer.draw();
+    } else {
+        // Whole frames are the jobs, and each one is written as soon as it is back.
+        std::vector<RenderJob> jobs;
+        for (size_t i=0; i<frameCount; ++i) {
+            const float ratio=frameCount>1 ? float(i)/float(frameCount-1) : 0.0f;
+            const Camera &camera=path.evaluate(path.getStartTime()+(path.getEndTime()-path.getStartTime())*ratio, width, height);
+            jobs.push_back(RenderJob(i, camera, Tile{0, 0, width, height}));
+        }
+        FrameBuffer<Color> &pixels=rayDrawer.getFrameBuffer();
+        const bool isFinished=coordinator.run(jobs, [&](const RenderJob &job, const Color *framePixels) {
+            for (size_t i=0; i<height; ++i) {
+                memcpy(pixels.row(i), framePixels+i*width, width*sizeof(Color));
+            }
+            char outputFilePath[64];
+            snprintf(outputFilePath, sizeof(outputFilePath), "../Images/Homework_9/frame_%04zu.ppm", job.frameIndex);
+            rayDrawer.changeOutputFile(outputFilePath);
+            rayDrawer.draw();
+        });
+        if (!isFinished) {
+            return;
+        }
+    }
+    const DistributedStatistics &statistics=coordinator.getStatistics();
+    printf("%zu jobs on %zu workers in %.1f ms, %.1f MB received, %zu workers lost and %zu jobs requeued.\n",
+           statistics.jobsFinished, workerCount, statistics.milliseconds, double(statistics.bytesReceived)/1e6,
+           statistics.workersLost, statistics.jobsRequeued);
+}
+
+// Homework task 4 for a whole scene - the normals, areas and bounds of every triangle and vertex in one batch.
+void task10(const char *sceneFilePath) {
+    Scene scene;
+    if (!createScene(sceneFilePath, scene)) {
+        return;
+    }
+    const Mesh &mesh=scene.mergeObjects();
+    MeshAttributes attributes;
+    const MeshProcessingStatistics &statistics=processMesh(mesh, attributes);
+    if (!statistics.isValid) {
+        return;
+    }
+    printf("%zu triangles and %zu vertices processed in %.2f ms on %zu threads.\n", statistics.triangleCount,
+           statistics.vertexCount, statistics.milliseconds, TileScheduler::getDefault().getThreadCount());
+    const Vector &extent=attributes.bounds.getExtent();
+    printf("Bounds %.3f x %.3f x %.3f, %zu vertices without a normal.\n", extent.getX(), extent.getY(), extent.getZ(),
+           statistics.verticesWithoutNormal);
+    if (statistics.degenerateTriangleCount>0) {
+        printf("%zu degenerate triangles have no normal:", statistics.degenerateTriangleCount);
+        const size_t shownCount=std::min<size_t>(statistics.degenerateTriangleCount, 16);
+        for (size_t i=0; i<shownCount; ++i) {
+            printf(" %u", attributes.degenerateTriangles[i]);
+        }
+        printf(shownCount<statistics.degenerateTriangleCount ? " ...\n" : "\n");
+    }
+}
+
+// Render the jobs of a manifest, next to each other, and report how long each took and how many jobs an hour that makes.
+void task11(const char *manifestFilePath, const BatchSettings &settings) {
+    std::vector<BatchJob> jobs;
+    if (!loadBatchManifest(manifestFilePath, jobs)) {
+        return;
+    }
+    std::vector<BatchJobResult> results;
+    const BatchStatistics &statistics=runBatch(jobs, settings, results);
+    for (size_t i=0; i<jobs.size(); ++i) {
+        const BatchJobResult &result=results[i];
+        printf("%-32s %s latency %9.1f ms (scene %.1f, render %.1f, write %.1f), queued %.1f ms.\n", jobs[i].name.c_str(),
+               result.isFinished ? "done  " : "FAILED", result.latencyMilliseconds, result.sceneMilliseconds,
+               result.renderMilliseconds, result.writeMilliseconds, result.queueMilliseconds);
+    }
+    printf("%zu jobs finished and %zu failed in %.1f ms - %.1f jobs per hour. %zu scenes loaded, up to %zu jobs and %.1f MB at once.\n",
+           statistics.jobsFinished, statistics.jobsFailed, statistics.milliseconds, statistics.getJobsPerHour(),
+           statistics.scenesLoaded, statistics.peakConcurrentJobs, double(statistics.peakMemoryUsage)/1e6);
+}
+
+/// The entry point of a worker process started by a RenderCoordinator.
+int runWorker(int socket, size_t threadCount, const char *sceneFilePath) {
+    Scene scene;
+    if (!createScene(sceneFilePath, scene)) {
+        return 1;
+    }
+    // The scene stays loaded for every job the worker gets.
+    BVH bvh;
+    bvh.build(scene.mergeObjects());
+    return runRenderWorker(socket, &bvh, scene.getBackgroundColor(), threadCount) ? 0 : 1;
+}
+
 int main(int argc, const char *argv[]) {
-    task3();
-    task4();
+    // "--profile file.json" and "--trace file.json" record where the time goes, and can come before any task.
+    // "--wavefront" renders the animation frames stage by stage over queues of rays.
+    std::string profileFilePath, traceFilePath;
+    bool useWavefront=false;
+    std::vector<const char *> arguments;
+    for (int i=0; i<argc; ++i) {
+        if (strcmp(argv[i], "--wavefront")==0) {
+            useWavefront=true;
+        } else if (strcmp(argv[i], "--profile")==0 && i+1<argc) {
+            profileFilePath=argv[++i];
+        } else if (strcmp(argv[i], "--trace")==0 && i+1<argc) {
+            traceFilePath=argv[++i];
+        } else {
+            arguments.push_back(argv[i]);
+        }
+    }
+    // "worker <socket> <threads> [scene file] [job limit]" is how a RenderCoordinator starts its workers.
+    // The job limit is only there in builds with fault injection.
+    if (arguments.size()>3 && strcmp(arguments[1], "worker")==0) {
+        const char *sceneFilePath=arguments.size()>4 ? arguments[4] : nullptr;
+#ifdef FAULT_INJECTION
+        injectWorkerCrash(arguments.size()>5 ? size_t(atoi(arguments[5])) : 0);
+#endif
+        return runWorker(atoi(arguments[2]), size_t(atoi(arguments[3])), sceneFilePath);
+    }
+    Profiler &profiler=Profiler::getInstance();
+    profiler.changeEnabled(!profileFilePath.empty() || !traceFilePath.empty());
+
+    // "animate [frame count] [scene file] [ppm|qoi|png]" renders a camera animation instead of the other tasks.
+    if (arguments.size()>1 && strcmp(arguments[1], "animate")==0) {
+        const size_t frameCount=arguments.size()>2 ? size_t(atoi(arguments[2])) : 60;
+        const char *sceneFilePath=arguments.size()>3 ? arguments[3] : nullptr;
+        const std::string extension=arguments.size()>4 ? arguments[4] : "ppm";
+        task6(sceneFilePath, frameCount, extension, useWavefront);
+    } else if (arguments.size()>1 && strcmp(arguments[1], "antialias")==0) {
+        // "antialias [time budget in milliseconds] [scene file]" - a budget of 0 samples until the image is clean.
+        const double timeBudgetMilliseconds=arguments.size()>2 ? atof(arguments[2]) : 0.0;
+        const char *sceneFilePath=arguments.size()>3 ? arguments[3] : nullptr;
+        task7(sceneFilePath, timeBudgetMilliseconds);
+    } else if (arguments.size()>1 && strcmp(arguments[1], "preview")==0) {
+        // "preview [scene file] [shm:/name | pipe:path]" - the passes go to shared memory by default.
+        const char *sceneFilePath=arguments.size()>2 ? arguments[2] : nullptr;
+        const std::string outputDescription=arguments.size()>3 ? arguments[3] : "shm:/crt_preview";
+        task8(sceneFilePath, outputDescription);
+    } else if (arguments.size()>1 && strcmp(arguments[1], "distribute")==0) {
+        // "distribute [worker count] [scene file] [frame count] [worker job limit]" - no frame count renders a single
+        // frame in tiles. With a job limit the workers exit after that many jobs, to see the lost jobs requeued -
+        // only in builds configured with -DCRT_FAULT_INJECTION=ON.
+        const size_t workerCount=arguments.size()>2 ? size_t(atoi(arguments[2])) : 4;
+        const char *sceneFilePath=arguments.size()>3 ? arguments[3] : nullptr;
+        const size_t frameCount=arguments.size()>4 ? size_t(atoi(arguments[4])) : 0;
+        const size_t workerJobLimit=arguments.size()>5 ? size_t(atoi(arguments[5])) : 0;
+        task9(sceneFilePath, workerCount, frameCount, workerJobLimit);
+    } else if (arguments.size()>1 && strcmp(arguments[1], "preprocess")==0) {
+        // "preprocess [scene file]" - the per-triangle and per-vertex attributes of the scene, and its degenerate triangles.
+        const char *sceneFilePath=arguments.size()>2 ? arguments[2] : nullptr;
+        task10(sceneFilePath);
+    } else if (arguments.size()>2 && strcmp(arguments[1], "batch")==0) {
+        // "batch <manifest> [threads] [threads per job] [memory budget in MB]" - the jobs of the manifest, see batch.h.
+        BatchSettings settings;
+        settings.threadCount=arguments.size()>3 ? size_t(atoi(arguments[3])) : 0;
+        settings.threadsPerJob=arguments.size()>4 ? size_t(atoi(arguments[4])) : 1;
+        settings.memoryBudget=arguments.size()>5 ? size_t(atof(arguments[5])*1e6) : 0;
+        task11(arguments[2], settings);
+    } else {
+        task3();
+        task4();
+    }
+
+    if (!profileFilePath.empty()) {
+        profiler.writeJson(profileFilePath);
+    }
+    if (!traceFilePath.empty()) {
+        profiler.writeChromeTrace(traceFilePath);
+    }
     return 0;
 }
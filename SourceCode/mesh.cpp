@@ -0,0 +1,69 @@
+#include <string.h>
+#include <unordered_map>
+
+#include "mesh.h"
+
+namespace {
+
+/// The exact bits of a vertex, used to find vertices that are shared between triangles.
+struct VertexKey {
+    uint32_t bits[3];
+
+    explicit VertexKey(const Vector &vertex) {
+        const float coordinates[3]={vertex.getX(), vertex.getY(), vertex.getZ()};
+        memcpy(bits, coordinates, sizeof(bits));
+    }
+    bool operator==(const VertexKey &otherKey) const {
+        return bits[0]==otherKey.bits[0] && bits[1]==otherKey.bits[1] && bits[2]==otherKey.bits[2];
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey &key) const {
+        uint64_t hash=0xcbf29ce484222325ull;
+        for (int i=0; i<3; ++i) {
+            hash=(hash^key.bits[i])*0x100000001b3ull;
+        }
+        return size_t(hash);
+    }
+};
+
+}
+
+// Mesh.
+Mesh Mesh::fromTriangles(const std::vector<Triangle> &triangles) {
+    Mesh mesh;
+    mesh.reserve(triangles.size()/2, triangles.size());
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertexIndices;
+    vertexIndices.reserve(triangles.size());
+    const auto findIndex=[&](const Vector &vertex) {
+        const std::pair<std::unordered_map<VertexKey, uint32_t, VertexKeyHash>::iterator, bool> &inserted
+            =vertexIndices.emplace(VertexKey(vertex), uint32_t(mesh.vertices.size()));
+        if (inserted.second) {
+            mesh.vertices.push_back(vertex);
+        }
+        return inserted.first->second;
+    };
+    for (const Triangle &triangle : triangles) {
+        const uint32_t index0=findIndex(triangle.getV0());
+        const uint32_t index1=findIndex(triangle.getV1());
+        const uint32_t index2=findIndex(triangle.getV2());
+        mesh.addTriangle(index0, index1, index2);
+    }
+    return mesh;
+}
+
+bool Mesh::isValid() const {
+    if (indices.size()%3!=0) {
+        return false;
+    }
+    if (!normals.empty() && normals.size()!=vertices.size()) {
+        return false;
+    }
+    for (const uint32_t index : indices) {
+        if (index>=vertices.size()) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "geometry.h"
+
+/// A lightweight view of a single triangle of a Mesh - the vertices are read from the mesh,
+/// not copied. Offers the same functions as Triangle.
+class TriangleView {
+private:
+    const Vector *vertices;
+    const uint32_t *indices;
+public:
+    /// Constructors.
+    TriangleView(const Vector *newVertices, const uint32_t *newIndices)
+        : vertices(newVertices)
+        , indices(newIndices) {}
+    /// Getters.
+    const Vector &getV0() const {
+        return vertices[indices[0]];
+    }
+    const Vector &getV1() const {
+        return vertices[indices[1]];
+    }
+    const Vector &getV2() const {
+        return vertices[indices[2]];
+    }
+    /// The index of a vertex (0, 1 or 2) in the vertex buffer of the mesh.
+    uint32_t getIndex(int vertex) const {
+        return indices[vertex];
+    }
+    /// Find the normal vector of the triangle.
+    Vector getNormalVector() const {
+        return findTriangleNormal(getV0(), getV1(), getV2());
+    }
+    /// Calculate the area of the triangle.
+    float getArea() const {
+        return findTriangleArea(getV0(), getV1(), getV2());
+    }
+    /// Copy the vertices to a standalone triangle.
+    Triangle toTriangle() const {
+        return Triangle(getV0(), getV1(), getV2());
+    }
+};
+
+/// A triangle mesh with a single shared vertex buffer and three uint32 indices per triangle,
+/// plus an optional normal per vertex.
+class Mesh {
+private:
+    std::vector<Vector> vertices;
+    std::vector<uint32_t> indices;
+    /// Either empty or one normal per vertex.
+    std::vector<Vector> normals;
+public:
+    /// Constructors.
+    Mesh() {}
+    Mesh(std::vector<Vector> newVertices, std::vector<uint32_t> newIndices, std::vector<Vector> newNormals=std::vector<Vector>())
+        : vertices(std::move(newVertices))
+        , indices(std::move(newIndices))
+        , normals(std::move(newNormals)) {}
+    /// Build a mesh from standalone triangles, merging vertices with exactly the same coordinates.
+    static Mesh fromTriangles(const std::vector<Triangle> &triangles);
+
+    /// Reserve space for a known number of vertices and triangles.
+    void reserve(size_t vertexCount, size_t triangleCount) {
+        vertices.reserve(vertexCount);
+        indices.reserve(triangleCount*3);
+    }
+    /// Add a vertex and return its index.
+    uint32_t addVertex(const Vector &vertex) {
+        vertices.push_back(vertex);
+        return uint32_t(vertices.size()-1);
+    }
+    /// Add a triangle from the indices of three vertices.
+    void addTriangle(uint32_t index0, uint32_t index1, uint32_t index2) {
+        indices.push_back(index0);
+        indices.push_back(index1);
+        indices.push_back(index2);
+    }
+    /// Set the per-vertex normals - one for each vertex.
+    void changeNormals(std::vector<Vector> newNormals) {
+        normals=std::move(newNormals);
+    }
+    /// Check that every index points to a vertex and that the normals match the vertices.
+    bool isValid() const;
+
+    /// Getters.
+    size_t getVertexCount() const {
+        return vertices.size();
+    }
+    size_t getTriangleCount() const {
+        return indices.size()/3;
+    }
+    bool hasNormals() const {
+        return !normals.empty();
+    }
+    const std::vector<Vector> &getVertices() const {
+        return vertices;
+    }
+    std::vector<Vector> &getVertices() {
+        return vertices;
+    }
+    const std::vector<uint32_t> &getIndices() const {
+        return indices;
+    }
+    std::vector<uint32_t> &getIndices() {
+        return indices;
+    }
+    const std::vector<Vector> &getNormals() const {
+        return normals;
+    }
+    std::vector<Vector> &getNormals() {
+        return normals;
+    }
+    /// A view of a single triangle. It stays valid until the mesh buffers change.
+    TriangleView getTriangle(size_t triangleIndex) const {
+        return TriangleView(vertices.data(), indices.data()+3*triangleIndex);
+    }
+    /// The memory taken by the vertex, index and normal buffers, in bytes.
+    size_t getMemoryUsage() const {
+        return (vertices.capacity()+normals.capacity())*sizeof(Vector)+indices.capacity()*sizeof(uint32_t);
+    }
+};
+
+#endif
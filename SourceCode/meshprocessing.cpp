@@ -0,0 +1,214 @@
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#include "meshprocessing.h"
+#include "profiler.h"
+#include "simd.h"
+
+namespace {
+
+/// The triangles and vertices one work item processes - a multiple of any SIMD_WIDTH.
+const size_t trianglesPerItem=4096;
+const size_t verticesPerItem=4096;
+
+/// Store the lanes of a packet to values[0, count), all of them with a single store when the packet is full.
+SIMD_INLINE void storeLanes(float *values, const PacketFloat &packet, int count) {
+    if (count==SIMD_WIDTH) {
+        packetStore(values, packet);
+        return;
+    }
+    for (int lane=0; lane<count; ++lane) {
+        values[lane]=packet[lane];
+    }
+}
+
+/// Compute the normals, areas, centroids and bounds of the triangles [first, first+count), SIMD_WIDTH
+/// triangles per iteration, and return the bounds of all of them.
+SIMD_DISPATCH
+BoundingBox processTriangles(const Vector *vertices, const uint32_t *indices, size_t first, size_t count, MeshAttributes &attributes) {
+    PacketFloat minX=packetBroadcast(INFINITY), minY=packetBroadcast(INFINITY), minZ=packetBroadcast(INFINITY);
+    PacketFloat maxX=packetBroadcast(-INFINITY), maxY=packetBroadcast(-INFINITY), maxZ=packetBroadcast(-INFINITY);
+    for (size_t k=first; k<first+count; k+=SIMD_WIDTH) {
+        const int laneCount=int(std::min<size_t>(SIMD_WIDTH, first+count-k));
+        // The lanes past the last triangle repeat it, so they change none of the bounds.
+        VectorPacket v0, v1, v2;
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+            const uint32_t *triangle=indices+3*(k+std::min(lane, laneCount-1));
+            v0.setLane(lane, vertices[triangle[0]]);
+            v1.setLane(lane, vertices[triangle[1]]);
+            v2.setLane(lane, vertices[triangle[2]]);
+        }
+
+        // The same operations as findTriangleNormal(..) and findTriangleArea(..).
+        const VectorPacket &cross=(v1-v0).crossProduct(v2-v0);
+        const PacketFloat length=cross.length();
+        const PacketFloat area=length*0.5f;
+        // A triangle without area, or with a vertex that isn't finite, has no normal - normalizing it gives NaNs.
+        const PacketInt isProper=packetLess(packetBroadcast(0.0f), area) & packetLess(length, packetBroadcast(INFINITY));
+        const PacketFloat zero=packetBroadcast(0.0f);
+        storeLanes(attributes.normalX.data()+k, packetSelect(isProper, cross.getX()/length, zero), laneCount);
+        storeLanes(attributes.normalY.data()+k, packetSelect(isProper, cross.getY()/length, zero), laneCount);
+        storeLanes(attributes.normalZ.data()+k, packetSelect(isProper, cross.getZ()/length, zero), laneCount);
+        storeLanes(attributes.areas.data()+k, packetSelect(isProper, area, zero), laneCount);
+
+        const VectorPacket &centroid=(v0+v1+v2)*(1.0f/3.0f);
+        storeLanes(attributes.centroidX.data()+k, centroid.getX(), laneCount);
+        storeLanes(attributes.centroidY.data()+k, centroid.getY(), laneCount);
+        storeLanes(attributes.centroidZ.data()+k, centroid.getZ(), laneCount);
+
+        const PacketFloat &triangleMinX=packetMin(packetMin(v0.getX(), v1.getX()), v2.getX());
+        const PacketFloat &triangleMinY=packetMin(packetMin(v0.getY(), v1.getY()), v2.getY());
+        const PacketFloat &triangleMinZ=packetMin(packetMin(v0.getZ(), v1.getZ()), v2.getZ());
+        const PacketFloat &triangleMaxX=packetMax(packetMax(v0.getX(), v1.getX()), v2.getX());
+        const PacketFloat &triangleMaxY=packetMax(packetMax(v0.getY(), v1.getY()), v2.getY());
+        const PacketFloat &triangleMaxZ=packetMax(packetMax(v0.getZ(), v1.getZ()), v2.getZ());
+        storeLanes(attributes.minX.data()+k, triangleMinX, laneCount);
+        storeLanes(attributes.minY.data()+k, triangleMinY, laneCount);
+        storeLanes(attributes.minZ.data()+k, triangleMinZ, laneCount);
+        storeLanes(attributes.maxX.data()+k, triangleMaxX, laneCount);
+        storeLanes(attributes.maxY.data()+k, triangleMaxY, laneCount);
+        storeLanes(attributes.maxZ.data()+k, triangleMaxZ, laneCount);
+        minX=packetMin(minX, triangleMinX);
+        minY=packetMin(minY, triangleMinY);
+        minZ=packetMin(minZ, triangleMinZ);
+        maxX=packetMax(maxX, triangleMaxX);
+        maxY=packetMax(maxY, triangleMaxY);
+        maxZ=packetMax(maxZ, triangleMaxZ);
+    }
+    BoundingBox bounds;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        bounds.expand(BoundingBox(Vector(minX[lane], minY[lane], minZ[lane]), Vector(maxX[lane], maxY[lane], maxZ[lane])));
+    }
+    return bounds;
+}
+
+/// Normalize the vertex normals [first, first+count), SIMD_WIDTH vertices per iteration.
+/// Returns how many of them had no length and stay zero.
+SIMD_DISPATCH
+size_t normalizeVertexNormals(size_t first, size_t count, MeshAttributes &attributes) {
+    size_t withoutNormal=0;
+    const PacketFloat zero=packetBroadcast(0.0f);
+    for (size_t k=first; k<first+count; k+=SIMD_WIDTH) {
+        const int laneCount=int(std::min<size_t>(SIMD_WIDTH, first+count-k));
+        VectorPacket normal;
+        for (int lane=0; lane<laneCount; ++lane) {
+            normal.setLane(lane, attributes.getVertexNormal(k+lane));
+        }
+        const PacketFloat length=normal.length();
+        const PacketInt hasLength=packetLess(zero, length);
+        for (int lane=0; lane<laneCount; ++lane) {
+            withoutNormal+=hasLength[lane]==0;
+        }
+        storeLanes(attributes.vertexNormalX.data()+k, packetSelect(hasLength, normal.getX()/length, zero), laneCount);
+        storeLanes(attributes.vertexNormalY.data()+k, packetSelect(hasLength, normal.getY()/length, zero), laneCount);
+        storeLanes(attributes.vertexNormalZ.data()+k, packetSelect(hasLength, normal.getZ()/length, zero), laneCount);
+    }
+    return withoutNormal;
+}
+
+/// Resize every array of the attributes, keeping their memory if they are big enough already.
+void resizeAttributes(MeshAttributes &attributes, size_t triangleCount, size_t vertexCount) {
+    MeshAttributes::FloatArray *triangleArrays[]={
+        &attributes.normalX, &attributes.normalY, &attributes.normalZ, &attributes.areas,
+        &attributes.centroidX, &attributes.centroidY, &attributes.centroidZ,
+        &attributes.minX, &attributes.minY, &attributes.minZ, &attributes.maxX, &attributes.maxY, &attributes.maxZ
+    };
+    for (MeshAttributes::FloatArray *array : triangleArrays) {
+        array->resize(triangleCount);
+    }
+    attributes.vertexNormalX.resize(vertexCount);
+    attributes.vertexNormalY.resize(vertexCount);
+    attributes.vertexNormalZ.resize(vertexCount);
+    attributes.degenerateTriangles.clear();
+    attributes.bounds=BoundingBox();
+}
+
+}
+
+// MeshAttributes.
+std::vector<Vector> MeshAttributes::getVertexNormals() const {
+    std::vector<Vector> normals(vertexNormalX.size());
+    for (size_t i=0; i<normals.size(); ++i) {
+        normals[i]=getVertexNormal(i);
+    }
+    return normals;
+}
+
+MeshProcessingStatistics processMesh(const Mesh &mesh, MeshAttributes &attributes, TileScheduler &scheduler) {
+    PROFILE_SCOPE(ProfileStage::MeshProcessing);
+    const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    MeshProcessingStatistics statistics;
+    const size_t triangleCount=mesh.getTriangleCount(), vertexCount=mesh.getVertexCount();
+    statistics.triangleCount=triangleCount;
+    statistics.vertexCount=vertexCount;
+    const Vector *vertices=mesh.getVertices().data();
+    const uint32_t *indices=mesh.getIndices().data();
+    for (size_t i=0; i<triangleCount*3; ++i) {
+        if (indices[i]>=vertexCount) {
+            printf("Triangle %zu points to vertex %u, but the mesh has %zu vertices.\n", i/3, indices[i], vertexCount);
+            return statistics;
+        }
+    }
+    resizeAttributes(attributes, triangleCount, vertexCount);
+
+    // The triangles first, each chunk on its own.
+    const size_t triangleItemCount=(triangleCount+trianglesPerItem-1)/trianglesPerItem;
+    std::vector<BoundingBox> itemBounds(triangleItemCount);
+    scheduler.runItems(triangleItemCount, [&](size_t item) {
+        const size_t first=item*trianglesPerItem;
+        itemBounds[item]=processTriangles(vertices, indices, first, std::min(trianglesPerItem, triangleCount-first), attributes);
+    });
+    for (const BoundingBox &bounds : itemBounds) {
+        attributes.bounds.expand(bounds);
+    }
+    for (size_t i=0; i<triangleCount; ++i) {
+        if (attributes.areas[i]==0.0f) {
+            attributes.degenerateTriangles.push_back(uint32_t(i));
+        }
+    }
+    statistics.degenerateTriangleCount=attributes.degenerateTriangles.size();
+
+    // Then the vertices, which gather from the triangles around them instead of the triangles scattering to their
+    // vertices - no two threads write the same vertex, and the sums are added in the same order for any thread count.
+    // The triangles around every vertex, in increasing order, are counted and laid out one vertex after the other.
+    std::vector<uint32_t> firstVertexTriangle(vertexCount+1, 0);
+    for (size_t i=0; i<triangleCount*3; ++i) {
+        ++firstVertexTriangle[indices[i]+1];
+    }
+    for (size_t i=0; i<vertexCount; ++i) {
+        firstVertexTriangle[i+1]+=firstVertexTriangle[i];
+    }
+    std::vector<uint32_t> vertexTriangles(triangleCount*3);
+    std::vector<uint32_t> nextVertexTriangle(firstVertexTriangle.begin(), firstVertexTriangle.end()-1);
+    for (size_t i=0; i<triangleCount*3; ++i) {
+        vertexTriangles[nextVertexTriangle[indices[i]]++]=uint32_t(i/3);
+    }
+
+    const size_t vertexItemCount=(vertexCount+verticesPerItem-1)/verticesPerItem;
+    std::vector<size_t> itemVerticesWithoutNormal(vertexItemCount, 0);
+    scheduler.runItems(vertexItemCount, [&](size_t item) {
+        const size_t first=item*verticesPerItem, count=std::min(verticesPerItem, vertexCount-first);
+        for (size_t vertex=first; vertex<first+count; ++vertex) {
+            // Degenerate triangles have no area, so they add nothing.
+            Vector sum;
+            for (uint32_t k=firstVertexTriangle[vertex]; k<firstVertexTriangle[vertex+1]; ++k) {
+                const uint32_t triangle=vertexTriangles[k];
+                sum=sum+attributes.getNormal(triangle)*attributes.areas[triangle];
+            }
+            attributes.vertexNormalX[vertex]=sum.getX();
+            attributes.vertexNormalY[vertex]=sum.getY();
+            attributes.vertexNormalZ[vertex]=sum.getZ();
+        }
+        itemVerticesWithoutNormal[item]=normalizeVertexNormals(first, count, attributes);
+    });
+    for (size_t withoutNormal : itemVerticesWithoutNormal) {
+        statistics.verticesWithoutNormal+=withoutNormal;
+    }
+
+    statistics.isValid=true;
+    const std::chrono::duration<double, std::milli> elapsed=std::chrono::steady_clock::now()-start;
+    statistics.milliseconds=elapsed.count();
+    return statistics;
+}
@@ -0,0 +1,68 @@
+#ifndef MESHPROCESSING_H
+#define MESHPROCESSING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "bvh.h"
+#include "mesh.h"
+#include "scheduler.h"
+
+/// The per-triangle and per-vertex quantities of a mesh, as structure of arrays - one array per coordinate -
+/// so that SIMD kernels and later passes read them a packet at a time.
+struct MeshAttributes {
+    typedef std::vector<float, CacheAlignedAllocator<float>> FloatArray;
+
+    /// The unit normal and the area of every triangle. Degenerate triangles have a zero normal and no area.
+    FloatArray normalX, normalY, normalZ;
+    FloatArray areas;
+    /// The center of the vertices of every triangle.
+    FloatArray centroidX, centroidY, centroidZ;
+    /// The bounding box of every triangle.
+    FloatArray minX, minY, minZ;
+    FloatArray maxX, maxY, maxZ;
+    /// The smooth normal of every vertex - the normals of the triangles around it weighted by their areas.
+    /// Vertices without a proper triangle around them have a zero normal.
+    FloatArray vertexNormalX, vertexNormalY, vertexNormalZ;
+    /// The triangles whose vertices are in a line, on top of each other or not finite, in increasing order.
+    std::vector<uint32_t> degenerateTriangles;
+    /// The bounds of the whole mesh.
+    BoundingBox bounds;
+
+    /// The normal of a triangle or a vertex as a Vector.
+    Vector getNormal(size_t triangleIndex) const {
+        return Vector(normalX[triangleIndex], normalY[triangleIndex], normalZ[triangleIndex]);
+    }
+    Vector getVertexNormal(size_t vertexIndex) const {
+        return Vector(vertexNormalX[vertexIndex], vertexNormalY[vertexIndex], vertexNormalZ[vertexIndex]);
+    }
+    BoundingBox getTriangleBounds(size_t triangleIndex) const {
+        return BoundingBox(Vector(minX[triangleIndex], minY[triangleIndex], minZ[triangleIndex]),
+                           Vector(maxX[triangleIndex], maxY[triangleIndex], maxZ[triangleIndex]));
+    }
+    /// The vertex normals as the per-vertex normals of a Mesh.
+    std::vector<Vector> getVertexNormals() const;
+};
+
+/// What processing a mesh found and how long it took.
+struct MeshProcessingStatistics {
+    size_t triangleCount;
+    size_t vertexCount;
+    size_t degenerateTriangleCount;
+    /// The vertices that got a zero normal - unused ones or ones only touched by degenerate triangles.
+    size_t verticesWithoutNormal;
+    double milliseconds;
+    /// Whether the mesh could be processed at all - false if an index points past the vertices.
+    bool isValid;
+
+    /// Constructor.
+    MeshProcessingStatistics() : triangleCount(0), vertexCount(0), degenerateTriangleCount(0), verticesWithoutNormal(0), milliseconds(0.0), isValid(false) {}
+};
+
+/// Compute the attributes of every triangle and vertex of a mesh in one batch, with SIMD kernels on the threads
+/// of the scheduler. Degenerate triangles are listed instead of getting a NaN normal.
+/// The results are the same for any number of threads.
+MeshProcessingStatistics processMesh(const Mesh &mesh, MeshAttributes &attributes, TileScheduler &scheduler=TileScheduler::getDefault());
+
+#endif
@@ -0,0 +1,124 @@
+#include <type_traits>
+
+#include "pixelkernels.h"
+#include "simd.h"
+#include "utils.h"
+
+static_assert(sizeof(Color)==3*sizeof(int32_t), "The kernels treat the pixels as a flat array of channels.");
+static_assert(std::is_trivially_copyable<Color>::value, "The kernels copy pixels as raw channels.");
+
+namespace {
+
+/// Bring a scaled channel into [0, 1]. The comparisons are ordered so that NaN ends up in range too.
+SIMD_INLINE PacketFloat mapChannels(const PacketFloat &values, ToneMapOperator toneMapOperator) {
+    const PacketFloat zero=packetBroadcast(0.0f), one=packetBroadcast(1.0f);
+    PacketFloat mapped=packetSelect(packetLess(zero, values), values, zero);
+    if (toneMapOperator==ToneMapOperator::Reinhard) {
+        mapped=mapped/(mapped+one);
+    }
+    return packetSelect(packetLess(mapped, one), mapped, one);
+}
+float mapChannel(float value, ToneMapOperator toneMapOperator) {
+    float mapped=0.0f<value ? value : 0.0f;
+    if (toneMapOperator==ToneMapOperator::Reinhard) {
+        mapped=mapped/(mapped+1.0f);
+    }
+    return mapped<1.0f ? mapped : 1.0f;
+}
+
+/// Quantize channels in [0, 1], through the gamma table if there is one.
+SIMD_INLINE PacketInt quantizeChannels(const PacketFloat &mapped, const ToneMapper &toneMapper) {
+    if (!toneMapper.usesGammaTable()) {
+        return packetToInt(mapped*float(toneMapper.getMaxValue())+0.5f);
+    }
+    const PacketInt &indices=packetToInt(packetSqrt(mapped)*float(ToneMapper::gammaTableSize-1)+0.5f);
+    const int32_t *table=toneMapper.getGammaTable();
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=table[indices[lane]];
+    }
+    return result;
+}
+int32_t quantizeChannel(float mapped, const ToneMapper &toneMapper) {
+    if (!toneMapper.usesGammaTable()) {
+        return int32_t(mapped*float(toneMapper.getMaxValue())+0.5f);
+    }
+    return toneMapper.getGammaTable()[int32_t(sqrtf(mapped)*float(ToneMapper::gammaTableSize-1)+0.5f)];
+}
+
+}
+
+SIMD_DISPATCH
+void fillPixels(Color *pixels, size_t count, const Color &color) {
+    // The channels of SIMD_WIDTH pixels, R G B R G B..., spread over three packets.
+    const int32_t channels[3]={color.R, color.G, color.B};
+    PacketInt pattern[3];
+    for (int i=0; i<3*SIMD_WIDTH; ++i) {
+        pattern[i/SIMD_WIDTH][i%SIMD_WIDTH]=channels[i%3];
+    }
+    int32_t *values=reinterpret_cast<int32_t *>(pixels);
+    size_t j=0;
+    for (; j+SIMD_WIDTH<=count; j+=SIMD_WIDTH) {
+        packetStore(values+3*j, pattern[0]);
+        packetStore(values+3*j+SIMD_WIDTH, pattern[1]);
+        packetStore(values+3*j+2*SIMD_WIDTH, pattern[2]);
+    }
+    for (; j<count; ++j) {
+        pixels[j]=color;
+    }
+}
+
+SIMD_DISPATCH
+void quantizePixels(const Color *pixels, size_t count, int maxValue, uint8_t *bytes) {
+    const int32_t *values=reinterpret_cast<const int32_t *>(pixels);
+    size_t j=0;
+    for (; j+SIMD_WIDTH<=count; j+=SIMD_WIDTH) {
+        for (int part=0; part<3; ++part) {
+            const PacketInt &channels=packetLoad(values+3*j+part*SIMD_WIDTH);
+            packetStoreBytes(bytes+3*j+part*SIMD_WIDTH, packetClamp(channels, 0, maxValue));
+        }
+    }
+    for (; j<count; ++j) {
+        bytes[3*j]=uint8_t(clamp(pixels[j].R, 0, maxValue));
+        bytes[3*j+1]=uint8_t(clamp(pixels[j].G, 0, maxValue));
+        bytes[3*j+2]=uint8_t(clamp(pixels[j].B, 0, maxValue));
+    }
+}
+
+SIMD_DISPATCH
+void resolvePixels(const AccumulatedColor *sums, size_t count, const ToneMapper &toneMapper, Color *pixels) {
+    const ToneMapping &toneMapping=toneMapper.getToneMapping();
+    const PacketFloat zero=packetBroadcast(0.0f);
+    size_t j=0;
+    for (; j+SIMD_WIDTH<=count; j+=SIMD_WIDTH) {
+        // Transpose the pixels into an array per channel, then load each of them as a packet.
+        alignas(PacketFloat) float transposed[4][SIMD_WIDTH];
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+            transposed[0][lane]=sums[j+lane].R;
+            transposed[1][lane]=sums[j+lane].G;
+            transposed[2][lane]=sums[j+lane].B;
+            transposed[3][lane]=sums[j+lane].weight;
+        }
+        const PacketFloat channels[3]={packetLoad(transposed[0]), packetLoad(transposed[1]), packetLoad(transposed[2])};
+        const PacketFloat weights=packetLoad(transposed[3]);
+        const PacketInt &hasSamples=packetLess(zero, weights);
+        const PacketFloat &scales=packetSelect(hasSamples, toneMapping.exposure/packetSelect(hasSamples, weights, packetBroadcast(1.0f)), zero);
+        PacketInt quantized[3];
+        for (int channel=0; channel<3; ++channel) {
+            quantized[channel]=quantizeChannels(mapChannels(channels[channel]*scales, toneMapping.toneMapOperator), toneMapper);
+        }
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+            pixels[j+lane]=Color(quantized[0][lane], quantized[1][lane], quantized[2][lane]);
+        }
+    }
+    // The pixels that don't fill a whole packet, with the same operations as the lanes.
+    for (; j<count; ++j) {
+        const AccumulatedColor &sum=sums[j];
+        const float scale=0.0f<sum.weight ? toneMapping.exposure/sum.weight : 0.0f;
+        pixels[j]=Color(
+            quantizeChannel(mapChannel(sum.R*scale, toneMapping.toneMapOperator), toneMapper),
+            quantizeChannel(mapChannel(sum.G*scale, toneMapping.toneMapOperator), toneMapper),
+            quantizeChannel(mapChannel(sum.B*scale, toneMapping.toneMapOperator), toneMapper)
+        );
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "accumulation.h"
+#include "color.h"
+
+/// Wide kernels over runs of pixels. A Color is three 32-bit channels, so SIMD_WIDTH pixels are exactly
+/// three packets, and these kernels move whole packets instead of single channels.
+/// The channels are kept as they are while drawing - the Color arithmetic doesn't saturate - and they are clamped
+/// and quantized once, when the image is encoded.
+
+/// Set count consecutive pixels to a color, with wide stores.
+void fillPixels(Color *pixels, size_t count, const Color &color);
+/// Clamp the channels of count consecutive pixels to [0, maxValue] and write them as bytes, R G B per pixel.
+void quantizePixels(const Color *pixels, size_t count, int maxValue, uint8_t *bytes);
+/// Average the samples of count consecutive pixels, tone map them and quantize them to [0, maxValue] of the tone mapper.
+/// Pixels without samples become black.
+void resolvePixels(const AccumulatedColor *sums, size_t count, const ToneMapper &toneMapper, Color *pixels);
+
+#endif
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "preview.h"
+
+namespace {
+
+const uint32_t previewVersion=1;
+
+/// Fill in everything about a frame but its sequence.
+void fillHeader(PreviewFrameHeader &header, size_t width, size_t height, size_t rowBytes, int maxValue, const PreviewPass &pass) {
+    memcpy(header.magic, "CRTP", 4);
+    header.version=previewVersion;
+    header.width=uint32_t(width);
+    header.height=uint32_t(height);
+    header.rowBytes=uint32_t(rowBytes);
+    header.pixelOffset=uint32_t(previewHeaderSize);
+    header.pixelFormat=PreviewPixelFormat::RGBInt32;
+    header.maxValue=maxValue;
+    header.pass=pass.index;
+    header.blockSize=pass.blockSize;
+    header.nanoseconds=pass.nanoseconds;
+}
+
+/// Write all buffers, continuing after partial writes. Returns false on an error, e.g. when the reader went away.
+bool writeAll(int descriptor, std::vector<iovec> &buffers) {
+    size_t first=0;
+    while (first<buffers.size()) {
+        const int count=int(std::min<size_t>(buffers.size()-first, IOV_MAX));
+        const ssize_t written=writev(descriptor, &buffers[first], count);
+        if (written<0) {
+            if (errno==EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // Skip the buffers that were written completely and move into the one that was written partly.
+        size_t remaining=size_t(written);
+        while (first<buffers.size() && remaining>=buffers[first].iov_len) {
+            remaining-=buffers[first].iov_len;
+            ++first;
+        }
+        if (first<buffers.size()) {
+            buffers[first].iov_base=static_cast<char *>(buffers[first].iov_base)+remaining;
+            buffers[first].iov_len-=remaining;
+        }
+    }
+    return true;
+}
+
+/// writeAll(..) with SIGPIPE blocked for the calling thread, so a reader that went away gives false with EPIPE
+/// instead of ending the process. The disposition of the signal for the rest of the process is left alone.
+bool writeAllWithoutSignal(int descriptor, std::vector<iovec> &buffers) {
+    sigset_t pipeSignal, pending, previousMask;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    sigpending(&pending);
+    const bool wasPending=sigismember(&pending, SIGPIPE)==1;
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+    const bool isWritten=writeAll(descriptor, buffers);
+    const int writeError=errno;
+    // The failed write raised a SIGPIPE of its own, which has to be taken before the signal is unblocked.
+    if (!isWritten && writeError==EPIPE && !wasPending) {
+        const timespec noWait={0, 0};
+        while (sigtimedwait(&pipeSignal, nullptr, &noWait)<0 && errno==EINTR) {}
+    }
+    pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+    errno=writeError;
+    return isWritten;
+}
+
+}
+
+// SharedMemoryPublisher.
+SharedMemoryPublisher::~SharedMemoryPublisher() {
+    if (mapping!=nullptr) {
+        munmap(mapping, mappingSize);
+    }
+    if (descriptor>=0) {
+        close(descriptor);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool SharedMemoryPublisher::open(const std::string &newName, size_t newWidth, size_t newHeight) {
+    if (descriptor>=0) {
+        printf("The shared memory is already open.\n");
+        return false;
+    }
+    const size_t size=previewHeaderSize+FrameBuffer<Color>::computeStride(newWidth)*newHeight*sizeof(Color);
+    const int newDescriptor=shm_open(newName.c_str(), O_CREAT|O_RDWR, 0600);
+    if (newDescriptor<0) {
+        printf("Couldn't create the shared memory %s: %s.\n", newName.c_str(), strerror(errno));
+        return false;
+    }
+    void *newMapping=MAP_FAILED;
+    if (ftruncate(newDescriptor, off_t(size))==0) {
+        newMapping=mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, newDescriptor, 0);
+    }
+    if (newMapping==MAP_FAILED) {
+        printf("Couldn't map the shared memory %s: %s.\n", newName.c_str(), strerror(errno));
+        close(newDescriptor);
+        shm_unlink(newName.c_str());
+        return false;
+    }
+    name=newName;
+    descriptor=newDescriptor;
+    mapping=newMapping;
+    mappingSize=size;
+    width=newWidth;
+    height=newHeight;
+    // The sequence goes on from what an earlier renderer left behind, so a viewer never sees it go back.
+    sequence=(getHeader()->sequence+1)&~uint64_t(1);
+    return true;
+}
+
+FrameBuffer<Color> SharedMemoryPublisher::createFrameBuffer() {
+    if (mapping==nullptr) {
+        return FrameBuffer<Color>();
+    }
+    return FrameBuffer<Color>(getPixels(), width, height);
+}
+
+void SharedMemoryPublisher::beginPass(const PreviewPass &) {
+    if (mapping==nullptr) {
+        return;
+    }
+    // Odd - the pixels are about to change.
+    sequence|=1;
+    __atomic_store_n(&getHeader()->sequence, sequence, __ATOMIC_RELEASE);
+}
+
+bool SharedMemoryPublisher::publish(const FrameBuffer<Color> &pixels, int maxValue, const PreviewPass &pass) {
+    if (mapping==nullptr) {
+        printf("The shared memory isn't open.\n");
+        return false;
+    }
+    if (pixels.getWidth()!=width || pixels.getHeight()!=height) {
+        printf("The frame buffer resolution doesn't match the shared memory.\n");
+        return false;
+    }
+    PreviewFrameHeader &header=*getHeader();
+    if ((sequence&1)==0) {
+        sequence|=1;
+        __atomic_store_n(&header.sequence, sequence, __ATOMIC_RELEASE);
+    }
+    // Only a buffer drawn somewhere else has to be copied in.
+    const size_t stride=FrameBuffer<Color>::computeStride(width);
+    if (pixels.getData()!=getPixels()) {
+        for (size_t i=0; i<height; ++i) {
+            memcpy(getPixels()+i*stride, pixels.row(i), width*sizeof(Color));
+        }
+    }
+    fillHeader(header, width, height, stride*sizeof(Color), maxValue, pass);
+    // Even - the pass is complete. The release store makes the pixels visible before the sequence.
+    ++sequence;
+    __atomic_store_n(&header.sequence, sequence, __ATOMIC_RELEASE);
+    return true;
+}
+
+// PipePublisher.
+PipePublisher::~PipePublisher() {
+    if (descriptor>=0) {
+        close(descriptor);
+    }
+}
+
+bool PipePublisher::open(const std::string &path) {
+    if (descriptor>=0) {
+        printf("The pipe is already open.\n");
+        return false;
+    }
+    // The FIFO has to exist already - a missing one isn't replaced by a regular file nobody reads.
+    struct stat status;
+    if (stat(path.c_str(), &status)!=0) {
+        printf("Couldn't find %s: %s.\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!S_ISFIFO(status.st_mode)) {
+        printf("%s isn't a FIFO - create it with mkfifo.\n", path.c_str());
+        return false;
+    }
+    // This blocks until a viewer opens the FIFO for reading.
+    descriptor=::open(path.c_str(), O_WRONLY);
+    if (descriptor<0) {
+        printf("Couldn't open %s: %s.\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    // The path could have been replaced between the check and the open.
+    if (fstat(descriptor, &status)!=0 || !S_ISFIFO(status.st_mode)) {
+        printf("%s isn't a FIFO - create it with mkfifo.\n", path.c_str());
+        close(descriptor);
+        descriptor=-1;
+        return false;
+    }
+    return true;
+}
+
+bool PipePublisher::publish(const FrameBuffer<Color> &pixels, int maxValue, const PreviewPass &pass) {
+    if (descriptor<0) {
+        printf("The pipe isn't open.\n");
+        return false;
+    }
+    const size_t width=pixels.getWidth(), height=pixels.getHeight();
+    PreviewFrameHeader header;
+    char headerBytes[previewHeaderSize]={};
+    fillHeader(header, width, height, width*sizeof(Color), maxValue, pass);
+    sequence+=2;
+    header.sequence=sequence;
+    memcpy(headerBytes, &header, sizeof(header));
+    // The rows go out straight from the frame buffer, without their padding.
+    std::vector<iovec> buffers;
+    buffers.reserve(height+1);
+    buffers.push_back(iovec{headerBytes, previewHeaderSize});
+    if (pixels.getStride()==width) {
+        buffers.push_back(iovec{const_cast<Color *>(pixels.getData()), width*height*sizeof(Color)});
+    } else {
+        for (size_t i=0; i<height; ++i) {
+            buffers.push_back(iovec{const_cast<Color *>(pixels.row(i)), width*sizeof(Color)});
+        }
+    }
+    // A viewer that goes away only stops the publishing, it doesn't end the renderer.
+    if (!writeAllWithoutSignal(descriptor, buffers)) {
+        printf("Couldn't write the frame to the pipe: %s.\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<FramePublisher> createFramePublisher(const std::string &description, size_t width, size_t height) {
+    if (description.compare(0, 4, "shm:")==0) {
+        std::unique_ptr<SharedMemoryPublisher> publisher=std::make_unique<SharedMemoryPublisher>();
+        if (!publisher->open(description.substr(4), width, height)) {
+            return nullptr;
+        }
+        return publisher;
+    }
+    if (description.compare(0, 5, "pipe:")==0) {
+        std::unique_ptr<PipePublisher> publisher=std::make_unique<PipePublisher>();
+        if (!publisher->open(description.substr(5))) {
+            return nullptr;
+        }
+        return publisher;
+    }
+    printf("Unknown preview output %s - use shm:/name or pipe:path.\n", description.c_str());
+    return nullptr;
+}
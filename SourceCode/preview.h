@@ -0,0 +1,135 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "color.h"
+#include "framebuffer.h"
+
+/// Publishing the passes of a progressive render to a viewer running next to the renderer.
+///
+/// Every frame is a PreviewFrameHeader followed by the pixels as they are in the frame buffer - three signed
+/// 32-bit channels per pixel in the byte order of the machine, rowBytes apart - so nothing is encoded on the way.
+/// In shared memory the header sits at the start of the mapping and the pixels start pixelOffset bytes in.
+/// The renderer draws right into the mapping, and the sequence works as a lock: it is odd while a pass is
+/// being drawn and even once it is complete, so a viewer copies the pixels and keeps them if the sequence
+/// was the same even number before and after. On a pipe every frame is the header and then the pixels
+/// of the rows without padding, pass after pass.
+
+/// The format of the published pixels.
+enum class PreviewPixelFormat : uint32_t {
+    /// Color - R, G and B as int32_t in [0, maxValue].
+    RGBInt32=0
+};
+
+/// The header of a published frame.
+struct PreviewFrameHeader {
+    /// "CRTP".
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    /// The distance between two rows, in bytes.
+    uint32_t rowBytes;
+    /// Where the pixels start, from the start of the header.
+    uint32_t pixelOffset;
+    PreviewPixelFormat pixelFormat;
+    int32_t maxValue;
+    /// The pass, counting from 0, and the side of the blocks it filled - 1 in the last, full resolution pass.
+    uint32_t pass;
+    uint32_t blockSize;
+    /// Odd while a pass is drawn into shared memory, even once it is published. It only grows.
+    uint64_t sequence;
+    /// When the pass was published, from the start of the render.
+    uint64_t nanoseconds;
+};
+
+/// The header is padded to a whole alignment, so the pixels after it stay aligned.
+const size_t previewHeaderSize=(sizeof(PreviewFrameHeader)+frameBufferAlignment-1)/frameBufferAlignment*frameBufferAlignment;
+
+/// A pass of a progressive render, as the publishers see it.
+struct PreviewPass {
+    uint32_t index=0;
+    uint32_t blockSize=1;
+    /// From the start of the render.
+    uint64_t nanoseconds=0;
+};
+
+/// Sends the passes of a progressive render somewhere a viewer can see them.
+class FramePublisher {
+public:
+    virtual ~FramePublisher() {}
+
+    /// A frame buffer to draw into, so that publishing doesn't need to copy the pixels, or an empty one if the
+    /// publisher has none. It must not outlive the publisher.
+    virtual FrameBuffer<Color> createFrameBuffer() {
+        return FrameBuffer<Color>();
+    }
+    /// Called before a pass starts drawing into the pixels.
+    virtual void beginPass(const PreviewPass &) {}
+    /// Publish the pixels after a pass. Returns false if they couldn't be published.
+    virtual bool publish(const FrameBuffer<Color> &pixels, int maxValue, const PreviewPass &pass)=0;
+};
+
+/// Publishes the passes through a POSIX shared memory object. The drawer should draw into the buffer from
+/// createFrameBuffer(), which lives in the shared memory itself, so publishing a pass only updates the header.
+/// Other buffers are copied in.
+class SharedMemoryPublisher : public FramePublisher {
+private:
+    std::string name;
+    int descriptor;
+    void *mapping;
+    size_t mappingSize;
+    size_t width, height;
+    uint64_t sequence;
+
+    PreviewFrameHeader *getHeader() const {
+        return static_cast<PreviewFrameHeader *>(mapping);
+    }
+    Color *getPixels() const {
+        return reinterpret_cast<Color *>(static_cast<char *>(mapping)+previewHeaderSize);
+    }
+public:
+    /// Constructors.
+    SharedMemoryPublisher() : descriptor(-1), mapping(nullptr), mappingSize(0), width(0), height(0), sequence(0) {}
+    SharedMemoryPublisher(const SharedMemoryPublisher &)=delete;
+    SharedMemoryPublisher &operator=(const SharedMemoryPublisher &)=delete;
+    /// Unmaps and removes the shared memory object. A viewer that has it mapped keeps the last frame.
+    ~SharedMemoryPublisher();
+
+    /// Create the shared memory object, e.g. "/crt_preview", with room for an image of the given resolution.
+    /// Returns false if it couldn't be created.
+    bool open(const std::string &newName, size_t newWidth, size_t newHeight);
+
+    /// A frame buffer over the pixels in the shared memory.
+    FrameBuffer<Color> createFrameBuffer() override;
+    void beginPass(const PreviewPass &pass) override;
+    bool publish(const FrameBuffer<Color> &pixels, int maxValue, const PreviewPass &pass) override;
+};
+
+/// Publishes the passes as a stream of frames to a pipe, a FIFO or a file.
+class PipePublisher : public FramePublisher {
+private:
+    int descriptor;
+    uint64_t sequence;
+public:
+    /// Constructors.
+    PipePublisher() : descriptor(-1), sequence(0) {}
+    PipePublisher(const PipePublisher &)=delete;
+    PipePublisher &operator=(const PipePublisher &)=delete;
+    ~PipePublisher();
+
+    /// Open an existing FIFO a viewer reads the frames from, e.g. one made with mkfifo. Blocks until a viewer opens it.
+    /// Returns false if the path isn't a FIFO or couldn't be opened.
+    bool open(const std::string &path);
+
+    bool publish(const FrameBuffer<Color> &pixels, int maxValue, const PreviewPass &pass) override;
+};
+
+/// Create a publisher from a description - "shm:/name" for shared memory or "pipe:path" for a pipe.
+/// Returns nullptr with a message if the description is wrong or the publisher couldn't be opened.
+std::unique_ptr<FramePublisher> createFramePublisher(const std::string &description, size_t width, size_t height);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+#include "profiler.h"
+
+namespace {
+
+const char *stageNames[]={
+    "None", "SceneLoad", "BVHBuild", "MeshProcessing", "Fill", "Render", "RayGeneration", "RaySort", "Intersection", "Shading", "Resolve", "Encode", "Write"
+};
+const char *counterNames[]={
+    "raysGenerated", "nodesVisited", "boxTests", "triangleTests", "pixelsWritten", "bytesOutput"
+};
+static_assert(sizeof(stageNames)/sizeof(stageNames[0])==size_t(ProfileStage::Count), "Every stage needs a name.");
+static_assert(sizeof(counterNames)/sizeof(counterNames[0])==size_t(ProfileCounter::Count), "Every counter needs a name.");
+
+double toMilliseconds(uint64_t nanoseconds) {
+    return double(nanoseconds)/1e6;
+}
+
+double toMicroseconds(uint64_t nanoseconds) {
+    return double(nanoseconds)/1e3;
+}
+
+}
+
+const char *getProfileStageName(ProfileStage stage) {
+    return stageNames[size_t(stage)];
+}
+
+const char *getProfileCounterName(ProfileCounter counter) {
+    return counterNames[size_t(counter)];
+}
+
+// Profiler.
+thread_local Profiler::ThreadProfile *Profiler::currentThreadProfile=nullptr;
+
+Profiler::ThreadProfile::ThreadProfile(size_t newThreadIndex) : threadIndex(newThreadIndex) {
+    clear();
+}
+
+void Profiler::ThreadProfile::clear() {
+    for (std::atomic<uint64_t> &counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    std::fill(stageCalls, stageCalls+size_t(ProfileStage::Count), 0);
+    std::fill(stageWallNanoseconds, stageWallNanoseconds+size_t(ProfileStage::Count), 0);
+    std::fill(stageCpuNanoseconds, stageCpuNanoseconds+size_t(ProfileStage::Count), 0);
+    events.clear();
+    tileEvents.clear();
+    currentStage=ProfileStage::None;
+}
+
+Profiler::Profiler() : isEnabledFlag(false), startNanoseconds(getWallNanoseconds()) {}
+
+Profiler &Profiler::getInstance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+uint64_t Profiler::getWallNanoseconds() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t Profiler::getThreadCpuNanoseconds() {
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time)!=0) {
+        return 0;
+    }
+    return uint64_t(time.tv_sec)*1000000000ull+uint64_t(time.tv_nsec);
+}
+
+Profiler::ThreadProfile &Profiler::getThreadProfile() {
+    if (!currentThreadProfile) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threadProfiles.push_back(std::make_unique<ThreadProfile>(threadProfiles.size()));
+        currentThreadProfile=threadProfiles.back().get();
+    }
+    return *currentThreadProfile;
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<ThreadProfile> &threadProfile : threadProfiles) {
+        threadProfile->clear();
+    }
+    tileRuns.clear();
+    startNanoseconds=getWallNanoseconds();
+}
+
+void Profiler::addStageTime(ProfileStage stage, uint64_t wallNanoseconds) {
+    ThreadProfile &threadProfile=getThreadProfile();
+    ++threadProfile.stageCalls[size_t(stage)];
+    threadProfile.stageWallNanoseconds[size_t(stage)]+=wallNanoseconds;
+}
+
+void Profiler::recordStage(ProfileStage stage, uint64_t startWallNanoseconds, uint64_t wallNanoseconds, uint64_t cpuNanoseconds) {
+    ThreadProfile &threadProfile=getThreadProfile();
+    ++threadProfile.stageCalls[size_t(stage)];
+    threadProfile.stageWallNanoseconds[size_t(stage)]+=wallNanoseconds;
+    threadProfile.stageCpuNanoseconds[size_t(stage)]+=cpuNanoseconds;
+    threadProfile.events.push_back(Event{stage, startWallNanoseconds, wallNanoseconds});
+}
+
+ProfileStage Profiler::enterStage(ProfileStage stage) {
+    ThreadProfile &threadProfile=getThreadProfile();
+    const ProfileStage previousStage=threadProfile.currentStage;
+    threadProfile.currentStage=stage;
+    return previousStage;
+}
+
+void Profiler::leaveStage(ProfileStage previousStage) {
+    getThreadProfile().currentStage=previousStage;
+}
+
+size_t Profiler::beginTileRun(size_t fromX, size_t fromY, size_t width, size_t height, size_t tileSize) {
+    const ProfileStage stage=getThreadProfile().currentStage;
+    std::lock_guard<std::mutex> lock(mutex);
+    tileRuns.push_back(TileRun{stage, fromX, fromY, width, height, tileSize});
+    return tileRuns.size()-1;
+}
+
+void Profiler::recordTile(size_t runIndex, const Tile &tile, uint64_t startWallNanoseconds, uint64_t wallNanoseconds) {
+    getThreadProfile().tileEvents.push_back(TileEvent{runIndex, tile, startWallNanoseconds, wallNanoseconds});
+}
+
+bool Profiler::writeJson(const std::string &filePath) {
+    FILE *file=fopen(filePath.c_str(), "w");
+    if (!file) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(file, "{\n");
+    fprintf(file, "  \"wallMilliseconds\": %.3f,\n", toMilliseconds(getWallNanoseconds()-startNanoseconds));
+
+    // The stages, summed over all threads.
+    fprintf(file, "  \"stages\": {");
+    bool isFirst=true;
+    for (size_t stage=1; stage<size_t(ProfileStage::Count); ++stage) {
+        uint64_t calls=0, wallNanoseconds=0, cpuNanoseconds=0;
+        for (const std::unique_ptr<ThreadProfile> &threadProfile : threadProfiles) {
+            calls+=threadProfile->stageCalls[stage];
+            wallNanoseconds+=threadProfile->stageWallNanoseconds[stage];
+            cpuNanoseconds+=threadProfile->stageCpuNanoseconds[stage];
+        }
+        if (calls==0) {
+            continue;
+        }
+        fprintf(file, "%s\n    \"%s\": {\"calls\": %llu, \"wallMilliseconds\": %.3f, \"cpuMilliseconds\": %.3f}",
+                isFirst ? "" : ",", stageNames[stage], (unsigned long long)calls,
+                toMilliseconds(wallNanoseconds), toMilliseconds(cpuNanoseconds));
+        isFirst=false;
+    }
+    fprintf(file, "\n  },\n");
+
+    // The counters, in total and per thread.
+    uint64_t totals[size_t(ProfileCounter::Count)]={};
+    for (const std::unique_ptr<ThreadProfile> &threadProfile : threadProfiles) {
+        for (size_t counter=0; counter<size_t(ProfileCounter::Count); ++counter) {
+            totals[counter]+=threadProfile->counters[counter].load(std::memory_order_relaxed);
+        }
+    }
+    fprintf(file, "  \"counters\": {");
+    for (size_t counter=0; counter<size_t(ProfileCounter::Count); ++counter) {
+        fprintf(file, "%s\"%s\": %llu", counter==0 ? "" : ", ", counterNames[counter], (unsigned long long)totals[counter]);
+    }
+    fprintf(file, "},\n");
+    fprintf(file, "  \"threads\": [");
+    for (size_t i=0; i<threadProfiles.size(); ++i) {
+        const ThreadProfile &threadProfile=*threadProfiles[i];
+        uint64_t tileNanoseconds=0;
+        for (const TileEvent &tileEvent : threadProfile.tileEvents) {
+            tileNanoseconds+=tileEvent.durationNanoseconds;
+        }
+        fprintf(file, "%s\n    {\"thread\": %zu, \"tiles\": %zu, \"tileMilliseconds\": %.3f, \"counters\": {",
+                i==0 ? "" : ",", threadProfile.threadIndex, threadProfile.tileEvents.size(), toMilliseconds(tileNanoseconds));
+        for (size_t counter=0; counter<size_t(ProfileCounter::Count); ++counter) {
+            fprintf(file, "%s\"%s\": %llu", counter==0 ? "" : ", ", counterNames[counter],
+                    (unsigned long long)threadProfile.counters[counter].load(std::memory_order_relaxed));
+        }
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n  ],\n");
+
+    // A grid of tile times and of the threads that processed them, for every run.
+    fprintf(file, "  \"tileRuns\": [");
+    for (size_t runIndex=0; runIndex<tileRuns.size(); ++runIndex) {
+        const TileRun &run=tileRuns[runIndex];
+        const size_t columns=(run.width+run.tileSize-1)/run.tileSize;
+        const size_t rows=(run.height+run.tileSize-1)/run.tileSize;
+        std::vector<double> microseconds(columns*rows, 0.0);
+        std::vector<int> threads(columns*rows, -1);
+        for (const std::unique_ptr<ThreadProfile> &threadProfile : threadProfiles) {
+            for (const TileEvent &tileEvent : threadProfile->tileEvents) {
+                if (tileEvent.runIndex!=runIndex) {
+                    continue;
+                }
+                const size_t cell=(tileEvent.tile.fromY-run.fromY)/run.tileSize*columns
+                    +(tileEvent.tile.fromX-run.fromX)/run.tileSize;
+                microseconds[cell]=toMicroseconds(tileEvent.durationNanoseconds);
+                threads[cell]=int(threadProfile->threadIndex);
+            }
+        }
+        fprintf(file, "%s\n    {\"stage\": \"%s\", \"fromX\": %zu, \"fromY\": %zu, \"width\": %zu, \"height\": %zu, \"tileSize\": %zu,",
+                runIndex==0 ? "" : ",", stageNames[size_t(run.stage)], run.fromX, run.fromY, run.width, run.height, run.tileSize);
+        fprintf(file, "\n     \"microseconds\": [");
+        for (size_t row=0; row<rows; ++row) {
+            fprintf(file, "%s[", row==0 ? "" : ", ");
+            for (size_t column=0; column<columns; ++column) {
+                fprintf(file, "%s%.1f", column==0 ? "" : ", ", microseconds[row*columns+column]);
+            }
+            fprintf(file, "]");
+        }
+        fprintf(file, "],\n     \"threads\": [");
+        for (size_t row=0; row<rows; ++row) {
+            fprintf(file, "%s[", row==0 ? "" : ", ");
+            for (size_t column=0; column<columns; ++column) {
+                fprintf(file, "%s%d", column==0 ? "" : ", ", threads[row*columns+column]);
+            }
+            fprintf(file, "]");
+        }
+        fprintf(file, "]}");
+    }
+    fprintf(file, "\n  ]\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
+bool Profiler::writeChromeTrace(const std::string &filePath) {
+    FILE *file=fopen(filePath.c_str(), "w");
+    if (!file) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool isFirst=true;
+    for (const std::unique_ptr<ThreadProfile> &threadProfile : threadProfiles) {
+        fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"thread %zu\"}}",
+                isFirst ? "" : ",", threadProfile->threadIndex, threadProfile->threadIndex);
+        isFirst=false;
+        for (const Event &event : threadProfile->events) {
+            fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f}",
+                    stageNames[size_t(event.stage)], threadProfile->threadIndex,
+                    toMicroseconds(event.startNanoseconds-startNanoseconds), toMicroseconds(event.durationNanoseconds));
+        }
+        for (const TileEvent &tileEvent : threadProfile->tileEvents) {
+            fprintf(file, ",\n{\"name\": \"tile\", \"cat\": \"tile\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f, "
+                    "\"args\": {\"run\": %zu, \"x\": %zu, \"y\": %zu, \"width\": %zu, \"height\": %zu}}",
+                    threadProfile->threadIndex, toMicroseconds(tileEvent.startNanoseconds-startNanoseconds),
+                    toMicroseconds(tileEvent.durationNanoseconds), tileEvent.runIndex,
+                    tileEvent.tile.fromX, tileEvent.tile.fromY, tileEvent.tile.width, tileEvent.tile.height);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+// ProfileScope.
+ProfileScope::ProfileScope(ProfileStage newStage)
+    : stage(newStage)
+    , previousStage(ProfileStage::None)
+    , startWallNanoseconds(0)
+    , startCpuNanoseconds(0) {
+    Profiler &profiler=Profiler::getInstance();
+    if (!profiler.isEnabled()) {
+        return;
+    }
+    previousStage=profiler.enterStage(stage);
+    startCpuNanoseconds=Profiler::getThreadCpuNanoseconds();
+    startWallNanoseconds=Profiler::getWallNanoseconds();
+}
+
+ProfileScope::~ProfileScope() {
+    if (startWallNanoseconds==0) {
+        return;
+    }
+    const uint64_t wallNanoseconds=Profiler::getWallNanoseconds()-startWallNanoseconds;
+    const uint64_t cpuNanoseconds=Profiler::getThreadCpuNanoseconds()-startCpuNanoseconds;
+    Profiler &profiler=Profiler::getInstance();
+    profiler.recordStage(stage, startWallNanoseconds, wallNanoseconds, cpuNanoseconds);
+    profiler.leaveStage(previousStage);
+}
@@ -0,0 +1,208 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "scheduler.h"
+
+/// The stages of a render the profiler keeps the time of.
+enum class ProfileStage {
+    None,
+    SceneLoad,
+    BVHBuild,
+    /// Computing the normals, areas and bounds of the triangles and vertices of a mesh.
+    MeshProcessing,
+    /// Filling the image with backgrounds and shapes.
+    Fill,
+    /// Tracing the rays of an image. Contains RayGeneration and Shading, and in the wavefront mode RaySort and Intersection.
+    Render,
+    RayGeneration,
+    /// Reordering the rays of a wavefront for coherence.
+    RaySort,
+    /// Tracing the rays of a wavefront through the BVH. The per-pixel path counts this as Shading.
+    Intersection,
+    Shading,
+    /// Averaging, tone mapping and quantizing accumulated samples into pixels.
+    Resolve,
+    /// Turning pixels into file bytes.
+    Encode,
+    /// Writing the bytes to the file.
+    Write,
+    Count
+};
+
+/// The work the profiler counts, per thread.
+enum class ProfileCounter {
+    RaysGenerated,
+    NodesVisited,
+    BoxTests,
+    TriangleTests,
+    PixelsWritten,
+    BytesOutput,
+    Count
+};
+
+/// The name of a stage or counter in the output files.
+const char *getProfileStageName(ProfileStage stage);
+const char *getProfileCounterName(ProfileCounter counter);
+
+/// Collects the timings and the counters of a render. Each thread records into its own buffers,
+/// so recording takes no locks. The buffers are only aggregated when writing the results, which
+/// must happen once the recording threads are idle, e.g. after the render.
+/// Recording only happens while the profiler is enabled. Building with NO_PROFILING removes the
+/// PROFILE_* macros from the hot paths altogether.
+class Profiler {
+private:
+    /// A timed piece of work of a thread, for the trace.
+    struct Event {
+        ProfileStage stage;
+        uint64_t startNanoseconds;
+        uint64_t durationNanoseconds;
+    };
+    /// A tile processed by a thread.
+    struct TileEvent {
+        size_t runIndex;
+        Tile tile;
+        uint64_t startNanoseconds;
+        uint64_t durationNanoseconds;
+    };
+    /// Everything a single thread recorded. Only the owning thread writes to it.
+    struct ThreadProfile {
+        size_t threadIndex;
+        std::atomic<uint64_t> counters[size_t(ProfileCounter::Count)];
+        uint64_t stageCalls[size_t(ProfileStage::Count)];
+        uint64_t stageWallNanoseconds[size_t(ProfileStage::Count)];
+        uint64_t stageCpuNanoseconds[size_t(ProfileStage::Count)];
+        std::vector<Event> events;
+        std::vector<TileEvent> tileEvents;
+        /// The innermost stage the thread is in.
+        ProfileStage currentStage;
+
+        explicit ThreadProfile(size_t newThreadIndex);
+        void clear();
+    };
+    /// A scheduler run whose tiles were timed.
+    struct TileRun {
+        ProfileStage stage;
+        size_t fromX, fromY, width, height, tileSize;
+    };
+
+    std::atomic<bool> isEnabledFlag;
+    /// The time everything is measured from.
+    uint64_t startNanoseconds;
+    /// The profiles of all threads that recorded anything. They live as long as the profiler.
+    std::vector<std::unique_ptr<ThreadProfile>> threadProfiles;
+    std::vector<TileRun> tileRuns;
+    std::mutex mutex;
+    /// The profile of the calling thread, once it recorded anything.
+    static thread_local ThreadProfile *currentThreadProfile;
+
+    Profiler();
+    /// The profile of the calling thread, created on its first use.
+    ThreadProfile &getThreadProfile();
+public:
+    Profiler(const Profiler &)=delete;
+    Profiler &operator=(const Profiler &)=delete;
+
+    /// The profiler shared by the whole program.
+    static Profiler &getInstance();
+    /// The time since an arbitrary fixed point, and the CPU time the calling thread used.
+    static uint64_t getWallNanoseconds();
+    static uint64_t getThreadCpuNanoseconds();
+
+    /// Start or stop recording. Enabling doesn't clear what was recorded before.
+    void changeEnabled(bool newIsEnabled) {
+        isEnabledFlag.store(newIsEnabled, std::memory_order_relaxed);
+    }
+    bool isEnabled() const {
+        return isEnabledFlag.load(std::memory_order_relaxed);
+    }
+    /// Forget everything recorded and restart the clock. The recording threads must be idle.
+    void reset();
+
+    /// Add to a counter of the calling thread.
+    void addCount(ProfileCounter counter, uint64_t count) {
+        std::atomic<uint64_t> &value=getThreadProfile().counters[size_t(counter)];
+        // Only the owning thread writes, so a plain load and store are enough and need no locked instruction.
+        value.store(value.load(std::memory_order_relaxed)+count, std::memory_order_relaxed);
+    }
+    /// Add time spent in a stage without a trace event, for work timed in many small pieces.
+    void addStageTime(ProfileStage stage, uint64_t wallNanoseconds);
+    /// Record a timed stage of the calling thread, with a trace event.
+    void recordStage(ProfileStage stage, uint64_t startWallNanoseconds, uint64_t wallNanoseconds, uint64_t cpuNanoseconds);
+    /// Make stage the current one of the calling thread, and return the previous one.
+    ProfileStage enterStage(ProfileStage stage);
+    void leaveStage(ProfileStage previousStage);
+    /// Start timing the tiles of a scheduler run. Returns the index to record its tiles with.
+    size_t beginTileRun(size_t fromX, size_t fromY, size_t width, size_t height, size_t tileSize);
+    /// Record a tile processed by the calling thread.
+    void recordTile(size_t runIndex, const Tile &tile, uint64_t startWallNanoseconds, uint64_t wallNanoseconds);
+
+    /// Write the stage times, the counters per thread and in total, and a heatmap of the tile times of every run.
+    bool writeJson(const std::string &filePath);
+    /// Write the stages and tiles of every thread in the Chrome trace event format,
+    /// which chrome://tracing and Perfetto can open.
+    bool writeChromeTrace(const std::string &filePath);
+};
+
+/// Times a stage from its construction to its destruction, if the profiler is enabled.
+class ProfileScope {
+private:
+    ProfileStage stage;
+    ProfileStage previousStage;
+    uint64_t startWallNanoseconds;
+    uint64_t startCpuNanoseconds;
+public:
+    /// Constructors.
+    explicit ProfileScope(ProfileStage newStage);
+    ProfileScope(const ProfileScope &)=delete;
+    ProfileScope &operator=(const ProfileScope &)=delete;
+    ~ProfileScope();
+};
+
+/// Adds the wall time from its construction to its destruction to a stage, without a trace event or CPU time.
+/// Cheap enough for work timed row by row.
+class ProfileTimer {
+private:
+    ProfileStage stage;
+    uint64_t startWallNanoseconds;
+public:
+    /// Constructors.
+    explicit ProfileTimer(ProfileStage newStage)
+        : stage(newStage)
+        , startWallNanoseconds(Profiler::getInstance().isEnabled() ? Profiler::getWallNanoseconds() : 0) {}
+    ProfileTimer(const ProfileTimer &)=delete;
+    ProfileTimer &operator=(const ProfileTimer &)=delete;
+    ~ProfileTimer() {
+        if (startWallNanoseconds!=0) {
+            Profiler::getInstance().addStageTime(stage, Profiler::getWallNanoseconds()-startWallNanoseconds);
+        }
+    }
+};
+
+#define PROFILE_CONCATENATE_INNER(first, second) first##second
+#define PROFILE_CONCATENATE(first, second) PROFILE_CONCATENATE_INNER(first, second)
+#ifndef NO_PROFILING
+/// Time the rest of the enclosing block as a stage.
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCATENATE(profileScope, __LINE__)(stage)
+/// Add the wall time of the rest of the enclosing block to a stage.
+#define PROFILE_TIMER(stage) ProfileTimer PROFILE_CONCATENATE(profileTimer, __LINE__)(stage)
+/// Add to a counter of the calling thread.
+#define PROFILE_COUNT(counter, count) \
+    do { \
+        if (Profiler::getInstance().isEnabled()) { \
+            Profiler::getInstance().addCount(counter, count); \
+        } \
+    } while (false)
+#else
+#define PROFILE_SCOPE(stage) do {} while (false)
+#define PROFILE_TIMER(stage) do {} while (false)
+#define PROFILE_COUNT(counter, count) do {} while (false)
+#endif
+
+#endif
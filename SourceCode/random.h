@@ -0,0 +1,56 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/// Counter-based random numbers. Every value is a hash of a seed, a pixel, a sample index and the number of
+/// values drawn before it, so there is no shared state: any pixel's numbers can be made in any thread, in any
+/// order, and the same seed always gives the same image. The hash is the SplitMix64 finalizer.
+
+/// Scramble the bits of a 64-bit number, so that neighbouring inputs give unrelated outputs.
+inline uint64_t mixBits(uint64_t value) {
+    value=(value^(value>>30))*0xbf58476d1ce4e5b9ull;
+    value=(value^(value>>27))*0x94d049bb133111ebull;
+    return value^(value>>31);
+}
+
+/// The random numbers of a single pixel and sample.
+class RandomStream {
+private:
+    /// The increments between the counters of consecutive values and samples - odd, so they never repeat.
+    static constexpr uint64_t valueStep=0x9e3779b97f4a7c15ull;
+    static constexpr uint64_t sampleStep=0xd1b54a32d192ed03ull;
+
+    uint64_t key;
+    uint64_t counter;
+public:
+    /// Constructor. Streams with different seeds, pixels or samples are independent.
+    RandomStream(uint64_t seed, uint32_t x=0, uint32_t y=0, uint32_t sample=0)
+        : key(mixBits(mixBits(mixBits(seed)^((uint64_t(y)<<32)|x))+sample*sampleStep))
+        , counter(0) {}
+
+    /// The next 32 random bits.
+    uint32_t nextUint() {
+        ++counter;
+        return uint32_t(mixBits(key+counter*valueStep)>>32);
+    }
+    /// A number in [0, bound), for a bound above 0, with every number equally likely. The high half of a
+    /// 32x32-bit product picks the number, and the rare draws that would favour some of them are drawn again
+    /// (Lemire's method), which needs no division unless the low half falls below the bound.
+    uint32_t nextBelow(uint32_t bound) {
+        uint64_t product=uint64_t(nextUint())*bound;
+        if (uint32_t(product)<bound) {
+            const uint32_t threshold=uint32_t(-bound)%bound;
+            while (uint32_t(product)<threshold) {
+                product=uint64_t(nextUint())*bound;
+            }
+        }
+        return uint32_t(product>>32);
+    }
+    /// A number in [0, 1).
+    float nextFloat() {
+        return float(nextUint()>>8)*(1.0f/16777216.0f);
+    }
+};
+
+#endif
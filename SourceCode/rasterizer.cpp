@@ -0,0 +1,131 @@
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "pixelkernels.h"
+#include "profiler.h"
+#include "rasterizer.h"
+
+namespace {
+
+/// The largest integer whose square is at most value.
+int64_t findIntegerSquareRoot(int64_t value) {
+    int64_t root=int64_t(sqrt(double(value)));
+    // The floating point root can be one off for large values.
+    while (root*root>value) {
+        --root;
+    }
+    while ((root+1)*(root+1)<=value) {
+        ++root;
+    }
+    return root;
+}
+
+}
+
+// Shape.
+Shape Shape::makeCircle(int newCenterX, int newCenterY, int newRadius, const Color &color) {
+    Shape shape=makeGradientCircle(newCenterX, newCenterY, newRadius, color, color);
+    shape.fill=ShapeFill::Solid;
+    return shape;
+}
+
+Shape Shape::makeGradientCircle(int newCenterX, int newCenterY, int newRadius, const Color &color1, const Color &color2) {
+    Shape shape;
+    shape.type=ShapeType::Circle;
+    shape.fill=ShapeFill::VerticalGradient;
+    shape.color1=color1;
+    shape.color2=color2;
+    shape.centerX=newCenterX;
+    shape.centerY=newCenterY;
+    shape.radius=newRadius;
+    return shape;
+}
+
+Shape Shape::makeRectangle(int newFromX, int newFromY, int newSizeX, int newSizeY, const Color &color) {
+    Shape shape=makeGradientRectangle(newFromX, newFromY, newSizeX, newSizeY, color, color);
+    shape.fill=ShapeFill::Solid;
+    return shape;
+}
+
+Shape Shape::makeGradientRectangle(int newFromX, int newFromY, int newSizeX, int newSizeY, const Color &color1, const Color &color2) {
+    Shape shape;
+    shape.type=ShapeType::Rectangle;
+    shape.fill=ShapeFill::VerticalGradient;
+    shape.color1=color1;
+    shape.color2=color2;
+    shape.fromX=newFromX;
+    shape.fromY=newFromY;
+    shape.sizeX=newSizeX;
+    shape.sizeY=newSizeY;
+    return shape;
+}
+
+void Shape::getBounds(int &minX, int &minY, int &maxX, int &maxY) const {
+    if (type==ShapeType::Circle) {
+        const int absoluteRadius=std::abs(radius);
+        minX=centerX-absoluteRadius;
+        minY=centerY-absoluteRadius;
+        maxX=centerX+absoluteRadius+1;
+        maxY=centerY+absoluteRadius+1;
+        return;
+    }
+    minX=fromX;
+    minY=fromY;
+    maxX=fromX+sizeX;
+    maxY=fromY+sizeY;
+}
+
+Span Shape::getSpan(int row) const {
+    if (type==ShapeType::Circle) {
+        // The pixels with (x-centerX)^2+(y-centerY)^2<=radius^2.
+        const int64_t offsetY=row-centerY;
+        const int64_t remaining=int64_t(radius)*radius-offsetY*offsetY;
+        if (remaining<0) {
+            return Span();
+        }
+        const int halfWidth=int(findIntegerSquareRoot(remaining));
+        return Span(centerX-halfWidth, centerX+halfWidth+1);
+    }
+    if (row<fromY || row>=fromY+sizeY) {
+        return Span();
+    }
+    return Span(fromX, fromX+sizeX);
+}
+
+// ShapeBatch.
+void ShapeBatch::rasterize(FrameBuffer<Color> &pixels, TileScheduler &scheduler) const {
+    PROFILE_SCOPE(ProfileStage::Fill);
+    const int width=int(pixels.getWidth());
+    const int height=int(pixels.getHeight());
+    // Only visit the rows the shapes can cover, in bands of whole rows.
+    int minX=width, minY=height, maxX=0, maxY=0;
+    for (const Shape &shape : shapes) {
+        int shapeMinX, shapeMinY, shapeMaxX, shapeMaxY;
+        shape.getBounds(shapeMinX, shapeMinY, shapeMaxX, shapeMaxY);
+        minX=std::min(minX, std::max(shapeMinX, 0));
+        minY=std::min(minY, std::max(shapeMinY, 0));
+        maxX=std::max(maxX, std::min(shapeMaxX, width));
+        maxY=std::max(maxY, std::min(shapeMaxY, height));
+    }
+    if (minX>=maxX || minY>=maxY) {
+        return;
+    }
+    scheduler.runRows(size_t(minY), size_t(maxY-minY), [&](size_t fromRow, size_t toRow) {
+        size_t pixelsWritten=0;
+        for (int i=int(fromRow); i<int(toRow); ++i) {
+            Color *row=pixels.row(i);
+            for (const Shape &shape : shapes) {
+                const Span &span=shape.getSpan(i).clip(minX, maxX);
+                if (span.isEmpty()) {
+                    continue;
+                }
+                // The color only changes from row to row.
+                const Color color=shape.getRowColor(i, pixels.getHeight());
+                fillPixels(row+span.fromX, size_t(span.toX-span.fromX), color);
+                pixelsWritten+=size_t(span.toX-span.fromX);
+            }
+        }
+        PROFILE_COUNT(ProfileCounter::PixelsWritten, pixelsWritten);
+    });
+}
@@ -0,0 +1,98 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <vector>
+
+#include "color.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+/// The pixels [fromX, toX) of a single row.
+struct Span {
+    int fromX, toX;
+
+    /// Constructors.
+    Span() : fromX(0), toX(0) {}
+    Span(int newFromX, int newToX) : fromX(newFromX), toX(newToX) {}
+
+    bool isEmpty() const {
+        return fromX>=toX;
+    }
+    /// The part of the span that is also in another span.
+    Span clip(int minX, int maxX) const {
+        return Span(fromX>minX ? fromX : minX, toX<maxX ? toX : maxX);
+    }
+};
+
+/// The kinds of shapes the rasterizer can fill.
+enum class ShapeType {
+    Circle,
+    Rectangle
+};
+
+/// How a shape is colored.
+enum class ShapeFill {
+    /// A single color.
+    Solid,
+    /// Going from the first color at the top of the image to the second at the bottom.
+    VerticalGradient
+};
+
+/// A filled shape. Its rows are found as a single span each, so filling it only touches the pixels it covers.
+struct Shape {
+    ShapeType type;
+    ShapeFill fill;
+    Color color1, color2;
+    /// The circle - its center and radius.
+    int centerX, centerY, radius;
+    /// The rectangle - its top left pixel and its size.
+    int fromX, fromY, sizeX, sizeY;
+
+    /// Constructors.
+    Shape()
+        : type(ShapeType::Rectangle)
+        , fill(ShapeFill::Solid)
+        , centerX(0)
+        , centerY(0)
+        , radius(0)
+        , fromX(0)
+        , fromY(0)
+        , sizeX(0)
+        , sizeY(0) {}
+    static Shape makeCircle(int newCenterX, int newCenterY, int newRadius, const Color &color);
+    static Shape makeGradientCircle(int newCenterX, int newCenterY, int newRadius, const Color &color1, const Color &color2);
+    static Shape makeRectangle(int newFromX, int newFromY, int newSizeX, int newSizeY, const Color &color);
+    static Shape makeGradientRectangle(int newFromX, int newFromY, int newSizeX, int newSizeY, const Color &color1, const Color &color2);
+
+    /// The box [minX, maxX) x [minY, maxY) the shape can cover.
+    void getBounds(int &minX, int &minY, int &maxX, int &maxY) const;
+    /// The pixels the shape covers in a row. The span is empty if it doesn't cover any.
+    Span getSpan(int row) const;
+    /// The color of the shape in a row of an image with the given height.
+    Color getRowColor(int row, size_t imageHeight) const {
+        return fill==ShapeFill::Solid ? color1 : color1.interpolate(color2, (double(row)/imageHeight));
+    }
+};
+
+/// A list of shapes drawn over each other in order, later shapes on top.
+/// All of them are composited in a single pass over the image, row by row, so drawing many shapes
+/// costs one traversal of the pixels they cover instead of one traversal per shape.
+class ShapeBatch {
+private:
+    std::vector<Shape> shapes;
+public:
+    /// Add a shape on top of the ones added so far.
+    void add(const Shape &shape) {
+        shapes.push_back(shape);
+    }
+    void clear() {
+        shapes.clear();
+    }
+    const std::vector<Shape> &getShapes() const {
+        return shapes;
+    }
+    /// Fill the shapes into the pixels, split into bands of rows that run in parallel.
+    void rasterize(FrameBuffer<Color> &pixels, TileScheduler &scheduler) const;
+};
+
+#endif
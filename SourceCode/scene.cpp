@@ -0,0 +1,31 @@
+#include "scene.h"
+
+// Scene.
+size_t Scene::getTriangleCount() const {
+    size_t triangleCount=0;
+    for (const SceneObject &object : objects) {
+        triangleCount+=object.mesh.getTriangleCount();
+    }
+    return triangleCount;
+}
+
+Mesh Scene::mergeObjects() const {
+    size_t vertexCount=0;
+    for (const SceneObject &object : objects) {
+        vertexCount+=object.mesh.getVertexCount();
+    }
+    Mesh merged;
+    merged.reserve(vertexCount, getTriangleCount());
+    for (const SceneObject &object : objects) {
+        // The indices of each object continue after the vertices of the previous ones.
+        const uint32_t firstVertex=uint32_t(merged.getVertexCount());
+        for (const Vector &vertex : object.mesh.getVertices()) {
+            merged.addVertex(vertex);
+        }
+        const std::vector<uint32_t> &indices=object.mesh.getIndices();
+        for (size_t i=0; i+2<indices.size(); i+=3) {
+            merged.addTriangle(firstVertex+indices[i], firstVertex+indices[i+1], firstVertex+indices[i+2]);
+        }
+    }
+    return merged;
+}
@@ -0,0 +1,80 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "color.h"
+#include "mesh.h"
+
+/// A single object of a scene - its geometry and the index of its material.
+struct SceneObject {
+    Mesh mesh;
+    int materialIndex;
+
+    /// Constructors.
+    SceneObject() : materialIndex(0) {}
+};
+
+/// Everything a scene file describes - the image settings, the camera and the objects.
+class Scene {
+private:
+    /// The color of pixels whose rays hit nothing.
+    Color backgroundColor;
+    /// The image resolution and the size of the buckets it is rendered in.
+    size_t imageWidth, imageHeight;
+    size_t bucketSize;
+    Camera camera;
+    std::vector<SceneObject> objects;
+public:
+    /// Constructors.
+    Scene()
+        : imageWidth(1920)
+        , imageHeight(1080)
+        , bucketSize(24)
+        , camera(1920, 1080) {}
+
+    /// Getters.
+    const Color &getBackgroundColor() const {
+        return backgroundColor;
+    }
+    size_t getImageWidth() const {
+        return imageWidth;
+    }
+    size_t getImageHeight() const {
+        return imageHeight;
+    }
+    size_t getBucketSize() const {
+        return bucketSize;
+    }
+    const Camera &getCamera() const {
+        return camera;
+    }
+    Camera &getCamera() {
+        return camera;
+    }
+    const std::vector<SceneObject> &getObjects() const {
+        return objects;
+    }
+    std::vector<SceneObject> &getObjects() {
+        return objects;
+    }
+    /// The total number of triangles in all objects.
+    size_t getTriangleCount() const;
+
+    /// Setters.
+    void changeBackgroundColor(const Color &newBackgroundColor) {
+        backgroundColor=newBackgroundColor;
+    }
+    void changeImageSettings(size_t newImageWidth, size_t newImageHeight, size_t newBucketSize) {
+        imageWidth=newImageWidth;
+        imageHeight=newImageHeight;
+        bucketSize=newBucketSize;
+        camera.changeResolution(imageWidth, imageHeight);
+    }
+    /// Merge all objects into a single mesh, e.g. to build one BVH over the whole scene.
+    Mesh mergeObjects() const;
+};
+
+#endif
@@ -0,0 +1,583 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include "profiler.h"
+#include "sceneloader.h"
+
+// MappedFile.
+MappedFile &MappedFile::operator=(MappedFile &&otherFile) {
+    if (this!=&otherFile) {
+        close();
+        data=otherFile.data;
+        size=otherFile.size;
+        otherFile.data=nullptr;
+        otherFile.size=0;
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string &filePath) {
+    close();
+    const int fileDescriptor=::open(filePath.c_str(), O_RDONLY);
+    if (fileDescriptor<0) {
+        return false;
+    }
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus)!=0) {
+        ::close(fileDescriptor);
+        return false;
+    }
+    size=size_t(fileStatus.st_size);
+    if (size==0) {
+        // Empty files can't be mapped, but they are still valid.
+        ::close(fileDescriptor);
+        data="";
+        return true;
+    }
+    void *mapping=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fileDescriptor);
+    if (mapping==MAP_FAILED) {
+        size=0;
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    data=static_cast<const char *>(mapping);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data!=nullptr && size!=0) {
+        munmap(const_cast<char *>(data), size);
+    }
+    data=nullptr;
+    size=0;
+}
+
+namespace {
+
+static_assert(sizeof(Vector)==3*sizeof(float) && std::is_standard_layout<Vector>::value,
+    "The vertex buffers are parsed and loaded in place as plain floats.");
+
+/// Arrays with more characters than this are parsed by several threads.
+const size_t parallelParseThreshold=1<<20;
+
+/// A position in the scene text, with the functions to parse the JSON values the format uses.
+/// Nothing is copied - keys are compared in place and numbers are parsed with std::from_chars.
+class JsonCursor {
+private:
+    const char *position;
+    const char *end;
+public:
+    JsonCursor(const char *text, size_t length) : position(text), end(text+length) {}
+
+    const char *getPosition() const {
+        return position;
+    }
+    const char *getEnd() const {
+        return end;
+    }
+    void skipTo(const char *newPosition) {
+        position=newPosition;
+    }
+    void skipWhitespace() {
+        while (position<end && (*position==' ' || *position=='\n' || *position=='\r' || *position=='\t')) {
+            ++position;
+        }
+    }
+    /// Consume a character if it is next, after any whitespace.
+    bool consume(char character) {
+        skipWhitespace();
+        if (position<end && *position==character) {
+            ++position;
+            return true;
+        }
+        return false;
+    }
+    bool isAtEnd() {
+        skipWhitespace();
+        return position>=end;
+    }
+    char peek() {
+        skipWhitespace();
+        return position<end ? *position : '\0';
+    }
+    /// Parse a string, without its quotes. Escape sequences are kept as they are.
+    bool parseString(std::string_view &text) {
+        if (!consume('"')) {
+            return false;
+        }
+        const char *start=position;
+        while (position<end && *position!='"') {
+            position+=(*position=='\\') ? 2 : 1;
+        }
+        if (position>=end) {
+            return false;
+        }
+        text=std::string_view(start, position-start);
+        ++position;
+        return true;
+    }
+    template <typename Number>
+    bool parseNumber(Number &number) {
+        skipWhitespace();
+        const std::from_chars_result result=std::from_chars(position, end, number);
+        if (result.ec!=std::errc()) {
+            return false;
+        }
+        position=result.ptr;
+        return true;
+    }
+    /// Skip any value - used for the parts of the format that aren't loaded, like lights and materials.
+    bool skipValue() {
+        const char next=peek();
+        if (next=='"') {
+            std::string_view ignored;
+            return parseString(ignored);
+        }
+        if (next=='{' || next=='[') {
+            // Skip to the matching bracket, ignoring brackets inside strings.
+            int depth=0;
+            while (position<end) {
+                const char character=*position;
+                if (character=='"') {
+                    std::string_view ignored;
+                    if (!parseString(ignored)) {
+                        return false;
+                    }
+                    continue;
+                }
+                ++position;
+                if (character=='{' || character=='[') {
+                    ++depth;
+                } else if (character=='}' || character==']') {
+                    if (--depth==0) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+        // A number, true, false or null.
+        while (position<end && *position!=',' && *position!='}' && *position!=']') {
+            ++position;
+        }
+        return true;
+    }
+};
+
+/// Parse the comma separated numbers in [begin, end) into output, which has room for exactly count numbers.
+template <typename Number>
+bool parseNumberRange(const char *begin, const char *end, Number *output, size_t count) {
+    JsonCursor cursor(begin, end-begin);
+    for (size_t i=0; i<count; ++i) {
+        if (!cursor.parseNumber(output[i])) {
+            return false;
+        }
+        if (i+1<count && !cursor.consume(',')) {
+            return false;
+        }
+    }
+    cursor.consume(',');
+    return cursor.isAtEnd();
+}
+
+/// Parse an array of numbers into a buffer, sized once by counting the commas first.
+/// Large arrays are split at commas and the parts are parsed in parallel.
+template <typename Number>
+bool parseNumberArray(JsonCursor &cursor, Number *&output, size_t &count, const std::function<Number *(size_t)> &allocate, size_t threadCount) {
+    if (!cursor.consume('[')) {
+        return false;
+    }
+    // Arrays of numbers can't contain brackets, so the end is the next ']'.
+    const char *begin=cursor.getPosition();
+    const char *end=static_cast<const char *>(memchr(begin, ']', cursor.getEnd()-begin));
+    if (end==nullptr) {
+        return false;
+    }
+    cursor.skipTo(end+1);
+    if (std::all_of(begin, end, [](char character) { return character==' ' || character=='\n' || character=='\r' || character=='\t'; })) {
+        count=0;
+        output=allocate(0);
+        return true;
+    }
+    count=std::count(begin, end, ',')+1;
+    output=allocate(count);
+    const size_t length=end-begin;
+    if (threadCount<=1 || length<parallelParseThreshold) {
+        return parseNumberRange(begin, end, output, count);
+    }
+    // Split into parts that start right after a comma, and find where each part's numbers go. Once the rest of
+    // the array has no comma, e.g. after a long last number, it stays in the last part instead of leaving empty ones.
+    std::vector<const char *> boundaries(1, begin);
+    for (size_t i=1; i<threadCount; ++i) {
+        const char *boundary=std::find(std::max(begin+length*i/threadCount, boundaries.back()), end, ',');
+        if (boundary==end) {
+            break;
+        }
+        boundaries.push_back(boundary+1);
+    }
+    boundaries.push_back(end);
+    const size_t partCount=boundaries.size()-1;
+    std::vector<size_t> offsets(1, 0);
+    for (size_t i=0; i<partCount; ++i) {
+        offsets.push_back(offsets.back()+std::count(boundaries[i], boundaries[i+1], ','));
+    }
+    // The last number isn't followed by a comma.
+    offsets.back()=count;
+    std::vector<char> results(partCount, 1);
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<partCount; ++i) {
+        threads.emplace_back([&, i]() {
+            results[i]=parseNumberRange(boundaries[i], boundaries[i+1], output+offsets[i], offsets[i+1]-offsets[i]);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return std::all_of(results.begin(), results.end(), [](char result) { return result!=0; });
+}
+
+/// Parse a small, fixed size array of floats.
+bool parseFloats(JsonCursor &cursor, float *values, size_t expectedCount) {
+    std::vector<float> parsed;
+    float *output=nullptr;
+    size_t count=0;
+    const std::function<float *(size_t)> allocate=[&](size_t newCount) {
+        parsed.resize(newCount);
+        return parsed.data();
+    };
+    if (!parseNumberArray<float>(cursor, output, count, allocate, 1) || count!=expectedCount) {
+        return false;
+    }
+    std::copy(parsed.begin(), parsed.end(), values);
+    return true;
+}
+
+/// Iterate the members of an object, calling parseMember with each key.
+bool parseObject(JsonCursor &cursor, const std::function<bool(std::string_view)> &parseMember) {
+    if (!cursor.consume('{')) {
+        return false;
+    }
+    if (cursor.consume('}')) {
+        return true;
+    }
+    do {
+        std::string_view key;
+        if (!cursor.parseString(key) || !cursor.consume(':') || !parseMember(key)) {
+            return false;
+        }
+    } while (cursor.consume(','));
+    return cursor.consume('}');
+}
+
+bool parseSettings(JsonCursor &cursor, Scene &scene) {
+    size_t width=scene.getImageWidth(), height=scene.getImageHeight(), bucketSize=scene.getBucketSize();
+    const bool isValid=parseObject(cursor, [&](std::string_view key) {
+        if (key=="background_color") {
+            float color[3];
+            if (!parseFloats(cursor, color, 3)) {
+                return false;
+            }
+            scene.changeBackgroundColor(Color(int(color[0]*255.0f), int(color[1]*255.0f), int(color[2]*255.0f)));
+            return true;
+        }
+        if (key=="image_settings") {
+            return parseObject(cursor, [&](std::string_view imageKey) {
+                if (imageKey=="width") {
+                    return cursor.parseNumber(width);
+                }
+                if (imageKey=="height") {
+                    return cursor.parseNumber(height);
+                }
+                if (imageKey=="bucket_size") {
+                    return cursor.parseNumber(bucketSize);
+                }
+                return cursor.skipValue();
+            });
+        }
+        return cursor.skipValue();
+    });
+    scene.changeImageSettings(width, height, bucketSize);
+    return isValid;
+}
+
+bool parseCamera(JsonCursor &cursor, Scene &scene) {
+    float matrix[9]={1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    float position[3]={0.0f, 0.0f, 0.0f};
+    const bool isValid=parseObject(cursor, [&](std::string_view key) {
+        if (key=="matrix") {
+            return parseFloats(cursor, matrix, 9);
+        }
+        if (key=="position") {
+            return parseFloats(cursor, position, 3);
+        }
+        return cursor.skipValue();
+    });
+    // The rows of the matrix are where the camera's right, up and backward axes point in the world.
+    Camera &camera=scene.getCamera();
+    camera.changePosition(Vector(position[0], position[1], position[2]));
+    camera.changeOrientation(
+        Vector(matrix[0], matrix[1], matrix[2]),
+        Vector(matrix[3], matrix[4], matrix[5]),
+        Vector(-matrix[6], -matrix[7], -matrix[8])
+    );
+    return isValid;
+}
+
+bool parseMeshObject(JsonCursor &cursor, SceneObject &object, size_t threadCount) {
+    std::vector<Vector> &vertices=object.mesh.getVertices();
+    std::vector<uint32_t> &indices=object.mesh.getIndices();
+    return parseObject(cursor, [&](std::string_view key) {
+        if (key=="vertices") {
+            float *output=nullptr;
+            size_t count=0;
+            // Parse the coordinates straight into the vertex buffer.
+            const std::function<float *(size_t)> allocate=[&](size_t newCount) {
+                vertices.resize((newCount+2)/3);
+                return reinterpret_cast<float *>(vertices.data());
+            };
+            return parseNumberArray<float>(cursor, output, count, allocate, threadCount) && count%3==0;
+        }
+        if (key=="triangles") {
+            uint32_t *output=nullptr;
+            size_t count=0;
+            const std::function<uint32_t *(size_t)> allocate=[&](size_t newCount) {
+                indices.resize(newCount);
+                return indices.data();
+            };
+            return parseNumberArray<uint32_t>(cursor, output, count, allocate, threadCount) && count%3==0;
+        }
+        if (key=="material_index") {
+            return cursor.parseNumber(object.materialIndex);
+        }
+        return cursor.skipValue();
+    });
+}
+
+bool parseObjects(JsonCursor &cursor, Scene &scene, size_t threadCount) {
+    std::vector<SceneObject> &objects=scene.getObjects();
+    if (!cursor.consume('[')) {
+        return false;
+    }
+    if (cursor.consume(']')) {
+        return true;
+    }
+    do {
+        objects.emplace_back();
+        if (!parseMeshObject(cursor, objects.back(), threadCount)) {
+            return false;
+        }
+        if (!objects.back().mesh.isValid()) {
+            printf("Object %zu has triangle indices outside of its vertices.\n", objects.size()-1);
+            return false;
+        }
+    } while (cursor.consume(','));
+    return cursor.consume(']');
+}
+
+/// The layout of the binary cache - a header, then for every object its counts followed by the
+/// raw vertex and index buffers.
+const char cacheMagic[8]={'C', 'R', 'T', 'S', 'C', 'N', 'B', '1'};
+
+struct CacheHeader {
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    uint64_t objectCount;
+    uint64_t imageWidth, imageHeight, bucketSize;
+    int32_t backgroundColor[3];
+    float cameraPosition[3];
+    float cameraRight[3], cameraUp[3], cameraForward[3];
+};
+
+struct CacheObject {
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    int64_t materialIndex;
+};
+
+void storeVector(const Vector &vector, float *values) {
+    values[0]=vector.getX();
+    values[1]=vector.getY();
+    values[2]=vector.getZ();
+}
+
+Vector loadVector(const float *values) {
+    return Vector(values[0], values[1], values[2]);
+}
+
+/// Get the size and modification time of a file.
+bool getFileVersion(const std::string &filePath, uint64_t &size, int64_t &modified) {
+    struct stat fileStatus;
+    if (stat(filePath.c_str(), &fileStatus)!=0) {
+        return false;
+    }
+    size=uint64_t(fileStatus.st_size);
+    modified=int64_t(fileStatus.st_mtim.tv_sec)*1000000000+fileStatus.st_mtim.tv_nsec;
+    return true;
+}
+
+}
+
+bool parseScene(const char *text, size_t length, Scene &scene, size_t threadCount) {
+    if (threadCount==0) {
+        threadCount=std::max(1u, std::thread::hardware_concurrency());
+    }
+    scene=Scene();
+    JsonCursor cursor(text, length);
+    const bool isValid=parseObject(cursor, [&](std::string_view key) {
+        if (key=="settings") {
+            return parseSettings(cursor, scene);
+        }
+        if (key=="camera") {
+            return parseCamera(cursor, scene);
+        }
+        if (key=="objects") {
+            return parseObjects(cursor, scene, threadCount);
+        }
+        return cursor.skipValue();
+    });
+    if (!isValid) {
+        printf("Invalid scene near character %zu.\n", size_t(cursor.getPosition()-text));
+    }
+    return isValid;
+}
+
+bool writeSceneCache(const std::string &cachePath, const Scene &scene, uint64_t sourceSize, int64_t sourceModified) {
+    // The cache is written next to it and renamed over it once complete, so an interrupted write or another
+    // renderer writing the same cache never leaves a truncated file behind for the next load.
+    const std::string temporaryPath=cachePath+".tmp"+std::to_string(getpid());
+    FILE *file=fopen(temporaryPath.c_str(), "wb");
+    if (file==nullptr) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.sourceSize=sourceSize;
+    header.sourceModified=sourceModified;
+    header.objectCount=scene.getObjects().size();
+    header.imageWidth=scene.getImageWidth();
+    header.imageHeight=scene.getImageHeight();
+    header.bucketSize=scene.getBucketSize();
+    header.backgroundColor[0]=scene.getBackgroundColor().R;
+    header.backgroundColor[1]=scene.getBackgroundColor().G;
+    header.backgroundColor[2]=scene.getBackgroundColor().B;
+    const Camera &camera=scene.getCamera();
+    storeVector(camera.getPosition(), header.cameraPosition);
+    storeVector(camera.getRight(), header.cameraRight);
+    storeVector(camera.getUp(), header.cameraUp);
+    storeVector(camera.getForward(), header.cameraForward);
+    bool isValid=fwrite(&header, sizeof(header), 1, file)==1;
+    for (const SceneObject &object : scene.getObjects()) {
+        CacheObject objectHeader;
+        objectHeader.vertexCount=object.mesh.getVertexCount();
+        objectHeader.indexCount=object.mesh.getIndices().size();
+        objectHeader.materialIndex=object.materialIndex;
+        isValid=isValid && fwrite(&objectHeader, sizeof(objectHeader), 1, file)==1;
+        isValid=isValid && fwrite(object.mesh.getVertices().data(), sizeof(Vector), objectHeader.vertexCount, file)==objectHeader.vertexCount;
+        isValid=isValid && fwrite(object.mesh.getIndices().data(), sizeof(uint32_t), objectHeader.indexCount, file)==objectHeader.indexCount;
+    }
+    isValid=(fclose(file)==0) && isValid;
+    isValid=isValid && rename(temporaryPath.c_str(), cachePath.c_str())==0;
+    if (!isValid) {
+        printf("Couldn't write to %s.\n", cachePath.c_str());
+        remove(temporaryPath.c_str());
+    }
+    return isValid;
+}
+
+bool loadSceneCache(const std::string &cachePath, Scene &scene, uint64_t sourceSize, int64_t sourceModified) {
+    MappedFile file;
+    if (!file.open(cachePath) || file.getSize()<sizeof(CacheHeader)) {
+        return false;
+    }
+    CacheHeader header;
+    memcpy(&header, file.getData(), sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic))!=0 || header.sourceSize!=sourceSize || header.sourceModified!=sourceModified) {
+        return false;
+    }
+    scene=Scene();
+    scene.changeImageSettings(header.imageWidth, header.imageHeight, header.bucketSize);
+    scene.changeBackgroundColor(Color(header.backgroundColor[0], header.backgroundColor[1], header.backgroundColor[2]));
+    Camera &camera=scene.getCamera();
+    camera.changePosition(loadVector(header.cameraPosition));
+    camera.changeOrientation(loadVector(header.cameraRight), loadVector(header.cameraUp), loadVector(header.cameraForward));
+    // Copy the buffers of every object straight from the mapping. The counts are checked against what is left of
+    // the file before they are multiplied, so a damaged cache can neither overflow them nor read past the end.
+    size_t offset=sizeof(header);
+    if (header.objectCount>(file.getSize()-offset)/sizeof(CacheObject)) {
+        return false;
+    }
+    std::vector<SceneObject> &objects=scene.getObjects();
+    objects.resize(header.objectCount);
+    for (SceneObject &object : objects) {
+        CacheObject objectHeader;
+        if (offset+sizeof(objectHeader)>file.getSize()) {
+            return false;
+        }
+        memcpy(&objectHeader, file.getData()+offset, sizeof(objectHeader));
+        offset+=sizeof(objectHeader);
+        const size_t remainingBytes=file.getSize()-offset;
+        if (objectHeader.vertexCount>remainingBytes/sizeof(Vector) || objectHeader.indexCount>remainingBytes/sizeof(uint32_t)
+            || objectHeader.vertexCount>UINT32_MAX || objectHeader.indexCount%3!=0) {
+            return false;
+        }
+        const size_t vertexBytes=objectHeader.vertexCount*sizeof(Vector);
+        const size_t indexBytes=objectHeader.indexCount*sizeof(uint32_t);
+        if (vertexBytes+indexBytes>remainingBytes) {
+            return false;
+        }
+        object.materialIndex=int(objectHeader.materialIndex);
+        object.mesh.getVertices().resize(objectHeader.vertexCount);
+        memcpy(static_cast<void *>(object.mesh.getVertices().data()), file.getData()+offset, vertexBytes);
+        offset+=vertexBytes;
+        object.mesh.getIndices().resize(objectHeader.indexCount);
+        memcpy(object.mesh.getIndices().data(), file.getData()+offset, indexBytes);
+        offset+=indexBytes;
+        for (uint32_t index : object.mesh.getIndices()) {
+            if (index>=objectHeader.vertexCount) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool loadScene(const std::string &filePath, Scene &scene, const SceneLoadOptions &options) {
+    PROFILE_SCOPE(ProfileStage::SceneLoad);
+    uint64_t sourceSize=0;
+    int64_t sourceModified=0;
+    if (!getFileVersion(filePath, sourceSize, sourceModified)) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    const std::string cachePath=filePath+".bin";
+    if (options.useCache && loadSceneCache(cachePath, scene, sourceSize, sourceModified)) {
+        return true;
+    }
+    MappedFile file;
+    if (!file.open(filePath)) {
+        printf("Couldn't open the given file path.\n");
+        return false;
+    }
+    if (!parseScene(file.getData(), file.getSize(), scene, options.threadCount)) {
+        return false;
+    }
+    if (options.useCache) {
+        writeSceneCache(cachePath, scene, sourceSize, sourceModified);
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef SCENELOADER_H
+#define SCENELOADER_H
+
+#include <stdint.h>
+#include <string>
+
+#include "scene.h"
+
+/// A read-only memory mapping of a whole file. It can only be moved, not copied.
+class MappedFile {
+private:
+    const char *data;
+    size_t size;
+public:
+    /// Constructors.
+    MappedFile() : data(nullptr), size(0) {}
+    MappedFile(const MappedFile &)=delete;
+    MappedFile(MappedFile &&otherFile) : data(otherFile.data), size(otherFile.size) {
+        otherFile.data=nullptr;
+        otherFile.size=0;
+    }
+    ~MappedFile() {
+        close();
+    }
+    MappedFile &operator=(const MappedFile &)=delete;
+    MappedFile &operator=(MappedFile &&otherFile);
+
+    /// Map a file. Returns false if it can't be opened or mapped.
+    bool open(const std::string &filePath);
+    /// Unmap the file.
+    void close();
+    /// Getters.
+    const char *getData() const {
+        return data;
+    }
+    size_t getSize() const {
+        return size;
+    }
+};
+
+/// Options for loading a scene.
+struct SceneLoadOptions {
+    /// The number of threads that parse large vertex and index arrays. 0 means one per hardware thread.
+    size_t threadCount=0;
+    /// Whether to load from, and write, a binary cache next to the scene file (the scene path plus ".bin").
+    /// The cache is only used while the size and modification time of the scene file still match.
+    bool useCache=true;
+};
+
+/// Load a .crtscene file. The file is memory mapped and the numbers are parsed in place,
+/// straight into the mesh buffers of the objects. Prints an error and returns false on failure.
+bool loadScene(const std::string &filePath, Scene &scene, const SceneLoadOptions &options=SceneLoadOptions());
+/// Load a scene from the text of a .crtscene file.
+bool parseScene(const char *text, size_t length, Scene &scene, size_t threadCount=0);
+/// Write the compact binary form of a scene, which loadSceneCache(..) reads back with a single mapping.
+/// The size and modification time of the source file are stored to check if the cache is still valid.
+bool writeSceneCache(const std::string &cachePath, const Scene &scene, uint64_t sourceSize, int64_t sourceModified);
+/// Load a scene from its binary form. Fails if it doesn't match the given source file size and modification time.
+bool loadSceneCache(const std::string &cachePath, Scene &scene, uint64_t sourceSize, int64_t sourceModified);
+
+#endif
@@ -0,0 +1,261 @@
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "arena.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+namespace {
+
+/// The scheduler whose tile function the calling thread is running, if any.
+thread_local const TileScheduler *runningScheduler=nullptr;
+/// The index of the calling thread within that scheduler.
+thread_local size_t runningThreadIndex=0;
+
+/// Interleave the bits of the tile coordinates to get its position on a Z-order curve.
+uint64_t mortonCode(uint32_t x, uint32_t y) {
+    uint64_t code=0;
+    for (int bit=0; bit<32; ++bit) {
+        code|=uint64_t((x>>bit)&1)<<(2*bit);
+        code|=uint64_t((y>>bit)&1)<<(2*bit+1);
+    }
+    return code;
+}
+
+}
+
+// TileScheduler.
+TileScheduler::TileScheduler(size_t newThreadCount, size_t newTileSize, TileOrder newTileOrder)
+    : threadCount(newThreadCount)
+    , tileSize(newTileSize==0 ? 1 : newTileSize)
+    , tileOrder(newTileOrder)
+    , currentFunction(nullptr)
+    , generation(0)
+    , activeWorkers(0)
+    , isStopping(false) {
+    if (threadCount==0) {
+        threadCount=std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i=0; i<threadCount; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    // The calling thread works as thread 0, so only the rest need their own threads.
+    for (size_t i=1; i<threadCount; ++i) {
+        workers.emplace_back(&TileScheduler::workerLoop, this, i);
+    }
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        isStopping=true;
+    }
+    startCondition.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+Tile *TileScheduler::makeTiles(size_t fromX, size_t fromY, size_t regionWidth, size_t regionHeight, size_t &tileCount) const {
+    const size_t tilesX=(regionWidth+tileSize-1)/tileSize;
+    const size_t tilesY=(regionHeight+tileSize-1)/tileSize;
+    tileCount=tilesX*tilesY;
+    MemoryArena &arena=getScratchArena();
+    Tile *tiles=arena.allocateArray<Tile>(tileCount);
+    // Pair the index of each tile with its position in the chosen order. The keys only live while sorting.
+    const MemoryArena::Marker marker=arena.getMarker();
+    std::pair<double, size_t> *keys=arena.allocateArray<std::pair<double, size_t>>(tileCount);
+    const double centerX=(double(tilesX)-1.0)*0.5;
+    const double centerY=(double(tilesY)-1.0)*0.5;
+    for (size_t ty=0; ty<tilesY; ++ty) {
+        for (size_t tx=0; tx<tilesX; ++tx) {
+            const size_t index=ty*tilesX+tx;
+            Tile &tile=tiles[index];
+            tile.fromX=fromX+tx*tileSize;
+            tile.fromY=fromY+ty*tileSize;
+            tile.width=std::min(tileSize, regionWidth-tx*tileSize);
+            tile.height=std::min(tileSize, regionHeight-ty*tileSize);
+            double key=0.0;
+            switch (tileOrder) {
+            case TileOrder::Morton:
+                key=double(mortonCode(uint32_t(tx), uint32_t(ty)));
+                break;
+            case TileOrder::Spiral: {
+                // Sort by ring first, then by the angle around the center within the ring.
+                const double dX=double(tx)-centerX;
+                const double dY=double(ty)-centerY;
+                const double ring=std::ceil(std::max(fabs(dX), fabs(dY)));
+                const double angle=atan2(dY, dX)+M_PI;
+                key=ring*8.0+angle;
+                break;
+            }
+            case TileOrder::Scanline:
+            default:
+                key=double(index);
+                break;
+            }
+            keys[index]=std::make_pair(key, index);
+        }
+    }
+    if (tileOrder!=TileOrder::Scanline) {
+        // Equal keys keep the scanline order by their indices, without the buffer a stable sort would allocate.
+        std::sort(keys, keys+tileCount);
+        Tile *sortedTiles=arena.allocateArray<Tile>(tileCount);
+        for (size_t i=0; i<tileCount; ++i) {
+            sortedTiles[i]=tiles[keys[i].second];
+        }
+        std::copy(sortedTiles, sortedTiles+tileCount, tiles);
+    }
+    arena.rewind(marker);
+    return tiles;
+}
+
+bool TileScheduler::popTile(size_t threadIndex, Tile &tile) {
+    // Take the next tile of the own queue first, to keep the work close together.
+    {
+        WorkQueue &ownQueue=*queues[threadIndex];
+        std::lock_guard<std::mutex> lock(ownQueue.mutex);
+        if (ownQueue.first<ownQueue.last) {
+            tile=ownQueue.tiles[ownQueue.first++];
+            return true;
+        }
+    }
+    // Then steal from the back of another queue, where the owner would get to last.
+    for (size_t offset=1; offset<threadCount; ++offset) {
+        WorkQueue &victimQueue=*queues[(threadIndex+offset)%threadCount];
+        std::lock_guard<std::mutex> lock(victimQueue.mutex);
+        if (victimQueue.first<victimQueue.last) {
+            tile=victimQueue.tiles[--victimQueue.last];
+            return true;
+        }
+    }
+    return false;
+}
+
+void TileScheduler::processTiles(size_t threadIndex) {
+    runningScheduler=this;
+    runningThreadIndex=threadIndex;
+    Tile tile;
+    while (popTile(threadIndex, tile)) {
+        try {
+            (*currentFunction)(tile);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(exceptionMutex);
+            if (!firstException) {
+                firstException=std::current_exception();
+            }
+        }
+    }
+    runningScheduler=nullptr;
+    runningThreadIndex=0;
+}
+
+void TileScheduler::workerLoop(size_t threadIndex) {
+    size_t seenGeneration=0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            startCondition.wait(lock, [&]() {
+                return isStopping || generation!=seenGeneration;
+            });
+            if (isStopping) {
+                return;
+            }
+            seenGeneration=generation;
+        }
+        processTiles(threadIndex);
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            --activeWorkers;
+            if (activeWorkers==0) {
+                doneCondition.notify_one();
+            }
+        }
+    }
+}
+
+void TileScheduler::run(size_t fromX, size_t fromY, size_t regionWidth, size_t regionHeight, const std::function<void(const Tile &)> &function) {
+    if (regionWidth==0 || regionHeight==0) {
+        return;
+    }
+    ScratchScope scratch;
+    size_t tileCount=0;
+    const Tile *tiles=makeTiles(fromX, fromY, regionWidth, regionHeight, tileCount);
+#ifndef NO_PROFILING
+    // Time every tile of the outermost runs for the heatmaps.
+    Profiler &profiler=Profiler::getInstance();
+    if (profiler.isEnabled() && runningScheduler==nullptr) {
+        const size_t runIndex=profiler.beginTileRun(fromX, fromY, regionWidth, regionHeight, tileSize);
+        const std::function<void(const Tile &)> timedFunction=[&](const Tile &tile) {
+            const uint64_t start=Profiler::getWallNanoseconds();
+            function(tile);
+            profiler.recordTile(runIndex, tile, start, Profiler::getWallNanoseconds()-start);
+        };
+        runTiles(tiles, tileCount, timedFunction);
+        return;
+    }
+#endif
+    runTiles(tiles, tileCount, function);
+}
+
+void TileScheduler::runItems(size_t count, const std::function<void(size_t index)> &function) {
+    // Each item is a tile of its own, with the index as its position.
+    ScratchScope scratch;
+    Tile *items=scratch.allocateArray<Tile>(count);
+    for (size_t i=0; i<count; ++i) {
+        items[i].fromX=i;
+        items[i].width=1;
+        items[i].height=1;
+    }
+    runTiles(items, count, [&](const Tile &item) {
+        function(item.fromX);
+    });
+}
+
+void TileScheduler::runTiles(const Tile *tiles, size_t tileCount, const std::function<void(const Tile &)> &function) {
+    // A nested run would wait for threads that are busy running the outer one, so do it inline.
+    if (threadCount==1 || runningScheduler!=nullptr) {
+        for (size_t i=0; i<tileCount; ++i) {
+            function(tiles[i]);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> runLock(runMutex);
+    // Give each thread a contiguous share of the tiles.
+    for (size_t i=0; i<threadCount; ++i) {
+        WorkQueue &queue=*queues[i];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tiles=tiles;
+        queue.first=i*tileCount/threadCount;
+        queue.last=(i+1)*tileCount/threadCount;
+    }
+    currentFunction=&function;
+    firstException=nullptr;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        activeWorkers=threadCount-1;
+        ++generation;
+    }
+    startCondition.notify_all();
+    processTiles(0);
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        doneCondition.wait(lock, [&]() {
+            return activeWorkers==0;
+        });
+    }
+    currentFunction=nullptr;
+    if (firstException) {
+        std::rethrow_exception(firstException);
+    }
+}
+
+size_t TileScheduler::getCurrentThreadIndex() {
+    return runningThreadIndex;
+}
+
+TileScheduler &TileScheduler::getDefault() {
+    static TileScheduler defaultScheduler;
+    return defaultScheduler;
+}
@@ -0,0 +1,124 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// The order in which the tiles of an image are handed out.
+enum class TileOrder {
+    /// Row by row, left to right.
+    Scanline,
+    /// Along a Z-order curve, so that consecutive tiles are close to each other.
+    Morton,
+    /// Ring by ring, from the center of the image outwards.
+    Spiral
+};
+
+/// A rectangular region of an image, processed as a single unit of work.
+struct Tile {
+    /// The top left pixel of the tile.
+    size_t fromX, fromY;
+    /// The tile resolution, already clipped to the region being processed.
+    size_t width, height;
+};
+
+/// A persistent pool of threads that processes an image tile by tile.
+/// Each thread starts with its own contiguous share of the tiles and, once it runs out,
+/// steals tiles from the back of the other threads' queues, so uneven per-pixel cost stays balanced.
+/// The calling thread takes part in the work, so a scheduler with a single thread runs everything inline.
+class TileScheduler {
+private:
+    /// The tiles assigned to a single thread - the range [first, last) of the tiles of the run.
+    struct WorkQueue {
+        std::mutex mutex;
+        const Tile *tiles=nullptr;
+        size_t first=0, last=0;
+    };
+
+    /// The number of threads, including the calling thread.
+    size_t threadCount;
+    /// The tile resolution.
+    size_t tileSize;
+    /// The order tiles are handed out in.
+    TileOrder tileOrder;
+    /// The helper threads and the queue of each thread.
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    /// The function processing a tile in the current run.
+    const std::function<void(const Tile &)> *currentFunction;
+    /// Synchronization between the calling thread and the helpers.
+    std::mutex stateMutex;
+    std::condition_variable startCondition, doneCondition;
+    size_t generation;
+    size_t activeWorkers;
+    bool isStopping;
+    /// Only a single run can be in flight at a time.
+    std::mutex runMutex;
+    /// The first exception thrown by a tile function in the current run.
+    std::exception_ptr firstException;
+    std::mutex exceptionMutex;
+
+    /// Split a region into tiles in the configured order. The tiles are in the scratch arena of the calling thread.
+    Tile *makeTiles(size_t fromX, size_t fromY, size_t regionWidth, size_t regionHeight, size_t &tileCount) const;
+    /// Process the own queue, then steal from the others until all queues are empty.
+    void processTiles(size_t threadIndex);
+    /// Get the next tile - from the front of the own queue, or from the back of another one.
+    bool popTile(size_t threadIndex, Tile &tile);
+    /// Process the tiles of a run on all threads.
+    void runTiles(const Tile *tiles, size_t tileCount, const std::function<void(const Tile &)> &function);
+    /// The loop of a helper thread.
+    void workerLoop(size_t threadIndex);
+public:
+    /// Constructors.
+    /// A thread count of 0 means one thread per hardware thread.
+    explicit TileScheduler(size_t newThreadCount=0, size_t newTileSize=32, TileOrder newTileOrder=TileOrder::Scanline);
+    TileScheduler(const TileScheduler &)=delete;
+    TileScheduler &operator=(const TileScheduler &)=delete;
+    ~TileScheduler();
+
+    /// Change the tiling of the following runs.
+    void changeTiling(size_t newTileSize, TileOrder newTileOrder) {
+        tileSize=newTileSize==0 ? 1 : newTileSize;
+        tileOrder=newTileOrder;
+    }
+    /// Getters.
+    size_t getThreadCount() const {
+        return threadCount;
+    }
+    size_t getTileSize() const {
+        return tileSize;
+    }
+    TileOrder getTileOrder() const {
+        return tileOrder;
+    }
+    /// Call function for every tile of the region, from all threads, and wait for all of them to finish.
+    /// Tiles never overlap, so a function that only writes the pixels of its tile needs no locking.
+    /// Calling run(..) from inside a tile function processes the nested region serially.
+    void run(size_t fromX, size_t fromY, size_t regionWidth, size_t regionHeight, const std::function<void(const Tile &)> &function);
+    /// Call function for every tile of a whole image.
+    void run(size_t width, size_t height, const std::function<void(const Tile &)> &function) {
+        run(0, 0, width, height, function);
+    }
+    /// Call function for bands of whole rows [fromRow, toRow) of the rows [fromY, fromY+rowCount), tileSize rows each.
+    /// Work that streams through memory, like fills, runs faster on whole rows than on square tiles.
+    void runRows(size_t fromY, size_t rowCount, const std::function<void(size_t fromRow, size_t toRow)> &function) {
+        run(0, fromY, 1, rowCount, [&](const Tile &tile) {
+            function(tile.fromY, tile.fromY+tile.height);
+        });
+    }
+    /// Call function for every index of [0, count), from all threads, one index per work item, and wait for all
+    /// of them to finish. For independent pieces of work that aren't regions of an image, e.g. compressing blocks.
+    void runItems(size_t count, const std::function<void(size_t index)> &function);
+    /// The index of the calling thread within the scheduler running it, 0 outside of a run.
+    static size_t getCurrentThreadIndex();
+    /// The scheduler shared by all drawers, with one thread per hardware thread.
+    static TileScheduler &getDefault();
+};
+
+#endif
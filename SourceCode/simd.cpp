@@ -0,0 +1,15 @@
+#include "simd.h"
+
+const char *getSimdDescription() {
+#if !defined(SIMD_VECTOR_EXTENSIONS) || SIMD_WIDTH==1
+    return "scalar";
+#elif defined(__AVX2__)
+    return "avx2";
+#elif defined(__x86_64__) && !defined(__clang__) && !defined(NO_SIMD_DISPATCH)
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "generic";
+#endif
+}
@@ -0,0 +1,376 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "geometry.h"
+
+/// Structure-of-arrays packets that process SIMD_WIDTH values per operation.
+///
+/// The width is chosen at compile time - 8 lanes (AVX2) by default, -DSIMD_WIDTH=4 for SSE
+/// and -DSIMD_WIDTH=1 for a plain scalar build. With GCC or Clang the packets are vector
+/// extension types, so the same code compiles to SSE or AVX instructions depending on the
+/// target. Functions marked with SIMD_DISPATCH are additionally compiled for AVX2 and the
+/// best version is picked at runtime by CPU, so an 8-wide build also runs on SSE-only machines.
+/// Without compiler support the packets fall back to plain arrays of floats.
+///
+/// Every operation does the same IEEE float operations in the same order as Vector, so packet
+/// results match the scalar path exactly. The only exception is a build that allows contracting
+/// multiplications and additions into FMA instructions (e.g. -mfma with -ffp-contract=fast),
+/// in which case lanes agree with the scalar path within 1 ulp per operation.
+
+#ifndef SIMD_WIDTH
+#define SIMD_WIDTH 8
+#endif
+
+#if defined(__GNUC__) && !defined(NO_SIMD)
+#define SIMD_VECTOR_EXTENSIONS 1
+#define SIMD_INLINE inline __attribute__((always_inline))
+#else
+#define SIMD_INLINE inline
+#endif
+
+#if defined(SIMD_VECTOR_EXTENSIONS) && defined(__x86_64__) && !defined(__clang__) && !defined(NO_SIMD_DISPATCH)
+#define SIMD_DISPATCH __attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_DISPATCH
+#endif
+
+#ifdef SIMD_VECTOR_EXTENSIONS
+/// SIMD_WIDTH floats, one per lane. The alignment is spelled out, because without -mavx GCC only aligns
+/// vectors to 16 bytes, while the AVX2 clones of SIMD_DISPATCH functions load them with aligned instructions.
+typedef float PacketFloat __attribute__((vector_size(SIMD_WIDTH*sizeof(float)), aligned(SIMD_WIDTH*sizeof(float))));
+/// SIMD_WIDTH 32-bit integers, one per lane. Comparisons of PacketFloat give lane masks of this type.
+typedef int32_t PacketInt __attribute__((vector_size(SIMD_WIDTH*sizeof(int32_t)), aligned(SIMD_WIDTH*sizeof(int32_t))));
+
+SIMD_INLINE PacketFloat packetBroadcast(float value) {
+    return PacketFloat{}+value;
+}
+SIMD_INLINE PacketInt packetToInt(const PacketFloat &values) {
+    return __builtin_convertvector(values, PacketInt);
+}
+SIMD_INLINE PacketFloat packetToFloat(const PacketInt &values) {
+    return __builtin_convertvector(values, PacketFloat);
+}
+#else
+/// The scalar fallback - arrays of floats with the same operators.
+struct PacketFloat {
+    float lanes[SIMD_WIDTH];
+
+    float &operator[](int lane) {
+        return lanes[lane];
+    }
+    float operator[](int lane) const {
+        return lanes[lane];
+    }
+};
+struct PacketInt {
+    int32_t lanes[SIMD_WIDTH];
+
+    int32_t &operator[](int lane) {
+        return lanes[lane];
+    }
+    int32_t operator[](int lane) const {
+        return lanes[lane];
+    }
+};
+
+#define SIMD_FALLBACK_OPERATOR(operation) \
+    inline PacketFloat operator operation(const PacketFloat &a, const PacketFloat &b) { \
+        PacketFloat result; \
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) { \
+            result[lane]=a[lane] operation b[lane]; \
+        } \
+        return result; \
+    } \
+    inline PacketFloat operator operation(const PacketFloat &a, float b) { \
+        PacketFloat result; \
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) { \
+            result[lane]=a[lane] operation b; \
+        } \
+        return result; \
+    } \
+    inline PacketFloat operator operation(float a, const PacketFloat &b) { \
+        PacketFloat result; \
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) { \
+            result[lane]=a operation b[lane]; \
+        } \
+        return result; \
+    }
+SIMD_FALLBACK_OPERATOR(+)
+SIMD_FALLBACK_OPERATOR(-)
+SIMD_FALLBACK_OPERATOR(*)
+SIMD_FALLBACK_OPERATOR(/)
+#undef SIMD_FALLBACK_OPERATOR
+
+inline PacketInt operator&(const PacketInt &a, const PacketInt &b) {
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=a[lane]&b[lane];
+    }
+    return result;
+}
+inline PacketInt operator|(const PacketInt &a, const PacketInt &b) {
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=a[lane]|b[lane];
+    }
+    return result;
+}
+
+inline PacketFloat packetBroadcast(float value) {
+    PacketFloat result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=value;
+    }
+    return result;
+}
+inline PacketInt packetToInt(const PacketFloat &values) {
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=int32_t(values[lane]);
+    }
+    return result;
+}
+inline PacketFloat packetToFloat(const PacketInt &values) {
+    PacketFloat result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=float(values[lane]);
+    }
+    return result;
+}
+#endif
+
+/// The same integer in every lane.
+SIMD_INLINE PacketInt packetBroadcastInt(int32_t value) {
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=value;
+    }
+    return result;
+}
+/// Lane-wise comparisons. A lane of the mask is -1 (all bits set) where the comparison holds and 0 elsewhere.
+SIMD_INLINE PacketInt packetLess(const PacketFloat &a, const PacketFloat &b) {
+#ifdef SIMD_VECTOR_EXTENSIONS
+    return a<b;
+#else
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=a[lane]<b[lane] ? -1 : 0;
+    }
+    return result;
+#endif
+}
+SIMD_INLINE PacketInt packetLessEqual(const PacketFloat &a, const PacketFloat &b) {
+#ifdef SIMD_VECTOR_EXTENSIONS
+    return a<=b;
+#else
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=a[lane]<=b[lane] ? -1 : 0;
+    }
+    return result;
+#endif
+}
+/// Pick each lane from a where the mask is set and from b elsewhere.
+SIMD_INLINE PacketFloat packetSelect(const PacketInt &mask, const PacketFloat &a, const PacketFloat &b) {
+#ifdef SIMD_VECTOR_EXTENSIONS
+    return mask ? a : b;
+#else
+    PacketFloat result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=mask[lane] ? a[lane] : b[lane];
+    }
+    return result;
+#endif
+}
+SIMD_INLINE PacketInt packetSelect(const PacketInt &mask, const PacketInt &a, const PacketInt &b) {
+#ifdef SIMD_VECTOR_EXTENSIONS
+    return mask ? a : b;
+#else
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=mask[lane] ? a[lane] : b[lane];
+    }
+    return result;
+#endif
+}
+/// Whether any lane of the mask is set.
+SIMD_INLINE bool packetAny(const PacketInt &mask) {
+    int32_t combined=0;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        combined|=mask[lane];
+    }
+    return combined!=0;
+}
+/// Load SIMD_WIDTH consecutive floats. The address doesn't need to be aligned.
+SIMD_INLINE PacketFloat packetLoad(const float *values) {
+    PacketFloat result;
+    memcpy(&result, values, sizeof(result));
+    return result;
+}
+/// Store the lanes to SIMD_WIDTH consecutive floats. The address doesn't need to be aligned.
+SIMD_INLINE void packetStore(float *values, const PacketFloat &packet) {
+    memcpy(values, &packet, sizeof(packet));
+}
+/// Load SIMD_WIDTH consecutive integers. The address doesn't need to be aligned.
+SIMD_INLINE PacketInt packetLoad(const int32_t *values) {
+    PacketInt result;
+    memcpy(&result, values, sizeof(result));
+    return result;
+}
+/// Store the lanes to SIMD_WIDTH consecutive integers. The address doesn't need to be aligned.
+SIMD_INLINE void packetStore(int32_t *values, const PacketInt &packet) {
+    memcpy(values, &packet, sizeof(packet));
+}
+/// Lane-wise clamp of integers to [lower, upper].
+SIMD_INLINE PacketInt packetClamp(const PacketInt &values, int32_t lower, int32_t upper) {
+#ifdef SIMD_VECTOR_EXTENSIONS
+    const PacketInt lowerPacket=packetBroadcastInt(lower), upperPacket=packetBroadcastInt(upper);
+    const PacketInt raised=values<lowerPacket ? lowerPacket : values;
+    return raised>upperPacket ? upperPacket : raised;
+#else
+    PacketInt result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=values[lane]<lower ? lower : (values[lane]>upper ? upper : values[lane]);
+    }
+    return result;
+#endif
+}
+/// Store the low byte of every lane to SIMD_WIDTH consecutive bytes.
+SIMD_INLINE void packetStoreBytes(uint8_t *bytes, const PacketInt &packet) {
+#ifdef SIMD_VECTOR_EXTENSIONS
+    typedef uint8_t PacketByte __attribute__((vector_size(SIMD_WIDTH)));
+    const PacketByte narrowed=__builtin_convertvector(packet, PacketByte);
+    memcpy(bytes, &narrowed, sizeof(narrowed));
+#else
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        bytes[lane]=uint8_t(packet[lane]);
+    }
+#endif
+}
+/// The packet (start, start+1, ..., start+SIMD_WIDTH-1).
+SIMD_INLINE PacketFloat packetSequence(float start) {
+    PacketFloat result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=start+float(lane);
+    }
+    return result;
+}
+/// Lane-wise square root.
+SIMD_INLINE PacketFloat packetSqrt(const PacketFloat &values) {
+    PacketFloat result;
+#if defined(SIMD_VECTOR_EXTENSIONS) && defined(__SSE__) && SIMD_WIDTH%4==0
+    // sqrtf has to set errno for negative inputs, which keeps the compiler from vectorizing it,
+    // so use the SSE instruction directly, four lanes at a time. It rounds exactly like sqrtf.
+    for (int lane=0; lane<SIMD_WIDTH; lane+=4) {
+        const __m128 quarter=_mm_loadu_ps(reinterpret_cast<const float *>(&values)+lane);
+        _mm_storeu_ps(reinterpret_cast<float *>(&result)+lane, _mm_sqrt_ps(quarter));
+    }
+#else
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=sqrtf(values[lane]);
+    }
+#endif
+    return result;
+}
+/// Lane-wise absolute value.
+SIMD_INLINE PacketFloat packetAbs(const PacketFloat &values) {
+    PacketFloat result;
+    for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+        result[lane]=fabsf(values[lane]);
+    }
+    return result;
+}
+/// Lane-wise minimum and maximum.
+SIMD_INLINE PacketFloat packetMin(const PacketFloat &a, const PacketFloat &b) {
+    return packetSelect(packetLess(b, a), b, a);
+}
+SIMD_INLINE PacketFloat packetMax(const PacketFloat &a, const PacketFloat &b) {
+    return packetSelect(packetLess(a, b), b, a);
+}
+
+/// SIMD_WIDTH vectors stored as structure of arrays, mirroring the operations of Vector.
+class VectorPacket {
+private:
+    /// The coordinates of the vectors, one vector per lane.
+    PacketFloat x, y, z;
+public:
+    /// Constructors.
+    SIMD_INLINE VectorPacket() : x(packetBroadcast(0.0f)), y(packetBroadcast(0.0f)), z(packetBroadcast(0.0f)) {}
+    SIMD_INLINE VectorPacket(const PacketFloat &xCoordinates, const PacketFloat &yCoordinates, const PacketFloat &zCoordinates)
+        : x(xCoordinates)
+        , y(yCoordinates)
+        , z(zCoordinates) {}
+    /// The same vector in every lane.
+    SIMD_INLINE explicit VectorPacket(const Vector &vector)
+        : x(packetBroadcast(vector.getX()))
+        , y(packetBroadcast(vector.getY()))
+        , z(packetBroadcast(vector.getZ())) {}
+    /// Operations.
+    SIMD_INLINE VectorPacket operator+(const VectorPacket &otherPacket) const {
+        return VectorPacket(x+otherPacket.x, y+otherPacket.y, z+otherPacket.z);
+    }
+    SIMD_INLINE VectorPacket operator-(const VectorPacket &otherPacket) const {
+        return VectorPacket(x-otherPacket.x, y-otherPacket.y, z-otherPacket.z);
+    }
+    SIMD_INLINE VectorPacket operator*(float multiplier) const {
+        return VectorPacket(x*multiplier, y*multiplier, z*multiplier);
+    }
+    /// Multiply each vector by the multiplier in its lane.
+    SIMD_INLINE VectorPacket operator*(const PacketFloat &multipliers) const {
+        return VectorPacket(x*multipliers, y*multipliers, z*multipliers);
+    }
+    SIMD_INLINE PacketFloat length() const {
+        return packetSqrt(x*x+y*y+z*z);
+    }
+    SIMD_INLINE void normalize() {
+        const PacketFloat vectorLength=length();
+        x=x/vectorLength;
+        y=y/vectorLength;
+        z=z/vectorLength;
+    }
+    SIMD_INLINE PacketFloat dotProduct(const VectorPacket &otherPacket) const {
+        return x*otherPacket.x+y*otherPacket.y+z*otherPacket.z;
+    }
+    SIMD_INLINE VectorPacket crossProduct(const VectorPacket &otherPacket) const {
+        return VectorPacket(
+            y*otherPacket.z-z*otherPacket.y,
+            z*otherPacket.x-x*otherPacket.z,
+            x*otherPacket.y-y*otherPacket.x
+        );
+    }
+    SIMD_INLINE VectorPacket absolute() const {
+        return VectorPacket(packetAbs(x), packetAbs(y), packetAbs(z));
+    }
+    /// Getters.
+    SIMD_INLINE const PacketFloat &getX() const {
+        return x;
+    }
+    SIMD_INLINE const PacketFloat &getY() const {
+        return y;
+    }
+    SIMD_INLINE const PacketFloat &getZ() const {
+        return z;
+    }
+    /// Set the vector of a single lane.
+    SIMD_INLINE void setLane(int lane, const Vector &vector) {
+        x[lane]=vector.getX();
+        y[lane]=vector.getY();
+        z[lane]=vector.getZ();
+    }
+    /// Extract the vector of a single lane.
+    SIMD_INLINE Vector getLane(int lane) const {
+        return Vector(x[lane], y[lane], z[lane]);
+    }
+};
+
+/// A description of the instruction set SIMD_DISPATCH functions run with on this CPU.
+const char *getSimdDescription();
+
+#endif
@@ -3,7 +3,7 @@
 
 #include <algorithm>
 
-int clamp(int number, int lower, int upper) {
+inline int clamp(int number, int lower, int upper) {
   return std::max(lower, std::min(number, upper));
 }
 
@@ -0,0 +1,322 @@
+#include <math.h>
+#include <algorithm>
+
+#include "arena.h"
+#include "profiler.h"
+#include "simd.h"
+#include "wavefront.h"
+
+namespace {
+
+/// The bits of a sort key per axis. Three axes fit in 24 bits, which three 8-bit radix passes sort.
+const int keyBitsPerAxis=8;
+const int radixBits=8;
+const int radixPasses=3;
+
+/// Spread the lowest 10 bits of a number out to every third bit, for a Morton code.
+uint32_t spreadBits(uint32_t value) {
+    value&=0x3ff;
+    value=(value|(value<<16))&0x030000ff;
+    value=(value|(value<<8))&0x0300f00f;
+    value=(value|(value<<4))&0x030c30c3;
+    value=(value|(value<<2))&0x09249249;
+    return value;
+}
+
+/// Quantize a value in [0, 1] to the given number of bits. Values outside, and NaN, are clamped.
+uint32_t quantize(float value, int bits) {
+    const uint32_t maxValue=(1u<<bits)-1;
+    if (!(value>0.0f)) {
+        return 0;
+    }
+    return std::min(uint32_t(value*float(maxValue+1)), maxValue);
+}
+
+/// The sort key of a direction - the octant in the highest bits, then the Morton code of the absolute direction.
+uint32_t findDirectionKey(float x, float y, float z) {
+    const uint32_t octant=(x<0.0f ? 4u : 0u)|(y<0.0f ? 2u : 0u)|(z<0.0f ? 1u : 0u);
+    const int bits=keyBitsPerAxis-1;
+    return (octant<<(3*bits))|(spreadBits(quantize(fabsf(x), bits))<<2)|(spreadBits(quantize(fabsf(y), bits))<<1)
+        |spreadBits(quantize(fabsf(z), bits));
+}
+
+/// The sort key of an origin - the Morton code of where it is in the scene bounds.
+uint32_t findOriginKey(float x, float y, float z, const Vector &boundsMin, const Vector &inverseExtent) {
+    return (spreadBits(quantize((x-boundsMin.getX())*inverseExtent.getX(), keyBitsPerAxis))<<2)
+        |(spreadBits(quantize((y-boundsMin.getY())*inverseExtent.getY(), keyBitsPerAxis))<<1)
+        |spreadBits(quantize((z-boundsMin.getZ())*inverseExtent.getZ(), keyBitsPerAxis));
+}
+
+/// Reorder count values so that the k-th one becomes the one at order[k].
+template <typename Type>
+void permute(Type *values, size_t count, const uint32_t *order) {
+    ScratchScope scratch;
+    Type *reordered=scratch.allocateArray<Type>(count);
+    for (size_t k=0; k<count; ++k) {
+        reordered[k]=values[order[k]];
+    }
+    std::copy(reordered, reordered+count, values);
+}
+
+/// Generate the rays of count consecutive pixels of a row, SIMD_WIDTH pixels per iteration.
+/// The directions are bit-identical to the ones of Camera::generatePixelRay(..).
+SIMD_DISPATCH
+void generateRowDirections(const Camera &camera, size_t i, size_t fromJ, size_t count, float *directionX, float *directionY, float *directionZ) {
+    size_t k=0;
+    for (; k+SIMD_WIDTH<=count; k+=SIMD_WIDTH) {
+        const VectorPacket &directions=camera.generateDirectionPacket(i, fromJ+k);
+        packetStore(directionX+k, directions.getX());
+        packetStore(directionY+k, directions.getY());
+        packetStore(directionZ+k, directions.getZ());
+    }
+    // The pixels that don't fill a whole packet.
+    for (; k<count; ++k) {
+        const Ray &ray=camera.generatePixelRay(fromJ+k, i);
+        directionX[k]=ray.getDirection().getX();
+        directionY[k]=ray.getDirection().getY();
+        directionZ[k]=ray.getDirection().getZ();
+    }
+}
+
+/// Shade count rays by the normals of the triangles they hit and how much they face them, SIMD_WIDTH rays
+/// per iteration. The rays that miss get the background color. The same operations as the per-pixel path.
+SIMD_DISPATCH
+void shadeHits(const float *directionX, const float *directionY, const float *directionZ, const uint32_t *triangleIds,
+               const Vector *normals, const Color &backgroundColor, size_t count, int32_t *red, int32_t *green, int32_t *blue) {
+    size_t k=0;
+    for (; k+SIMD_WIDTH<=count; k+=SIMD_WIDTH) {
+        // Gather the normals of the hits. The misses get a zero normal and are replaced below.
+        PacketFloat normalX, normalY, normalZ;
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+            const uint32_t triangleId=triangleIds[k+lane];
+            const Vector &normal=triangleId!=invalidTriangleId ? normals[triangleId] : Vector();
+            normalX[lane]=normal.getX();
+            normalY[lane]=normal.getY();
+            normalZ[lane]=normal.getZ();
+        }
+        const PacketFloat facing=packetAbs(normalX*packetLoad(directionX+k)+normalY*packetLoad(directionY+k)
+                                           +normalZ*packetLoad(directionZ+k));
+        const PacketFloat scale=255.0f*facing;
+        const PacketInt shadeRed=packetToInt(packetAbs(normalX)*scale);
+        const PacketInt shadeGreen=packetToInt(packetAbs(normalY)*scale);
+        const PacketInt shadeBlue=packetToInt(packetAbs(normalZ)*scale);
+        for (int lane=0; lane<SIMD_WIDTH; ++lane) {
+            const bool isHit=triangleIds[k+lane]!=invalidTriangleId;
+            red[k+lane]=isHit ? shadeRed[lane] : backgroundColor.R;
+            green[k+lane]=isHit ? shadeGreen[lane] : backgroundColor.G;
+            blue[k+lane]=isHit ? shadeBlue[lane] : backgroundColor.B;
+        }
+    }
+    // The rays that don't fill a whole packet.
+    for (; k<count; ++k) {
+        if (triangleIds[k]==invalidTriangleId) {
+            red[k]=backgroundColor.R;
+            green[k]=backgroundColor.G;
+            blue[k]=backgroundColor.B;
+            continue;
+        }
+        const Vector &normal=normals[triangleIds[k]];
+        const float facing=fabsf(normal.dotProduct(Vector(directionX[k], directionY[k], directionZ[k])));
+        const Vector &shade=normal.absolute()*(255.0f*facing);
+        red[k]=int(shade.getX());
+        green[k]=int(shade.getY());
+        blue[k]=int(shade.getZ());
+    }
+}
+
+/// Shade count rays by the absolute values of their directions, SIMD_WIDTH rays per iteration.
+SIMD_DISPATCH
+void shadeDirections(const float *directionX, const float *directionY, const float *directionZ, size_t count,
+                     int32_t *red, int32_t *green, int32_t *blue) {
+    size_t k=0;
+    for (; k+SIMD_WIDTH<=count; k+=SIMD_WIDTH) {
+        packetStore(red+k, packetToInt(packetAbs(packetLoad(directionX+k))*255.0f));
+        packetStore(green+k, packetToInt(packetAbs(packetLoad(directionY+k))*255.0f));
+        packetStore(blue+k, packetToInt(packetAbs(packetLoad(directionZ+k))*255.0f));
+    }
+    for (; k<count; ++k) {
+        red[k]=int(fabsf(directionX[k])*255.0f);
+        green[k]=int(fabsf(directionY[k])*255.0f);
+        blue[k]=int(fabsf(directionZ[k])*255.0f);
+    }
+}
+
+}
+
+// RayQueue.
+void RayQueue::resize(size_t count) {
+    for (Array<float> *array : {&originX, &originY, &originZ, &directionX, &directionY, &directionZ, &hitDistances}) {
+        array->resize(count);
+    }
+    pixelIndices.resize(count);
+    triangleIds.resize(count);
+    red.resize(count);
+    green.resize(count);
+    blue.resize(count);
+}
+
+// WavefrontRenderer.
+void WavefrontRenderer::generateRays(const Camera &camera, size_t width, const Tile &chunk, size_t from) {
+    PROFILE_TIMER(ProfileStage::RayGeneration);
+    const size_t count=chunk.width*chunk.height;
+    // The primary rays all start at the camera.
+    const Vector &position=camera.getPosition();
+    std::fill(&queue.originX[from], &queue.originX[from]+count, position.getX());
+    std::fill(&queue.originY[from], &queue.originY[from]+count, position.getY());
+    std::fill(&queue.originZ[from], &queue.originZ[from]+count, position.getZ());
+    for (size_t i=chunk.fromY; i<chunk.fromY+chunk.height; ++i) {
+        generateRowDirections(camera, i, chunk.fromX, chunk.width, &queue.directionX[from], &queue.directionY[from], &queue.directionZ[from]);
+        for (size_t j=chunk.fromX; j<chunk.fromX+chunk.width; ++j) {
+            queue.pixelIndices[from++]=uint32_t(i*width+j);
+        }
+    }
+    PROFILE_COUNT(ProfileCounter::RaysGenerated, count);
+}
+
+void WavefrontRenderer::sortRays(const BoundingBox &bounds, size_t from, size_t count) {
+    PROFILE_TIMER(ProfileStage::RaySort);
+    ScratchScope scratch;
+    uint32_t *keys=scratch.allocateArray<uint32_t>(count);
+    uint32_t *order=scratch.allocateArray<uint32_t>(count);
+    uint32_t *sortedOrder=scratch.allocateArray<uint32_t>(count);
+    if (settings.sortOrder==RaySortOrder::Origin) {
+        const Vector &extent=bounds.getExtent();
+        const Vector inverseExtent(extent.getX()>0.0f ? 1.0f/extent.getX() : 0.0f, extent.getY()>0.0f ? 1.0f/extent.getY() : 0.0f,
+                                   extent.getZ()>0.0f ? 1.0f/extent.getZ() : 0.0f);
+        for (size_t k=0; k<count; ++k) {
+            keys[k]=findOriginKey(queue.originX[from+k], queue.originY[from+k], queue.originZ[from+k], bounds.min, inverseExtent);
+        }
+    } else {
+        for (size_t k=0; k<count; ++k) {
+            keys[k]=findDirectionKey(queue.directionX[from+k], queue.directionY[from+k], queue.directionZ[from+k]);
+        }
+    }
+    // A stable least significant digit radix sort of the ray order by the keys.
+    for (size_t k=0; k<count; ++k) {
+        order[k]=uint32_t(k);
+    }
+    for (int pass=0; pass<radixPasses; ++pass) {
+        const int shift=pass*radixBits;
+        size_t offsets[(1<<radixBits)+1]={};
+        for (size_t k=0; k<count; ++k) {
+            ++offsets[((keys[order[k]]>>shift)&((1<<radixBits)-1))+1];
+        }
+        for (int digit=0; digit<(1<<radixBits); ++digit) {
+            offsets[digit+1]+=offsets[digit];
+        }
+        for (size_t k=0; k<count; ++k) {
+            sortedOrder[offsets[(keys[order[k]]>>shift)&((1<<radixBits)-1)]++]=order[k];
+        }
+        std::swap(order, sortedOrder);
+    }
+    // Only the rays are reordered - the later stages fill the rest in the new order.
+    for (RayQueue::Array<float> *array : {&queue.originX, &queue.originY, &queue.originZ, &queue.directionX, &queue.directionY, &queue.directionZ}) {
+        permute(array->data()+from, count, order);
+    }
+    permute(queue.pixelIndices.data()+from, count, order);
+}
+
+void WavefrontRenderer::intersectRays(const BVH &scene, size_t from, size_t count, TraversalStatistics *statistics) {
+    PROFILE_TIMER(ProfileStage::Intersection);
+    for (size_t k=from; k<from+count; ++k) {
+        const Ray ray(Vector(queue.originX[k], queue.originY[k], queue.originZ[k]),
+                      Vector(queue.directionX[k], queue.directionY[k], queue.directionZ[k]));
+        Hit hit;
+        scene.intersect(ray, hit, statistics);
+        queue.hitDistances[k]=hit.distance;
+        queue.triangleIds[k]=hit.triangleId;
+    }
+}
+
+void WavefrontRenderer::shadeRays(const std::vector<Vector> *normals, const Color &backgroundColor, size_t from, size_t count) {
+    PROFILE_TIMER(ProfileStage::Shading);
+    if (normals==nullptr) {
+        shadeDirections(&queue.directionX[from], &queue.directionY[from], &queue.directionZ[from], count,
+                        &queue.red[from], &queue.green[from], &queue.blue[from]);
+        return;
+    }
+    shadeHits(&queue.directionX[from], &queue.directionY[from], &queue.directionZ[from], &queue.triangleIds[from],
+              normals->data(), backgroundColor, count, &queue.red[from], &queue.green[from], &queue.blue[from]);
+}
+
+void WavefrontRenderer::writeRays(FrameBuffer<Color> &pixels, size_t from, size_t count) const {
+    const size_t width=pixels.getWidth();
+    for (size_t k=from; k<from+count; ++k) {
+        const uint32_t pixelIndex=queue.pixelIndices[k];
+        Color &pixel=pixels.row(pixelIndex/width)[pixelIndex%width];
+        pixel.R=queue.red[k];
+        pixel.G=queue.green[k];
+        pixel.B=queue.blue[k];
+    }
+    PROFILE_COUNT(ProfileCounter::PixelsWritten, count);
+}
+
+void WavefrontRenderer::render(const Camera &camera, const BVH *scene, const std::vector<Vector> &normals, const Color &backgroundColor,
+                               FrameBuffer<Color> &pixels, TileScheduler &scheduler) {
+    const size_t width=pixels.getWidth(), height=pixels.getHeight();
+    if (width==0 || height==0) {
+        return;
+    }
+    PROFILE_SCOPE(ProfileStage::Render);
+    const size_t chunkSize=std::max<size_t>(settings.chunkSize, 1);
+    // Whole bands of chunks per wave.
+    const size_t waveRows=std::max<size_t>(settings.waveRayCount/width/chunkSize, 1)*chunkSize;
+    if (queue.size()<std::min(waveRows, height)*width) {
+        queue.resize(std::min(waveRows, height)*width);
+    }
+    const BoundingBox &bounds=scene ? scene->getBounds() : BoundingBox();
+    const bool isCounting=Profiler::getInstance().isEnabled();
+
+    for (size_t fromRow=0; fromRow<height; fromRow+=waveRows) {
+        const size_t toRow=std::min(fromRow+waveRows, height);
+        // The rays of every chunk are next to each other in the queue, chunk after chunk.
+        chunks.clear();
+        chunkOffsets.clear();
+        size_t rayCount=0;
+        for (size_t i=fromRow; i<toRow; i+=chunkSize) {
+            for (size_t j=0; j<width; j+=chunkSize) {
+                Tile chunk;
+                chunk.fromX=j;
+                chunk.fromY=i;
+                chunk.width=std::min(chunkSize, width-j);
+                chunk.height=std::min(chunkSize, toRow-i);
+                chunks.push_back(chunk);
+                chunkOffsets.push_back(rayCount);
+                rayCount+=chunk.width*chunk.height;
+            }
+        }
+        // Every stage goes over all chunks of the wave before the next one starts. The stages are only passed
+        // by reference, so no std::function has to keep their captures on the heap.
+        // Each stage gets the chunk and the range of its rays in the queue.
+        const auto runStage=[&](const auto &stage) {
+            scheduler.runItems(chunks.size(), [&](size_t chunkIndex) {
+                const Tile &chunk=chunks[chunkIndex];
+                stage(chunk, chunkOffsets[chunkIndex], chunk.width*chunk.height);
+            });
+        };
+        runStage([&](const Tile &chunk, size_t from, size_t) {
+            generateRays(camera, width, chunk, from);
+        });
+        if (scene) {
+            if (settings.sortOrder!=RaySortOrder::None) {
+                runStage([&](const Tile &, size_t from, size_t count) {
+                    sortRays(bounds, from, count);
+                });
+            }
+            runStage([&](const Tile &, size_t from, size_t count) {
+                TraversalStatistics statistics;
+                // The traversal is only counted while profiling, to keep the counting off the hot path otherwise.
+                intersectRays(*scene, from, count, isCounting ? &statistics : nullptr);
+                PROFILE_COUNT(ProfileCounter::NodesVisited, statistics.nodesVisited);
+                PROFILE_COUNT(ProfileCounter::BoxTests, statistics.boxTests);
+                PROFILE_COUNT(ProfileCounter::TriangleTests, statistics.triangleTests);
+            });
+        }
+        runStage([&](const Tile &, size_t from, size_t count) {
+            shadeRays(scene ? &normals : nullptr, backgroundColor, from, count);
+        });
+        runStage([&](const Tile &, size_t from, size_t count) {
+            writeRays(pixels, from, count);
+        });
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+/// How the rays are reordered between generating and intersecting them, so that rays next to each other
+/// in the queue visit the same BVH nodes.
+enum class RaySortOrder {
+    /// Keep the rays in pixel order.
+    None,
+    /// By the octant of the direction, then by the direction within it.
+    Direction,
+    /// By where in the scene the rays start.
+    Origin
+};
+
+/// The settings of the wavefront renderer.
+struct WavefrontSettings {
+    /// The most rays in flight at once. The image is rendered in waves of whole bands of chunks, at least one band per wave.
+    size_t waveRayCount=size_t(1)<<18;
+    /// The side of the square tiles of pixels that a single task of every stage processes the rays of.
+    /// Rays are only reordered within their chunk.
+    size_t chunkSize=32;
+    /// The primary rays of a chunk are coherent already, so they are only sorted on request.
+    RaySortOrder sortOrder=RaySortOrder::None;
+};
+
+/// The rays of a wave and what the stages found out about them, as structure of arrays.
+/// Each stage streams through a few of the arrays, instead of pulling whole rays and hits through the caches.
+struct RayQueue {
+    template <typename Type>
+    using Array=std::vector<Type, CacheAlignedAllocator<Type>>;
+
+    Array<float> originX, originY, originZ;
+    Array<float> directionX, directionY, directionZ;
+    /// The index of the pixel of each ray, row by row.
+    Array<uint32_t> pixelIndices;
+    /// The closest hit of each ray, invalidTriangleId if it misses.
+    Array<float> hitDistances;
+    Array<uint32_t> triangleIds;
+    /// The shaded color of each ray.
+    Array<int32_t> red, green, blue;
+
+    /// Make room for count rays. The contents are left as they were.
+    void resize(size_t count);
+    size_t size() const {
+        return pixelIndices.size();
+    }
+};
+
+/// Renders an image as a stream of rays instead of pixel by pixel. A wave of rays goes through the stages
+/// one after the other - generate, sort, intersect, shade and write - and each stage is a batched kernel
+/// that runs over the chunks of the queue in parallel. The image is the same as the one of the per-pixel path.
+class WavefrontRenderer {
+private:
+    WavefrontSettings settings;
+    RayQueue queue;
+    /// The chunks of the current wave and where their rays start in the queue.
+    std::vector<Tile> chunks;
+    std::vector<size_t> chunkOffsets;
+
+    /// The stages, each over the rays [from, from+count) of the queue.
+    /// Generate the rays of the pixels of a chunk, row by row.
+    void generateRays(const Camera &camera, size_t width, const Tile &chunk, size_t from);
+    void sortRays(const BoundingBox &bounds, size_t from, size_t count);
+    void intersectRays(const BVH &scene, size_t from, size_t count, TraversalStatistics *statistics);
+    /// Shade the rays by the normals of the triangles they hit, or by their directions without a scene.
+    void shadeRays(const std::vector<Vector> *normals, const Color &backgroundColor, size_t from, size_t count);
+    void writeRays(FrameBuffer<Color> &pixels, size_t from, size_t count) const;
+public:
+    /// Constructors.
+    explicit WavefrontRenderer(const WavefrontSettings &newSettings=WavefrontSettings()) : settings(newSettings) {}
+
+    /// Getters.
+    const WavefrontSettings &getSettings() const {
+        return settings;
+    }
+    /// Change the settings. The queue grows on the next render(..) if the waves got bigger.
+    void changeSettings(const WavefrontSettings &newSettings) {
+        settings=newSettings;
+    }
+    /// Render every pixel of the frame buffer. Without a scene the pixels are colored by the ray directions,
+    /// otherwise by what the rays hit, with the normals indexed by the triangle ids of the hits.
+    void render(const Camera &camera, const BVH *scene, const std::vector<Vector> &normals, const Color &backgroundColor,
+                FrameBuffer<Color> &pixels, TileScheduler &scheduler);
+};
+
+#endif